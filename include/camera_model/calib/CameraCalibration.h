@@ -1,13 +1,61 @@
 #ifndef CAMERACALIBRATION_H
 #define CAMERACALIBRATION_H
 
+#include <boost/shared_ptr.hpp>
 #include <opencv2/core/core.hpp>
 
+#include "ceres/problem.h"
+#include "ceres/solver.h"
+#include "ceres/types.h"
 #include "camera_model/camera_models/Camera.h"
 
 namespace camera_model
 {
 
+class Transform;
+
+/**
+ * \brief Settings of the Ceres solve that refines a calibration
+ */
+struct CalibrationSolverOptions
+{
+    CalibrationSolverOptions();
+
+    /**
+     * \brief Copies the settings into the options of a Ceres solve
+     *
+     * The elimination ordering depends on the problem and is set by the
+     * calibrators.
+     */
+    void apply(ceres::Solver::Options& options) const;
+
+    int threadCount(void) const;
+
+    // <= 0 for one thread per hardware thread (default)
+    int numThreads;
+    int maxNumIterations;
+    // ceres::SPARSE_SCHUR by default
+    ceres::LinearSolverType linearSolverType;
+    ceres::TrustRegionStrategyType trustRegionStrategyType;
+    // With a Schur-based linear solver, eliminate the poses first and the
+    // intrinsics last; otherwise Ceres chooses the ordering itself.
+    bool useSchurOrdering;
+    // Use the analytic Jacobians of the camera models instead of automatic
+    // differentiation for the reprojection errors
+    bool analyticDerivatives;
+    // Add one residual block per view instead of one per corner; implies
+    // analytic derivatives
+    bool perViewResiduals;
+    // Incremental calibration: number of views of the initial full
+    // calibration, and iterations of the solve after each further view
+    int incrementalInitialViews;
+    int incrementalMaxNumIterations;
+};
+
+/**
+ * Not copyable: the Ceres problem kept between solves points into the
+ * intrinsics and poses owned by the object.
+ */
 class CameraCalibration
 {
 public:
@@ -20,6 +68,9 @@ public:
                       const cv::Size& boardSize,
                       float squareSize);
 
+    CameraCalibration(const CameraCalibration&) = delete;
+    CameraCalibration& operator=(const CameraCalibration&) = delete;
+
     void clear(void);
 
     void addChessboardData(const std::vector<cv::Point2f>& corners);
@@ -27,6 +78,25 @@ public:
 
     bool calibrate(void);
 
+    /**
+     * \brief Refines the last calibration after views were added or removed
+     *
+     * The Ceres problem built by calibrate() is kept between solves. Views
+     * added since then are initialised with the current intrinsics and
+     * joined to it, and the problem is solved again starting from the
+     * current estimates. Changes of the residual options take effect at the
+     * next calibrate(). Falls back to calibrate() if there is no problem yet.
+     *
+     * \param maxNumIterations limit of the solve, <= 0 for the limit of the
+     *        solver options
+     */
+    bool recalibrate(int maxNumIterations = 0);
+
+    /**
+     * \brief Removes view i, and its residuals from the problem
+     */
+    bool removeView(int i);
+
     int sampleCount(void) const;
     std::vector<std::vector<cv::Point2f> >& imagePoints(void);
     const std::vector<std::vector<cv::Point2f> >& imagePoints(void) const;
@@ -50,12 +120,73 @@ public:
 
     void setVerbose(bool verbose);
 
+    void setSolverOptions(const CalibrationSolverOptions& solverOptions);
+    const CalibrationSolverOptions& solverOptions(void) const;
+
+    /**
+     * \brief Updates the calibration as each view is added
+     *
+     * Once incrementalInitialViews views are available, addChessboardData()
+     * and addCornersData() run a full calibration. Each further view only
+     * gets its pose estimated with the current intrinsics, followed by a
+     * solve of at most incrementalMaxNumIterations iterations from the
+     * current estimates. The camera, the poses and both covariances are
+     * updated after every view.
+     */
+    void setIncremental(bool incremental);
+    bool incremental(void) const;
+
+    /**
+     * \brief Covariance of the intrinsics, in the order of
+     *        Camera::writeParameters()
+     *
+     * Scaled by the variance of the reprojection errors. Updated in
+     * incremental mode; empty before the first update or if the intrinsics
+     * are not observable from the views.
+     */
+    const Eigen::MatrixXd& intrinsicsCovariance(void) const;
+
 private:
-    bool calibrateHelper(CameraPtr& camera,
-                         std::vector<cv::Mat>& rvecs, std::vector<cv::Mat>& tvecs) const;
+    /**
+     * \brief Calibrates with the views added so far in incremental mode
+     */
+    void updateIncremental(void);
+
+    bool computeIntrinsicsCovariance(void);
 
-    void optimize(CameraPtr& camera,
-                  std::vector<cv::Mat>& rvecs, std::vector<cv::Mat>& tvecs) const;
+    bool calibrateHelper(CameraPtr& camera,
+                         std::vector<cv::Mat>& rvecs, std::vector<cv::Mat>& tvecs);
+
+    void optimize(std::vector<cv::Mat>& rvecs, std::vector<cv::Mat>& tvecs);
+
+    /**
+     * \brief Replaces the problem by an empty one for the current intrinsics
+     */
+    void resetProblem(void);
+
+    /**
+     * \brief Adds the residuals of the next view not yet in the problem,
+     *        starting from the pose rvec, tvec
+     */
+    void addViewToProblem(const cv::Mat& rvec, const cv::Mat& tvec);
+
+    /**
+     * \brief Solves the problem and copies the intrinsics to the camera
+     *
+     * \param maxNumIterations <= 0 for the limit of the solver options
+     */
+    void solveProblem(int maxNumIterations = 0);
+
+    /**
+     * \brief Current poses of the views in the problem
+     */
+    void problemPoses(std::vector<cv::Mat>& rvecs, std::vector<cv::Mat>& tvecs) const;
+
+    /**
+     * \brief Stores the poses of the views and the covariance of their
+     *        reprojection errors
+     */
+    void updateEstimates(const std::vector<cv::Mat>& rvecs, const std::vector<cv::Mat>& tvecs);
 
     template<typename T>
     void readData(std::ifstream& ifs, T& data) const;
@@ -74,6 +205,20 @@ private:
 
     Eigen::Matrix2d m_measurementCovariance;
 
+    CalibrationSolverOptions m_solverOptions;
+
+    // Problem of the last calibration with the poses of its views, which
+    // are the first views of the data. The loss and the parameterization
+    // are shared by all residual blocks.
+    boost::shared_ptr<ceres::LossFunction> m_lossFunction;
+    boost::shared_ptr<ceres::LocalParameterization> m_quaternionParameterization;
+    std::vector<double> m_intrinsicParams;
+    std::vector<boost::shared_ptr<Transform> > m_viewPoses;
+    boost::shared_ptr<ceres::Problem> m_problem;
+
+    bool m_incremental;
+    Eigen::MatrixXd m_intrinsicsCovariance;
+
     bool m_verbose;
 };
 
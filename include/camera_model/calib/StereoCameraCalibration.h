@@ -40,9 +40,77 @@ public:
     void drawResults(std::vector<cv::Mat>& imagesLeft,
                      std::vector<cv::Mat>& imagesRight) const;
 
+    /**
+     * \brief Computes the rectifying rotations of the calibrated rig and
+     *        the rectification maps of both cameras, see the static
+     *        overload
+     *
+     * The rotations, the camera matrix and the maps are kept and saved by
+     * writeParams().
+     */
+    cv::Mat initStereoRectifyMaps(cv::Mat& mapLeft1, cv::Mat& mapLeft2,
+                                  cv::Mat& mapRight1, cv::Mat& mapRight2,
+                                  float fx = -1.0f, float fy = -1.0f,
+                                  cv::Size imageSize = cv::Size(0, 0),
+                                  float cx = -1.0f, float cy = -1.0f,
+                                  int m1type = CV_32FC1);
+
+    const Eigen::Matrix3d& rectificationLeft(void) const;
+    const Eigen::Matrix3d& rectificationRight(void) const;
+
     void writeParams(const std::string& directory) const;
     void setVerbose(bool verbose);
 
+    /**
+     * \brief Options of the stereo solve and of the calibrations of the
+     *        individual cameras
+     */
+    void setSolverOptions(const CalibrationSolverOptions& solverOptions);
+    const CalibrationSolverOptions& solverOptions(void) const;
+
+    /**
+     * \brief Rotations that make the image planes of a stereo pair
+     *        coplanar, with the baseline along the rectified x-axis
+     *
+     * The extrinsics map points from the left to the right camera frame,
+     * P_r = q * P_l + t. Each camera is rotated by half of q, so that the
+     * rectified views share one orientation, and then about the optical
+     * axis until the baseline is horizontal. Rigs whose baseline is
+     * mostly vertical are aligned to the y-axis instead.
+     *
+     * \param R_left return value, rotation from the left camera frame to
+     *        the rectified frame, as expected by initUndistortRectifyMap()
+     * \param R_right return value, same for the right camera
+     */
+    static void stereoRectify(const Eigen::Quaterniond& q, const Eigen::Vector3d& t,
+                              Eigen::Matrix3d& R_left, Eigen::Matrix3d& R_right);
+
+    /**
+     * \brief Computes the rectification maps of a stereo pair of any two
+     *        camera models
+     *
+     * Both views are rendered through the same virtual pinhole camera. If
+     * fx or fy is not given, it defaults to the mean focal length of the
+     * two cameras at their image centres, measured by lifting neighbouring
+     * pixels; cx and cy default to the centre of the rectified image. The
+     * maps of the two cameras are generated concurrently, each with half
+     * of the numThreads() of cameraLeft.
+     *
+     * \return camera matrix K_rect shared by both rectified views
+     */
+    static cv::Mat initStereoRectifyMaps(const Camera& cameraLeft,
+                                         const Camera& cameraRight,
+                                         const Eigen::Quaterniond& q,
+                                         const Eigen::Vector3d& t,
+                                         cv::Mat& mapLeft1, cv::Mat& mapLeft2,
+                                         cv::Mat& mapRight1, cv::Mat& mapRight2,
+                                         Eigen::Matrix3d& R_left,
+                                         Eigen::Matrix3d& R_right,
+                                         float fx = -1.0f, float fy = -1.0f,
+                                         cv::Size imageSize = cv::Size(0, 0),
+                                         float cx = -1.0f, float cy = -1.0f,
+                                         int m1type = CV_32FC1);
+
 private:
     CameraCalibration m_calibLeft;
     CameraCalibration m_calibRight;
@@ -50,6 +118,14 @@ private:
     Eigen::Quaterniond m_q;
     Eigen::Vector3d m_t;
 
+    // results of the last initStereoRectifyMaps()
+    Eigen::Matrix3d m_rectLeft;
+    Eigen::Matrix3d m_rectRight;
+    cv::Mat m_K_rect;
+    cv::Mat m_rectMaps[4];
+
+    CalibrationSolverOptions m_solverOptions;
+
     bool m_verbose;
 };
 
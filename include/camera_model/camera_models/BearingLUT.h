@@ -0,0 +1,142 @@
+#ifndef BEARINGLUT_H
+#define BEARINGLUT_H
+
+#include <boost/interprocess/interprocess_fwd.hpp>
+#include <boost/shared_ptr.hpp>
+#include <eigen3/Eigen/Dense>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "Camera.h"
+
+namespace camera_model
+{
+
+/**
+ * \brief Per-pixel table of unit bearing vectors
+ *
+ * Stores Camera::liftSphere() of every step-th pixel as packed float
+ * triples (x, y, z), row by row. Subpixel queries interpolate the four
+ * surrounding entries bilinearly and renormalise, which replaces the
+ * iterative or polynomial undistortion of the camera model with four
+ * cache loads.
+ *
+ * Tables can be written to disk and memory-mapped on startup; a mapped
+ * table shares the file pages instead of holding its own copy. Files
+ * record MapCache::cameraKey() of the camera they were built from, so
+ * that tables of an outdated calibration can be rejected. Copies of a
+ * BearingLUT share the same immutable storage.
+ */
+class BearingLUT
+{
+public:
+    BearingLUT();
+
+    /**
+     * \brief Builds the table from a camera, see build()
+     */
+    BearingLUT(const Camera& camera, int step = 1);
+
+    /**
+     * \brief Samples the bearing of every step-th pixel of the camera
+     *
+     * The grid covers the whole image; its last row and column may lie
+     * past the image border. After sampling, the table is compared against
+     * the camera at every cell centre and edge midpoint to obtain
+     * maxAngularError().
+     */
+    void build(const Camera& camera, int step = 1);
+
+    bool empty(void) const;
+
+    int imageWidth(void) const;
+    int imageHeight(void) const;
+    int step(void) const;
+    int cols(void) const;
+    int rows(void) const;
+
+    /**
+     * \brief Largest angle in radians between an interpolated bearing and
+     *        the camera model, measured during build()
+     */
+    double maxAngularError(void) const;
+
+    /**
+     * \brief MapCache::cameraKey() of the camera the table was built from
+     */
+    uint64_t cameraKey(void) const;
+
+    /**
+     * \brief Packed (x, y, z) bearings of the grid nodes, row-major
+     */
+    const float* data(void) const;
+
+    /**
+     * \brief Interpolates the unit bearing of an image point
+     *
+     * Points outside the grid are extrapolated from the nearest cell.
+     */
+    void liftSphere(const Eigen::Vector2d& p, Eigen::Vector3d& P) const;
+    void liftSphere(const Eigen::Vector2f& p, Eigen::Vector3f& P) const;
+
+    /**
+     * \brief Interpolates the unit bearings of a batch of image points
+     *
+     * \param p packed image coordinates (u0, v0, u1, v1, ...)
+     * \param P return value, packed bearings (x0, y0, z0, x1, ...)
+     * \param count number of points
+     */
+    void liftSphere(const float* p, float* P, size_t count) const;
+
+    /**
+     * \brief Writes the table to a versioned binary file
+     */
+    bool writeToFile(const std::string& filename) const;
+
+    /**
+     * \brief Memory-maps a table written by writeToFile()
+     *
+     * \return false if the file cannot be mapped or is not a table of the
+     *         current version; the table is left unchanged in that case
+     */
+    bool readFromFile(const std::string& filename);
+
+    /**
+     * \brief Memory-maps a table written by writeToFile() for camera
+     *
+     * \return false also if the table was built from a camera with other
+     *         parameters, e.g. before a recalibration
+     */
+    bool readFromFile(const std::string& filename, const Camera& camera);
+
+private:
+    /**
+     * \brief Maps the file; cameraKey, if not null, must match its key
+     */
+    bool mapFile(const std::string& filename, const uint64_t* cameraKey);
+
+    template <typename T>
+    void lookup(T u, T v, T* P) const;
+
+    int m_imageWidth;
+    int m_imageHeight;
+    int m_step;
+    int m_cols;
+    int m_rows;
+    float m_invStep;
+    double m_maxAngularError;
+    uint64_t m_cameraKey;
+
+    // m_data points into m_table or m_region, whichever owns the table
+    const float* m_data;
+    boost::shared_ptr<const std::vector<float> > m_table;
+    boost::shared_ptr<boost::interprocess::mapped_region> m_region;
+};
+
+typedef boost::shared_ptr<BearingLUT> BearingLUTPtr;
+typedef boost::shared_ptr<const BearingLUT> BearingLUTConstPtr;
+
+}
+
+#endif
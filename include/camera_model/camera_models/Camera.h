@@ -1,9 +1,11 @@
 #ifndef CAMERA_H
 #define CAMERA_H
 
+#include <boost/function.hpp>
 #include <boost/shared_ptr.hpp>
 #include <eigen3/Eigen/Dense>
 #include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
 #include <vector>
 
 namespace camera_model
@@ -28,6 +30,11 @@ public:
         ARUCO,
         CHARUCO,
     };
+    enum UndistortionMethod
+    {
+        UNDISTORT_FIXED_POINT,
+        UNDISTORT_NEWTON
+    };
     class Parameters
     {
     public:
@@ -60,6 +67,24 @@ public:
         int m_imageHeight;
     };
 
+    /**
+     * \brief Statistics of the reprojection error norms of a set of points
+     */
+    struct ReprojectionStats
+    {
+        ReprojectionStats();
+
+        double mean(void) const;
+        double rms(void) const;
+
+        size_t count;
+        double sum;
+        double sumSquared;
+        double max;
+    };
+
+    Camera();
+
     virtual ModelType modelType(void) const = 0;
     virtual const std::string& cameraName(void) const = 0;
     virtual int imageWidth(void) const = 0;
@@ -89,20 +114,141 @@ public:
 
     // Projects 3D points to the image plane (Pi function)
     // and calculates jacobian
-    //virtual void spaceToPlane(const Eigen::Vector3d& P, Eigen::Vector2d& p,
-    //                          Eigen::Matrix<double,2,3>& J) const = 0;
+    virtual void spaceToPlane(const Eigen::Vector3d& P, Eigen::Vector2d& p,
+                              Eigen::Matrix<double,2,3>& J) const = 0;
+    //%output p
+    //%output J
+
+    // Projects 3D points to the image plane (Pi function)
+    // and calculates the jacobians w.r.t. the point and the intrinsics;
+    // the columns of J_params follow the order of writeParameters()
+    virtual void spaceToPlane(const Eigen::Vector3d& P, Eigen::Vector2d& p,
+                              Eigen::Matrix<double,2,3>& J,
+                              Eigen::Matrix<double,2,Eigen::Dynamic>& J_params) const = 0;
     //%output p
     //%output J
+    //%output J_params
 
     virtual void undistToPlane(const Eigen::Vector2d& p_u, Eigen::Vector2d& p) const = 0;
     //%output p
 
     //virtual void initUndistortMap(cv::Mat& map1, cv::Mat& map2, double fScale = 1.0) const = 0;
+
+    /**
+     * \brief Computes the maps for cv::remap() into a rectified pinhole view
+     *
+     * m1type selects the map format as in cv::initUndistortRectifyMap():
+     * CV_32FC1 returns separate float x and y maps, CV_32FC2 returns a
+     * single interleaved float map and an empty map2, and CV_16SC2 (or any
+     * value <= 0) returns fixed-point integer coordinates in map1 and the
+     * CV_16UC1 interpolation table indices in map2. All formats are written
+     * directly, without intermediate float maps.
+     *
+     * \return the camera matrix of the rectified view
+     */
     virtual cv::Mat initUndistortRectifyMap(cv::Mat& map1, cv::Mat& map2,
                                             float fx = -1.0f, float fy = -1.0f,
                                             cv::Size imageSize = cv::Size(0, 0),
                                             float cx = -1.0f, float cy = -1.0f,
-                                            cv::Mat rmat = cv::Mat::eye(3, 3, CV_32F)) const = 0;
+                                            cv::Mat rmat = cv::Mat::eye(3, 3, CV_32F),
+                                            int m1type = CV_32FC1) const = 0;
+
+    /**
+     * \brief Approximates initUndistortRectifyMap() by interpolating the
+     *        camera model between the nodes of a coarse grid
+     *
+     * Only every gridStep-th pixel in each direction is projected exactly;
+     * the other pixels are interpolated bilinearly (cv::INTER_LINEAR) or
+     * with Catmull-Rom splines (cv::INTER_CUBIC). The map is then checked
+     * against exact projections at the cell centres and edge midpoints,
+     * where the interpolation error peaks, on a sparse subset of cells
+     * that includes the last cell row and column. Pixels that project
+     * outside the source image are not checked, since remap never samples
+     * them.
+     *
+     * \param K_rect camera matrix of the rectified view, e.g. as returned by
+     *        initUndistortRectifyMap()
+     * \param m1type map format, see initUndistortRectifyMap()
+     * \return largest deviation in pixels from the exact map found on the
+     *         validation points; 0 for gridStep 1, where the map is exact
+     */
+    double initApproxUndistortRectifyMap(cv::Mat& map1, cv::Mat& map2,
+                                         const cv::Mat& K_rect,
+                                         cv::Size imageSize = cv::Size(0, 0),
+                                         cv::Mat rmat = cv::Mat::eye(3, 3, CV_32F),
+                                         int gridStep = 8,
+                                         int interpolation = cv::INTER_LINEAR,
+                                         int m1type = CV_32FC1) const;
+
+    /**
+     * \brief Generates the part roi of the maps of the rectified view
+     *        with camera matrix K_rect and rotation rmat
+     *
+     * The maps have the size of roi; their pixel (0, 0) corresponds to
+     * pixel (roi.x, roi.y) of the full maps. Used to build large maps
+     * piece by piece.
+     *
+     * \param m1type map format, see initUndistortRectifyMap()
+     * \param numThreads threads generating the region, < 0 for
+     *        numThreads(); callers that already run on several threads
+     *        pass 1
+     */
+    void initUndistortRectifyMapRegion(cv::Mat& map1, cv::Mat& map2,
+                                       const cv::Mat& K_rect, const cv::Rect& roi,
+                                       cv::Mat rmat = cv::Mat::eye(3, 3, CV_32F),
+                                       int m1type = CV_32FC1,
+                                       int numThreads = -1) const;
+
+    /**
+     * \brief Generates the remap maps of the six faces of a cube map
+     *
+     * Each face is a virtual pinhole view with a 90 degree field of view
+     * and faceSize x faceSize pixels. The faces are ordered +X, -X, +Y,
+     * -Y, +Z, -Z of the cube frame, which is the camera frame rotated by
+     * rmat; +Z looks along the optical axis and image rows run along +Y
+     * on the side faces. All faces are projected in a single parallel
+     * pass over one map of 6 * faceSize rows, and maps1[i] and maps2[i]
+     * are row ranges of it. Rays outside the domain of the model, such as
+     * rays behind a pinhole camera or beyond the valid cone of the Mei
+     * model with xi < 1, are projected as the model projects them and
+     * must be masked by the caller.
+     *
+     * \param m1type map format, see initUndistortRectifyMap()
+     */
+    void initCubemapMaps(std::vector<cv::Mat>& maps1, std::vector<cv::Mat>& maps2,
+                         int faceSize,
+                         cv::Mat rmat = cv::Mat::eye(3, 3, CV_32F),
+                         int m1type = CV_16SC2) const;
+
+    /**
+     * \brief Generates the remap maps of an equirectangular panorama
+     *
+     * Columns sample longitude and rows latitude uniformly, centred on
+     * the optical axis of the frame rotated by rmat. Longitude grows
+     * towards +X and latitude towards +Y. Rays outside the domain of the
+     * model are treated as in initCubemapMaps().
+     *
+     * \param hfov horizontal field of view in radians, 2 pi for a full
+     *        panorama
+     * \param vfov vertical field of view in radians, at most pi
+     * \param m1type map format, see initUndistortRectifyMap()
+     */
+    void initEquirectangularMap(cv::Mat& map1, cv::Mat& map2,
+                                const cv::Size& imageSize,
+                                float hfov = 2.0 * M_PI, float vfov = M_PI,
+                                cv::Mat rmat = cv::Mat::eye(3, 3, CV_32F),
+                                int m1type = CV_16SC2) const;
+
+    /**
+     * \brief Number of threads used to generate undistortion and
+     *        rectification maps and to undistort large point batches
+     *
+     * 0 (the default) selects the number of hardware threads. Rows and
+     * points are computed independently, so the results do not depend on
+     * the thread count.
+     */
+    void setNumThreads(int numThreads);
+    int numThreads(void) const;
 
     virtual int parameterCount(void) const = 0;
 
@@ -133,12 +279,255 @@ public:
                              const Eigen::Vector3d& camera_t,
                              const Eigen::Vector2d& observed_p) const;
 
+    /**
+     * \brief Reprojection error over several views
+     *
+     * \param perViewStats return value, statistics of each view; the vector
+     *        is only resized, so a reused vector does not reallocate
+     * \return mean reprojection error over all points
+     */
+    double reprojectionError(const std::vector< std::vector<cv::Point3f> >& objectPoints,
+                             const std::vector< std::vector<cv::Point2f> >& imagePoints,
+                             const std::vector<cv::Mat>& rvecs,
+                             const std::vector<cv::Mat>& tvecs,
+                             std::vector<ReprojectionStats>& perViewStats) const;
+
+    /**
+     * \brief Projects the points of one view and computes their residuals
+     *
+     * Works through the points in fixed-size chunks on the stack and
+     * allocates no memory.
+     *
+     * \param objectPoints object points in the frame of the view
+     * \param imagePoints observed image points
+     * \param count number of points
+     * \param camera_q rotation from the object frame to the camera frame
+     * \param camera_t translation from the object frame to the camera frame
+     * \param residuals optional return value, packed residuals
+     *        (u0 - u0_obs, v0 - v0_obs, u1 - u1_obs, ...)
+     * \param estImagePoints optional return value, projected points
+     * \return statistics of the residual norms
+     */
+    ReprojectionStats reprojectionResiduals(const cv::Point3f* objectPoints,
+                                            const cv::Point2f* imagePoints,
+                                            size_t count,
+                                            const Eigen::Quaterniond& camera_q,
+                                            const Eigen::Vector3d& camera_t,
+                                            double* residuals = 0,
+                                            cv::Point2f* estImagePoints = 0) const;
+
     void projectPoints(const std::vector<cv::Point3f>& objectPoints,
                        const cv::Mat& rvec,
                        const cv::Mat& tvec,
                        std::vector<cv::Point2f>& imagePoints) const;
+
+    /**
+     * \brief Projects object points into caller-provided storage
+     *
+     * Allocation-free counterpart of projectPoints() with the pose given
+     * as a quaternion and translation.
+     */
+    void projectPoints(const cv::Point3f* objectPoints, size_t count,
+                       const Eigen::Quaterniond& camera_q,
+                       const Eigen::Vector3d& camera_t,
+                       cv::Point2f* imagePoints) const;
+
+    /**
+     * \brief Projects a batch of 3D points to the image plane
+     *
+     * \param P packed 3D point coordinates (x0, y0, z0, x1, y1, z1, ...)
+     * \param p return value, packed image coordinates (u0, v0, u1, v1, ...)
+     * \param count number of points
+     */
+    void spaceToPlane(const double* P, double* p, size_t count) const;
+
+    /**
+     * \brief Projects a batch of 3D points given as separate coordinate arrays
+     */
+    void spaceToPlane(const double* X, const double* Y, const double* Z,
+                      double* u, double* v, size_t count) const;
+
+    void spaceToPlane(const Eigen::Matrix3Xd& P, Eigen::Matrix2Xd& p) const;
+
+    /**
+     * \brief Projects a batch of 3D points and calculates the jacobians
+     *        w.r.t. the points
+     *
+     * \param P packed 3D point coordinates (x0, y0, z0, x1, y1, z1, ...)
+     * \param p return value, packed image coordinates (u0, v0, u1, v1, ...)
+     * \param J return value, column-major 2x3 jacobian of each point,
+     *          6 values per point
+     * \param count number of points
+     */
+    void spaceToPlane(const double* P, double* p, double* J, size_t count) const;
+
+    /**
+     * \brief Projects a batch of 3D points and calculates the jacobians
+     *        w.r.t. the points
+     *
+     * Columns 3i to 3i + 2 of J hold the jacobian of point i.
+     */
+    void spaceToPlane(const Eigen::Matrix3Xd& P, Eigen::Matrix2Xd& p,
+                      Eigen::Matrix<double,2,Eigen::Dynamic>& J) const;
+
+    /**
+     * \brief Lifts a batch of image points to their projective rays
+     *
+     * \param p packed image coordinates (u0, v0, u1, v1, ...)
+     * \param P return value, packed ray coordinates (x0, y0, z0, x1, ...)
+     * \param count number of points
+     */
+    void liftProjective(const double* p, double* P, size_t count) const;
+
+    /**
+     * \brief Lifts a batch of image points given as separate coordinate arrays
+     */
+    void liftProjective(const double* u, const double* v,
+                        double* X, double* Y, double* Z, size_t count) const;
+
+    void liftProjective(const Eigen::Matrix2Xd& p, Eigen::Matrix3Xd& P) const;
+
+    /**
+     * \brief Lifts a batch of image points to the unit sphere
+     *
+     * \param p packed image coordinates (u0, v0, u1, v1, ...)
+     * \param P return value, packed coordinates on the sphere
+     * \param count number of points
+     */
+    void liftSphere(const double* p, double* P, size_t count) const;
+
+    /**
+     * \brief Lifts a batch of image points given as separate coordinate arrays
+     */
+    void liftSphere(const double* u, const double* v,
+                    double* X, double* Y, double* Z, size_t count) const;
+
+    void liftSphere(const Eigen::Matrix2Xd& p, Eigen::Matrix3Xd& P) const;
+
+    /**
+     * \brief Single-precision counterparts of the projection functions
+     *
+     * Camera models evaluate these with their float batch kernels, which
+     * halve the memory traffic of the double versions. Iterative
+     * undistortion still runs in double precision internally.
+     */
+    void spaceToPlane(const Eigen::Vector3f& P, Eigen::Vector2f& p) const;
+    void liftProjective(const Eigen::Vector2f& p, Eigen::Vector3f& P) const;
+    void liftSphere(const Eigen::Vector2f& p, Eigen::Vector3f& P) const;
+
+    void spaceToPlane(const float* P, float* p, size_t count) const;
+    void spaceToPlane(const float* X, const float* Y, const float* Z,
+                      float* u, float* v, size_t count) const;
+    void spaceToPlane(const Eigen::Matrix3Xf& P, Eigen::Matrix2Xf& p) const;
+
+    void liftProjective(const float* p, float* P, size_t count) const;
+    void liftProjective(const float* u, const float* v,
+                        float* X, float* Y, float* Z, size_t count) const;
+    void liftProjective(const Eigen::Matrix2Xf& p, Eigen::Matrix3Xf& P) const;
+
+    void liftSphere(const float* p, float* P, size_t count) const;
+    void liftSphere(const float* u, const float* v,
+                    float* X, float* Y, float* Z, size_t count) const;
+    void liftSphere(const Eigen::Matrix2Xf& p, Eigen::Matrix3Xf& P) const;
+
+    /**
+     * \brief Removes the distortion from a batch of image points
+     *
+     * The points are lifted with the float batch kernel of the model and
+     * divided by z. Without K_new the result is in normalised coordinates;
+     * otherwise it is projected with K_new, e.g. the K_rect of a rectified
+     * view. Large batches are split over numThreads() threads. p_u may
+     * equal p_d. Rays that do not point forward (z <= 0) have no
+     * normalised coordinates and give non-finite results.
+     *
+     * \param p_d packed image coordinates (u0, v0, u1, v1, ...)
+     * \param p_u return value, packed undistorted coordinates
+     * \param count number of points
+     * \param K_new optional camera matrix of the output coordinates
+     */
+    void undistortPoints(const float* p_d, float* p_u, size_t count,
+                         const cv::Mat& K_new = cv::Mat()) const;
+    void undistortPoints(const cv::Point2f* p_d, cv::Point2f* p_u, size_t count,
+                         const cv::Mat& K_new = cv::Mat()) const;
+
+    /**
+     * \brief Distorts a batch of points, the inverse of undistortPoints()
+     *
+     * \param p_u packed normalised coordinates, or pixel coordinates of
+     *        K_new if it is given
+     * \param p_d return value, packed image coordinates
+     */
+    void distortPoints(const float* p_u, float* p_d, size_t count,
+                       const cv::Mat& K_new = cv::Mat()) const;
+    void distortPoints(const cv::Point2f* p_u, cv::Point2f* p_d, size_t count,
+                       const cv::Mat& K_new = cv::Mat()) const;
+
 protected:
+    /**
+     * \brief Batch kernels behind the public batch overloads
+     *
+     * Point i is read from (x[i * inStride], y[i * inStride], z[i * inStride])
+     * and written to (u[i * outStride], v[i * outStride]), so the same kernel
+     * serves both packed and separate coordinate arrays. The default
+     * implementations fall back to the per-point virtual functions; camera
+     * models override them with a tight loop over their own parameters.
+     */
+    virtual void spaceToPlaneBatch(const double* x, const double* y, const double* z,
+                                   int inStride,
+                                   double* u, double* v, int outStride,
+                                   size_t count) const;
+    virtual void liftProjectiveBatch(const double* u, const double* v, int inStride,
+                                     double* x, double* y, double* z,
+                                     int outStride, size_t count) const;
+    virtual void liftSphereBatch(const double* u, const double* v, int inStride,
+                                 double* x, double* y, double* z,
+                                 int outStride, size_t count) const;
+
+    /**
+     * \brief Single-precision batch kernels
+     *
+     * The default implementations convert chunks of points to double and
+     * call the double kernels.
+     */
+    virtual void spaceToPlaneBatch(const float* x, const float* y, const float* z,
+                                   int inStride,
+                                   float* u, float* v, int outStride,
+                                   size_t count) const;
+    virtual void liftProjectiveBatch(const float* u, const float* v, int inStride,
+                                     float* x, float* y, float* z,
+                                     int outStride, size_t count) const;
+    virtual void liftSphereBatch(const float* u, const float* v, int inStride,
+                                 float* x, float* y, float* z,
+                                 int outStride, size_t count) const;
+
+    /**
+     * \brief Fills remap maps with the image points of a ray per pixel
+     *
+     * rays(v, X, Y, Z) writes the rays of the pixels in row v to X, Y and
+     * Z, which are then projected with the single-precision batch kernel
+     * and stored in the format selected by m1type, see
+     * initUndistortRectifyMap(). Rows are distributed over numThreads
+     * threads, or numThreads() threads if it is negative.
+     */
+    void initRectifyMap(const cv::Size& imageSize,
+                        const boost::function<void (int, float*, float*, float*)>& rays,
+                        cv::Mat& map1, cv::Mat& map2, int m1type,
+                        int numThreads = -1) const;
+
+    /**
+     * \brief Fills remap maps for the rays A * (u, v, 1)
+     *
+     * A is usually R_inv * K_rect_inv; it is applied incrementally along
+     * each row instead of with a matrix product per pixel. Pixel (0, 0) of
+     * the maps is pixel offset of the rectified view.
+     */
+    void initRectifyMap(const cv::Size& imageSize, const Eigen::Matrix3f& A,
+                        cv::Mat& map1, cv::Mat& map2, int m1type,
+                        const cv::Point& offset = cv::Point(0, 0),
+                        int numThreads = -1) const;
+
     cv::Mat m_mask;
+    int m_numThreads;
 };
 
 typedef boost::shared_ptr<Camera> CameraPtr;
@@ -0,0 +1,377 @@
+#ifndef CAMERAHANDLE_H
+#define CAMERAHANDLE_H
+
+#include <boost/variant.hpp>
+#include <cmath>
+#include <eigen3/Eigen/Dense>
+
+#include "Camera.h"
+#include "ScaramuzzaCamera.h"
+
+namespace camera_model
+{
+
+/**
+ * \brief Plain parameter structs of the camera models
+ *
+ * Each struct holds the intrinsics of one model by value and implements
+ * its projection inline, so a loop templated on the struct type compiles
+ * to straight-line code with the parameters in registers.
+ *
+ * liftProjective() inverts the distortion with Newton's method to full
+ * precision instead of following the undistortion settings of the camera;
+ * the rays agree with the camera up to its undistortion tolerance.
+ */
+struct PinholeModel
+{
+    double k1, k2, p1, p2;
+    double fx, fy, cx, cy;
+
+    template <typename T>
+    void spaceToPlane(const T* P, T* p) const;
+
+    void liftProjective(const double* p, double* P) const;
+};
+
+struct CataModel
+{
+    double xi;
+    double k1, k2, p1, p2;
+    double gamma1, gamma2, u0, v0;
+
+    template <typename T>
+    void spaceToPlane(const T* P, T* p) const;
+
+    void liftProjective(const double* p, double* P) const;
+};
+
+struct EquidistantModel
+{
+    double k2, k3, k4, k5;
+    double mu, mv, u0, v0;
+
+    template <typename T>
+    void spaceToPlane(const T* P, T* p) const;
+
+    void liftProjective(const double* p, double* P) const;
+};
+
+struct OCAMModel
+{
+    double C, D, E;
+    double center_x, center_y;
+    double poly[SCARAMUZZA_POLY_SIZE];
+    double inv_poly[SCARAMUZZA_INV_POLY_SIZE];
+
+    // number of coefficients up to the last non-zero one
+    int poly_terms;
+    int inv_poly_terms;
+    double inv_scale;
+
+    template <typename T>
+    void spaceToPlane(const T* P, T* p) const;
+
+    void liftProjective(const double* p, double* P) const;
+};
+
+/**
+ * \brief Value-type snapshot of a camera for use in tight loops
+ *
+ * A CameraHandle copies the intrinsics of a Camera into one of the model
+ * structs above. It holds no reference to the camera and is not updated
+ * when the camera changes. The member functions dispatch on the model once
+ * per call; batch functions therefore run their whole loop without virtual
+ * calls. Custom loops can be compiled per model with apply():
+ *
+ * \code
+ * struct ProjectAll : public boost::static_visitor<>
+ * {
+ *     template <typename Model>
+ *     void operator()(const Model& model) const
+ *     {
+ *         for (...) model.spaceToPlane(P, p);
+ *     }
+ * };
+ *
+ * handle.apply(ProjectAll());
+ * \endcode
+ */
+class CameraHandle
+{
+public:
+    typedef boost::variant<PinholeModel, CataModel, EquidistantModel, OCAMModel> Model;
+
+    CameraHandle();
+    explicit CameraHandle(const Camera& camera);
+
+    Camera::ModelType modelType(void) const;
+
+    const Model& model(void) const;
+
+    template <typename Visitor>
+    typename Visitor::result_type apply(const Visitor& visitor) const;
+
+    void spaceToPlane(const Eigen::Vector3d& P, Eigen::Vector2d& p) const;
+    void liftProjective(const Eigen::Vector2d& p, Eigen::Vector3d& P) const;
+    void liftSphere(const Eigen::Vector2d& p, Eigen::Vector3d& P) const;
+
+    /**
+     * \brief Batch versions on packed coordinates, see Camera
+     */
+    void spaceToPlane(const double* P, double* p, size_t count) const;
+    void spaceToPlane(const float* P, float* p, size_t count) const;
+    void liftProjective(const double* p, double* P, size_t count) const;
+    void liftSphere(const double* p, double* P, size_t count) const;
+
+private:
+    Model m_model;
+};
+
+namespace detail
+{
+
+/**
+ * \brief Inverts the radial-tangential distortion on the normalised plane
+ *
+ * Newton's method on p_u + d_u(p_u) = p_d, starting at p_d and halving
+ * the step whenever the residual grows.
+ */
+inline void
+undistortRadTan(double k1, double k2, double p1, double p2,
+                double mx_d, double my_d, double& mx_u, double& my_u)
+{
+    mx_u = mx_d;
+    my_u = my_d;
+
+    double res2_prev = 0.0;
+    double step_x = 0.0, step_y = 0.0;
+
+    for (int i = 0; i <= 10; ++i)
+    {
+        double mx2_u = mx_u * mx_u;
+        double my2_u = my_u * my_u;
+        double mxy_u = mx_u * my_u;
+        double rho2_u = mx2_u + my2_u;
+        double rad_dist_u = k1 * rho2_u + k2 * rho2_u * rho2_u;
+        double f_x = mx_u + mx_u * rad_dist_u + 2.0 * p1 * mxy_u + p2 * (rho2_u + 2.0 * mx2_u) - mx_d;
+        double f_y = my_u + my_u * rad_dist_u + 2.0 * p2 * mxy_u + p1 * (rho2_u + 2.0 * my2_u) - my_d;
+
+        double res2 = f_x * f_x + f_y * f_y;
+        if (res2 <= 1e-24 || i == 10)
+        {
+            break;
+        }
+
+        if (i > 0 && res2 > res2_prev)
+        {
+            // overshot: retreat halfway along the previous step
+            step_x *= 0.5;
+            step_y *= 0.5;
+            mx_u -= step_x;
+            my_u -= step_y;
+            continue;
+        }
+        res2_prev = res2;
+
+        double dr = 2.0 * k1 + 4.0 * k2 * rho2_u;
+        double J11 = 1.0 + rad_dist_u + dr * mx2_u + 2.0 * p1 * my_u + 6.0 * p2 * mx_u;
+        double J12 = dr * mxy_u + 2.0 * p1 * mx_u + 2.0 * p2 * my_u;
+        double J22 = 1.0 + rad_dist_u + dr * my2_u + 6.0 * p1 * my_u + 2.0 * p2 * mx_u;
+        double det = J11 * J22 - J12 * J12;
+        if (std::fabs(det) < 1e-12)
+        {
+            break;
+        }
+        double inv_det = 1.0 / det;
+
+        step_x = -inv_det * (J22 * f_x - J12 * f_y);
+        step_y = -inv_det * (J11 * f_y - J12 * f_x);
+        mx_u += step_x;
+        my_u += step_y;
+    }
+}
+
+template <typename T>
+inline void
+distortRadTan(double k1, double k2, double p1, double p2,
+              T mx_u, T my_u, T& mx_d, T& my_d)
+{
+    T mx2_u = mx_u * mx_u;
+    T my2_u = my_u * my_u;
+    T mxy_u = mx_u * my_u;
+    T rho2_u = mx2_u + my2_u;
+    T rad_dist_u = T(k1) * rho2_u + T(k2) * rho2_u * rho2_u;
+
+    mx_d = mx_u + mx_u * rad_dist_u + T(2.0 * p1) * mxy_u + T(p2) * (rho2_u + T(2) * mx2_u);
+    my_d = my_u + my_u * rad_dist_u + T(2.0 * p2) * mxy_u + T(p1) * (rho2_u + T(2) * my2_u);
+}
+
+}
+
+template <typename T>
+inline void
+PinholeModel::spaceToPlane(const T* P, T* p) const
+{
+    T inv_z = T(1) / P[2];
+
+    T mx_d, my_d;
+    detail::distortRadTan(k1, k2, p1, p2, P[0] * inv_z, P[1] * inv_z, mx_d, my_d);
+
+    p[0] = T(fx) * mx_d + T(cx);
+    p[1] = T(fy) * my_d + T(cy);
+}
+
+inline void
+PinholeModel::liftProjective(const double* p, double* P) const
+{
+    detail::undistortRadTan(k1, k2, p1, p2,
+                            (p[0] - cx) / fx, (p[1] - cy) / fy, P[0], P[1]);
+    P[2] = 1.0;
+}
+
+template <typename T>
+inline void
+CataModel::spaceToPlane(const T* P, T* p) const
+{
+    T inv_z = T(1) / (P[2] + T(xi) * std::sqrt(P[0] * P[0] + P[1] * P[1] + P[2] * P[2]));
+
+    T mx_d, my_d;
+    detail::distortRadTan(k1, k2, p1, p2, P[0] * inv_z, P[1] * inv_z, mx_d, my_d);
+
+    p[0] = T(gamma1) * mx_d + T(u0);
+    p[1] = T(gamma2) * my_d + T(v0);
+}
+
+inline void
+CataModel::liftProjective(const double* p, double* P) const
+{
+    double mx_u, my_u;
+    detail::undistortRadTan(k1, k2, p1, p2,
+                            (p[0] - u0) / gamma1, (p[1] - v0) / gamma2, mx_u, my_u);
+
+    P[0] = mx_u;
+    P[1] = my_u;
+    if (xi == 1.0)
+    {
+        P[2] = (1.0 - mx_u * mx_u - my_u * my_u) / 2.0;
+    }
+    else
+    {
+        double rho2_u = mx_u * mx_u + my_u * my_u;
+        P[2] = 1.0 - xi * (rho2_u + 1.0) / (xi + std::sqrt(1.0 + (1.0 - xi * xi) * rho2_u));
+    }
+}
+
+template <typename T>
+inline void
+EquidistantModel::spaceToPlane(const T* P, T* p) const
+{
+    T rho = std::sqrt(P[0] * P[0] + P[1] * P[1]);
+
+    T mx_u = T(0), my_u = T(0);
+    if (rho > T(0))
+    {
+        T theta = std::atan2(rho, P[2]);
+        T theta2 = theta * theta;
+        T r = theta * (T(1) + theta2 * (T(k2) + theta2 * (T(k3) + theta2 * (T(k4) + theta2 * T(k5)))));
+
+        mx_u = r * P[0] / rho;
+        my_u = r * P[1] / rho;
+    }
+
+    p[0] = T(mu) * mx_u + T(u0);
+    p[1] = T(mv) * my_u + T(v0);
+}
+
+inline void
+EquidistantModel::liftProjective(const double* p, double* P) const
+{
+    double mx_u = (p[0] - u0) / mu;
+    double my_u = (p[1] - v0) / mv;
+    double r_u = std::sqrt(mx_u * mx_u + my_u * my_u);
+
+    if (r_u == 0.0)
+    {
+        P[0] = 0.0;
+        P[1] = 0.0;
+        P[2] = 1.0;
+        return;
+    }
+
+    // Newton's method on r(theta) = r_u, starting at the equidistant angle
+    double theta = r_u;
+    for (int i = 0; i < 10; ++i)
+    {
+        double theta2 = theta * theta;
+        double f = theta * (1.0 + theta2 * (k2 + theta2 * (k3 + theta2 * (k4 + theta2 * k5)))) - r_u;
+        double df = 1.0 + theta2 * (3.0 * k2 + theta2 * (5.0 * k3 + theta2 * (7.0 * k4 + theta2 * 9.0 * k5)));
+
+        double step = f / df;
+        theta -= step;
+
+        if (std::fabs(step) <= 1e-14)
+        {
+            break;
+        }
+    }
+
+    double sin_theta = std::sin(theta);
+    P[0] = sin_theta * mx_u / r_u;
+    P[1] = sin_theta * my_u / r_u;
+    P[2] = std::cos(theta);
+}
+
+template <typename T>
+inline void
+OCAMModel::spaceToPlane(const T* P, T* p) const
+{
+    T norm = std::sqrt(P[0] * P[0] + P[1] * P[1]);
+    T theta = std::atan2(-P[2], norm);
+
+    T rho = T(0);
+    for (int i = inv_poly_terms - 1; i >= 0; --i)
+    {
+        rho = rho * theta + T(inv_poly[i]);
+    }
+
+    T xn0 = P[0] / norm * rho;
+    T xn1 = P[1] / norm * rho;
+
+    p[0] = xn0 * T(C) + xn1 * T(D) + T(center_x);
+    p[1] = xn0 * T(E) + xn1 + T(center_y);
+}
+
+inline void
+OCAMModel::liftProjective(const double* p, double* P) const
+{
+    // Relative to Center
+    double xc0 = p[0] - center_x;
+    double xc1 = p[1] - center_y;
+
+    // Affine Transformation
+    double xc_a0 = inv_scale * (xc0 - D * xc1);
+    double xc_a1 = inv_scale * (-E * xc0 + C * xc1);
+
+    double phi = std::sqrt(xc_a0 * xc_a0 + xc_a1 * xc_a1);
+
+    double z = 0.0;
+    for (int i = poly_terms - 1; i >= 0; --i)
+    {
+        z = z * phi + poly[i];
+    }
+
+    P[0] = xc0;
+    P[1] = xc1;
+    P[2] = -z;
+}
+
+template <typename Visitor>
+typename Visitor::result_type
+CameraHandle::apply(const Visitor& visitor) const
+{
+    return boost::apply_visitor(visitor, m_model);
+}
+
+}
+
+#endif
@@ -9,6 +9,7 @@
 namespace ceres
 {
     class CostFunction;
+    class LossFunction;
 }
 
 namespace camera_model
@@ -22,7 +23,10 @@ enum
     ODOMETRY_INTRINSICS =       1 << 3,
     ODOMETRY_3D_POSE =          1 << 4,
     ODOMETRY_6D_POSE =          1 << 5,
-    CAMERA_ODOMETRY_TRANSFORM = 1 << 6
+    CAMERA_ODOMETRY_TRANSFORM = 1 << 6,
+    // Use analytic instead of automatic derivatives. Only available for
+    // CAMERA_INTRINSICS | CAMERA_POSE, ignored otherwise.
+    ANALYTIC_DERIVATIVES =      1 << 7
 };
 
 class CostFunctionFactory
@@ -44,6 +48,22 @@ public:
                                               const Eigen::Matrix2d& sqrtPrecisionMat,
                                               int flags) const;
 
+    /**
+     * \brief Reprojection errors of all corners of one view in a single
+     *        residual block
+     *
+     * Only CAMERA_INTRINSICS | CAMERA_POSE is supported, always with
+     * analytic derivatives. The robust loss, if not null, is applied to
+     * each corner separately, so the block must be added to the problem
+     * without a loss function. lossFunction is not owned and must
+     * outlive the cost function, so that all views can share one.
+     */
+    ceres::CostFunction* generateCostFunction(const CameraConstPtr& camera,
+                                              const std::vector<cv::Point3f>& observed_P,
+                                              const std::vector<cv::Point2f>& observed_p,
+                                              const ceres::LossFunction* lossFunction,
+                                              int flags) const;
+
     ceres::CostFunction* generateCostFunction(const CameraConstPtr& camera,
                                               const Eigen::Vector2d& observed_p,
                                               int flags, bool optimize_cam_odo_z = true) const;
@@ -89,6 +89,10 @@ public:
                             const std::vector< std::vector<cv::Point3f> >& objectPoints,
                             const std::vector< std::vector<cv::Point2f> >& imagePoints);
 
+    using Camera::liftSphere;
+    using Camera::liftProjective;
+    using Camera::spaceToPlane;
+
     // Lift points from the image plane to the sphere
     virtual void liftSphere(const Eigen::Vector2d& p, Eigen::Vector3d& P) const;
     //%output P
@@ -108,6 +112,15 @@ public:
     //%output p
     //%output J
 
+    // Projects 3D points to the image plane (Pi function)
+    // and calculates the jacobians w.r.t. the point and the intrinsics
+    void spaceToPlane(const Eigen::Vector3d& P, Eigen::Vector2d& p,
+                      Eigen::Matrix<double,2,3>& J,
+                      Eigen::Matrix<double,2,Eigen::Dynamic>& J_params) const;
+    //%output p
+    //%output J
+    //%output J_params
+
     void undistToPlane(const Eigen::Vector2d& p_u, Eigen::Vector2d& p) const;
     //%output p
 
@@ -117,12 +130,14 @@ public:
                              const Eigen::Matrix<T, 3, 1>& P,
                              Eigen::Matrix<T, 2, 1>& p);
 
-    void initUndistortMap(cv::Mat& map1, cv::Mat& map2, double fScale = 1.0) const;
+    void initUndistortMap(cv::Mat& map1, cv::Mat& map2, double fScale = 1.0,
+                          int m1type = CV_32FC1) const;
     cv::Mat initUndistortRectifyMap(cv::Mat& map1, cv::Mat& map2,
                                     float fx = -1.0f, float fy = -1.0f,
                                     cv::Size imageSize = cv::Size(0, 0),
                                     float cx = -1.0f, float cy = -1.0f,
-                                    cv::Mat rmat = cv::Mat::eye(3, 3, CV_32F)) const;
+                                    cv::Mat rmat = cv::Mat::eye(3, 3, CV_32F),
+                                    int m1type = CV_32FC1) const;
 
     int parameterCount(void) const;
 
@@ -136,10 +151,42 @@ public:
 
     std::string parametersToString(void) const;
 
+protected:
+    void spaceToPlaneBatch(const double* x, const double* y, const double* z,
+                           int inStride,
+                           double* u, double* v, int outStride,
+                           size_t count) const;
+    void liftProjectiveBatch(const double* u, const double* v, int inStride,
+                             double* x, double* y, double* z,
+                             int outStride, size_t count) const;
+    void liftSphereBatch(const double* u, const double* v, int inStride,
+                         double* x, double* y, double* z,
+                         int outStride, size_t count) const;
+
+    void spaceToPlaneBatch(const float* x, const float* y, const float* z,
+                           int inStride,
+                           float* u, float* v, int outStride,
+                           size_t count) const;
+    void liftProjectiveBatch(const float* u, const float* v, int inStride,
+                             float* x, float* y, float* z,
+                             int outStride, size_t count) const;
+    void liftSphereBatch(const float* u, const float* v, int inStride,
+                         float* x, float* y, float* z,
+                         int outStride, size_t count) const;
+
 private:
     template<typename T>
     static T r(T k2, T k3, T k4, T k5, T theta);
 
+    template <typename T>
+    void spaceToPlaneBatchImpl(const T* x, const T* y, const T* z,
+                               int inStride,
+                               T* u, T* v, int outStride,
+                               size_t count) const;
+    template <typename T>
+    void liftProjectiveBatchImpl(const T* u, const T* v, int inStride,
+                                 T* x, T* y, T* z,
+                                 int outStride, size_t count) const;
 
     void fitOddPoly(const std::vector<double>& x, const std::vector<double>& y,
                     int n, std::vector<double>& coeffs) const;
@@ -147,9 +194,28 @@ private:
     void backprojectSymmetric(const Eigen::Vector2d& p_u,
                               double& theta, double& phi) const;
 
+    // theta(r) sampled at uniform steps of r over the range where r(theta)
+    // is monotonic, see buildThetaTable()
+    struct ThetaTable
+    {
+        std::vector<double> theta;
+        double invStep;
+        double maxR;
+        double thetaMax;
+    };
+
+    boost::shared_ptr<const ThetaTable> thetaTable(void) const;
+    boost::shared_ptr<const ThetaTable> buildThetaTable(void) const;
+    double thetaFromTable(const ThetaTable& table, double r_theta) const;
+
     Parameters mParameters;
 
     double m_inv_K11, m_inv_K13, m_inv_K22, m_inv_K23;
+
+    // Built on first use by thetaTable() and dropped when the parameters
+    // change, so that cost functions can re-read the parameters for every
+    // residual without paying for the table. Copies share the table.
+    mutable boost::shared_ptr<const ThetaTable> m_thetaTable;
 };
 
 typedef boost::shared_ptr<EquidistantCamera> EquidistantCameraPtr;
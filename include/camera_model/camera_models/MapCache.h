@@ -0,0 +1,93 @@
+#ifndef MAPCACHE_H
+#define MAPCACHE_H
+
+#include <opencv2/core/core.hpp>
+#include <stdint.h>
+#include <string>
+
+#include "Camera.h"
+
+namespace camera_model
+{
+
+/**
+ * \brief On-disk cache of undistortion and rectification maps
+ *
+ * Each cache file holds one map pair together with the camera matrix of
+ * the rectified view and a 64-bit key. The key hashes everything the maps
+ * depend on: the model type, the image size and writeParameters() vector
+ * of the camera, and the arguments of initUndistortRectifyMap(). If the
+ * key of an existing file matches, the maps are memory-mapped from it;
+ * otherwise they are generated by the camera and the file is rewritten.
+ *
+ * Loaded maps point into a copy-on-write mapping of the file, which stays
+ * mapped for as long as the maps or copies of them exist, independent of
+ * the cache object. A cache object must not be used from several threads
+ * at once.
+ */
+class MapCache
+{
+public:
+    MapCache();
+
+    /**
+     * \brief Returns the maps of camera.initUndistortRectifyMap(), from
+     *        the cache file if it is up to date
+     *
+     * A file that is missing, of another version or whose key does not
+     * match is replaced by the newly generated maps. The new file is
+     * written next to the old one and renamed over it, so processes that
+     * still map the old file are not affected.
+     *
+     * \return camera matrix of the rectified view
+     */
+    cv::Mat initUndistortRectifyMap(const std::string& filename,
+                                    const Camera& camera,
+                                    cv::Mat& map1, cv::Mat& map2,
+                                    float fx = -1.0f, float fy = -1.0f,
+                                    cv::Size imageSize = cv::Size(0, 0),
+                                    float cx = -1.0f, float cy = -1.0f,
+                                    cv::Mat rmat = cv::Mat::eye(3, 3, CV_32F),
+                                    int m1type = CV_32FC1);
+
+    /**
+     * \brief Whether the last call to initUndistortRectifyMap() loaded the
+     *        maps from the cache file
+     */
+    bool lastLoadWasHit(void) const;
+
+    /**
+     * \brief Cache key of a map pair, see the class description
+     */
+    static uint64_t key(const Camera& camera,
+                        float fx, float fy, cv::Size imageSize,
+                        float cx, float cy, const cv::Mat& rmat,
+                        int m1type);
+
+    /**
+     * \brief Hash of the model type, the image size and the
+     *        writeParameters() vector of camera
+     *
+     * Changes whenever the camera is recalibrated; also used to tie other
+     * tables derived from a camera, such as BearingLUT files, to it.
+     */
+    static uint64_t cameraKey(const Camera& camera);
+
+    /**
+     * \brief Writes a map pair and its rectified camera matrix to a cache
+     *        file with the given key
+     */
+    static bool writeToFile(const std::string& filename, uint64_t key,
+                            const cv::Mat& map1, const cv::Mat& map2,
+                            const cv::Mat& K_rect);
+
+private:
+    bool readFromFile(const std::string& filename, uint64_t key,
+                      cv::Mat& map1, cv::Mat& map2, cv::Mat& K_rect);
+
+    bool m_lastLoadWasHit;
+};
+
+}
+
+#endif
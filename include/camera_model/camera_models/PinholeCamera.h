@@ -81,6 +81,10 @@ public:
                             const std::vector< std::vector<cv::Point3f> >& objectPoints,
                             const std::vector< std::vector<cv::Point2f> >& imagePoints);
 
+    using Camera::liftSphere;
+    using Camera::liftProjective;
+    using Camera::spaceToPlane;
+
     // Lift points from the image plane to the sphere
     virtual void liftSphere(const Eigen::Vector2d& p, Eigen::Vector3d& P) const;
     //%output P
@@ -100,6 +104,15 @@ public:
     //%output p
     //%output J
 
+    // Projects 3D points to the image plane (Pi function)
+    // and calculates the jacobians w.r.t. the point and the intrinsics
+    void spaceToPlane(const Eigen::Vector3d& P, Eigen::Vector2d& p,
+                      Eigen::Matrix<double,2,3>& J,
+                      Eigen::Matrix<double,2,Eigen::Dynamic>& J_params) const;
+    //%output p
+    //%output J
+    //%output J_params
+
     void undistToPlane(const Eigen::Vector2d& p_u, Eigen::Vector2d& p) const;
     //%output p
 
@@ -113,12 +126,49 @@ public:
     void distortion(const Eigen::Vector2d& p_u, Eigen::Vector2d& d_u,
                     Eigen::Matrix2d& J) const;
 
-    void initUndistortMap(cv::Mat& map1, cv::Mat& map2, double fScale = 1.0) const;
+    /**
+     * \brief Selects how distortion is inverted when lifting points
+     *
+     * UNDISTORT_FIXED_POINT runs the recursive distortion model,
+     * UNDISTORT_NEWTON runs Newton's method on p_u + d_u(p_u) = p_d using
+     * the analytic distortion Jacobian. Iteration stops once the update
+     * (fixed point) or the residual (Newton) drops below the tolerance.
+     * The default is the fixed-point model with 8 iterations and no early
+     * exit.
+     */
+    void setUndistortionMethod(UndistortionMethod method,
+                               int maxIterations = 10,
+                               double tolerance = 1e-12);
+    UndistortionMethod undistortionMethod(void) const;
+
+    /**
+     * \brief Removes distortion from a point on the normalised plane
+     *
+     * \param p_d distorted coordinates on the normalised plane
+     * \param p_u return value, undistorted coordinates
+     * \return norm of the residual p_u + d_u(p_u) - p_d
+     */
+    double undistort(const Eigen::Vector2d& p_d, Eigen::Vector2d& p_u) const;
+
+    /**
+     * \brief Removes distortion from a batch of points on the normalised plane
+     *
+     * \param p_d packed distorted coordinates (x0, y0, x1, y1, ...)
+     * \param p_u return value, packed undistorted coordinates
+     * \param count number of points
+     * \param residuals optional return value, residual norm of each point
+     */
+    void undistort(const double* p_d, double* p_u, size_t count,
+                   double* residuals = 0) const;
+
+    void initUndistortMap(cv::Mat& map1, cv::Mat& map2, double fScale = 1.0,
+                          int m1type = CV_32FC1) const;
     cv::Mat initUndistortRectifyMap(cv::Mat& map1, cv::Mat& map2,
                                     float fx = -1.0f, float fy = -1.0f,
                                     cv::Size imageSize = cv::Size(0, 0),
                                     float cx = -1.0f, float cy = -1.0f,
-                                    cv::Mat rmat = cv::Mat::eye(3, 3, CV_32F)) const;
+                                    cv::Mat rmat = cv::Mat::eye(3, 3, CV_32F),
+                                    int m1type = CV_32FC1) const;
 
     int parameterCount(void) const;
 
@@ -132,11 +182,56 @@ public:
 
     std::string parametersToString(void) const;
 
+protected:
+    void spaceToPlaneBatch(const double* x, const double* y, const double* z,
+                           int inStride,
+                           double* u, double* v, int outStride,
+                           size_t count) const;
+    void liftProjectiveBatch(const double* u, const double* v, int inStride,
+                             double* x, double* y, double* z,
+                             int outStride, size_t count) const;
+    void liftSphereBatch(const double* u, const double* v, int inStride,
+                         double* x, double* y, double* z,
+                         int outStride, size_t count) const;
+
+    void spaceToPlaneBatch(const float* x, const float* y, const float* z,
+                           int inStride,
+                           float* u, float* v, int outStride,
+                           size_t count) const;
+    void liftProjectiveBatch(const float* u, const float* v, int inStride,
+                             float* x, float* y, float* z,
+                             int outStride, size_t count) const;
+    void liftSphereBatch(const float* u, const float* v, int inStride,
+                         float* x, float* y, float* z,
+                         int outStride, size_t count) const;
+
 private:
+    template <typename T>
+    void spaceToPlaneBatchImpl(const T* x, const T* y, const T* z,
+                               int inStride,
+                               T* u, T* v, int outStride,
+                               size_t count) const;
+    template <typename T>
+    void liftProjectiveBatchImpl(const T* u, const T* v, int inStride,
+                                 T* x, T* y, T* z,
+                                 int outStride, size_t count) const;
+    template <typename T>
+    void liftSphereBatchImpl(const T* u, const T* v, int inStride,
+                             T* x, T* y, T* z,
+                             int outStride, size_t count) const;
+
+    double undistortPoint(double mx_d, double my_d,
+                          double& mx_u, double& my_u,
+                          bool computeResidual) const;
+
     Parameters mParameters;
 
     double m_inv_K11, m_inv_K13, m_inv_K22, m_inv_K23;
     bool m_noDistortion;
+
+    UndistortionMethod m_undistortMethod;
+    int m_undistortMaxIterations;
+    double m_undistortTolerance;
 };
 
 typedef boost::shared_ptr<PinholeCamera> PinholeCameraPtr;
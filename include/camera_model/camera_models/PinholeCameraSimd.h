@@ -0,0 +1,71 @@
+#ifndef PINHOLECAMERASIMD_H
+#define PINHOLECAMERASIMD_H
+
+#include <cstddef>
+
+namespace camera_model
+{
+
+/**
+ * \brief Vectorized kernels for the pinhole projection and distortion model
+ *
+ * The kernels work on separate coordinate arrays and take the intrinsics in
+ * the same order as PinholeCamera::writeParameters():
+ * k1, k2, p1, p2, fx, fy, cx, cy.
+ *
+ * The instruction set is chosen once at runtime (AVX-512, AVX2+FMA or a
+ * scalar fallback); results agree with the scalar model up to rounding.
+ */
+enum PinholeSimdIsa
+{
+    PINHOLE_SIMD_SCALAR,
+    PINHOLE_SIMD_AVX2,
+    PINHOLE_SIMD_AVX512
+};
+
+/**
+ * \brief Returns the instruction set used by the kernels
+ */
+PinholeSimdIsa pinholeSimdIsa(void);
+
+/**
+ * \brief Restricts the kernels to the given instruction set
+ *
+ * Requests for an instruction set the CPU does not support fall back to
+ * the best supported one. Intended for benchmarking and debugging.
+ */
+void setPinholeSimdIsa(PinholeSimdIsa isa);
+
+/**
+ * \brief Projects 3D points to the image plane
+ *
+ * \param params intrinsics k1, k2, p1, p2, fx, fy, cx, cy
+ * \param x, y, z 3D point coordinates
+ * \param u, v return value, image point coordinates
+ * \param count number of points
+ */
+void pinholeSpaceToPlaneSimd(const double* params,
+                             const double* x, const double* y, const double* z,
+                             double* u, double* v, size_t count);
+void pinholeSpaceToPlaneSimd(const float* params,
+                             const float* x, const float* y, const float* z,
+                             float* u, float* v, size_t count);
+
+/**
+ * \brief Applies distortion to points on the normalised plane
+ *
+ * \param params intrinsics k1, k2, p1, p2, fx, fy, cx, cy
+ * \param mx, my undistorted coordinates on the normalised plane
+ * \param dx, dy return value, to obtain the distorted point: p_d = p_u + d_u
+ * \param count number of points
+ */
+void pinholeDistortionSimd(const double* params,
+                           const double* mx, const double* my,
+                           double* dx, double* dy, size_t count);
+void pinholeDistortionSimd(const float* params,
+                           const float* mx, const float* my,
+                           float* dx, float* dy, size_t count);
+
+}
+
+#endif
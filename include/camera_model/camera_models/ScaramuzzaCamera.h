@@ -45,8 +45,8 @@ namespace camera_model
             double center_x(void) const { return m_center_x; }
             double center_y(void) const { return m_center_y; }
 
-            double poly(int idx) const { return m_poly[idx]; }
-            double inv_poly(int idx) const { return m_inv_poly[idx]; }
+            const double &poly(int idx) const { return m_poly[idx]; }
+            const double &inv_poly(int idx) const { return m_inv_poly[idx]; }
 
             bool readFromYamlFile(const std::string &filename);
             void writeToYamlFile(const std::string &filename) const;
@@ -80,6 +80,10 @@ namespace camera_model
                                 const std::vector<std::vector<cv::Point3f>> &objectPoints,
                                 const std::vector<std::vector<cv::Point2f>> &imagePoints);
 
+        using Camera::liftSphere;
+        using Camera::liftProjective;
+        using Camera::spaceToPlane;
+
         // Lift points from the image plane to the sphere
         void liftSphere(const Eigen::Vector2d &p, Eigen::Vector3d &P) const;
         //%output P
@@ -94,10 +98,19 @@ namespace camera_model
 
         // Projects 3D points to the image plane (Pi function)
         // and calculates jacobian
-        //void spaceToPlane(const Eigen::Vector3d& P, Eigen::Vector2d& p,
-        //                  Eigen::Matrix<double,2,3>& J) const;
+        void spaceToPlane(const Eigen::Vector3d &P, Eigen::Vector2d &p,
+                          Eigen::Matrix<double, 2, 3> &J) const;
+        //%output p
+        //%output J
+
+        // Projects 3D points to the image plane (Pi function)
+        // and calculates the jacobians w.r.t. the point and the intrinsics
+        void spaceToPlane(const Eigen::Vector3d &P, Eigen::Vector2d &p,
+                          Eigen::Matrix<double, 2, 3> &J,
+                          Eigen::Matrix<double, 2, Eigen::Dynamic> &J_params) const;
         //%output p
         //%output J
+        //%output J_params
 
         void undistToPlane(const Eigen::Vector2d &p_u, Eigen::Vector2d &p) const;
         //%output p
@@ -121,12 +134,16 @@ namespace camera_model
         static void SphereToPlane(const T *const params, const Eigen::Matrix<T, 3, 1> &P,
                                   Eigen::Matrix<T, 2, 1> &p);
 
-        void initUndistortMap(cv::Mat &map1, cv::Mat &map2, double fScale = 1.0) const;
+        // Maps a perspective view onto the image; the focal length of the
+        // view defaults to |poly[0]|, the scale at the principal point
+        void initUndistortMap(cv::Mat &map1, cv::Mat &map2, double fScale = 1.0,
+                              int m1type = CV_32FC1) const;
         cv::Mat initUndistortRectifyMap(cv::Mat &map1, cv::Mat &map2,
                                         float fx = -1.0f, float fy = -1.0f,
                                         cv::Size imageSize = cv::Size(0, 0),
                                         float cx = -1.0f, float cy = -1.0f,
-                                        cv::Mat rmat = cv::Mat::eye(3, 3, CV_32F)) const;
+                                        cv::Mat rmat = cv::Mat::eye(3, 3, CV_32F),
+                                        int m1type = CV_32FC1) const;
 
         int parameterCount(void) const;
 
@@ -140,10 +157,75 @@ namespace camera_model
 
         std::string parametersToString(void) const;
 
+    protected:
+        void spaceToPlaneBatch(const double *x, const double *y, const double *z,
+                               int inStride,
+                               double *u, double *v, int outStride,
+                               size_t count) const;
+        void liftProjectiveBatch(const double *u, const double *v, int inStride,
+                                 double *x, double *y, double *z,
+                                 int outStride, size_t count) const;
+        void liftSphereBatch(const double *u, const double *v, int inStride,
+                             double *x, double *y, double *z,
+                             int outStride, size_t count) const;
+
+        void spaceToPlaneBatch(const float *x, const float *y, const float *z,
+                               int inStride,
+                               float *u, float *v, int outStride,
+                               size_t count) const;
+        void liftProjectiveBatch(const float *u, const float *v, int inStride,
+                                 float *x, float *y, float *z,
+                                 int outStride, size_t count) const;
+        void liftSphereBatch(const float *u, const float *v, int inStride,
+                             float *x, float *y, float *z,
+                             int outStride, size_t count) const;
+
     private:
+        template <typename T>
+        void spaceToPlaneBatchImpl(const T *x, const T *y, const T *z,
+                                   int inStride,
+                                   T *u, T *v, int outStride,
+                                   size_t count) const;
+        template <int N, typename T>
+        void spaceToPlaneBatchFixed(const T *x, const T *y, const T *z,
+                                    int inStride,
+                                    T *u, T *v, int outStride,
+                                    size_t count) const;
+        template <typename T>
+        void liftProjectiveBatchImpl(const T *u, const T *v, int inStride,
+                                     T *x, T *y, T *z,
+                                     int outStride, size_t count) const;
+        template <typename T>
+        void liftSphereBatchImpl(const T *u, const T *v, int inStride,
+                                 T *x, T *y, T *z,
+                                 int outStride, size_t count) const;
+
+        /**
+         * \brief Number of terms up to and including the highest nonzero coefficient
+         */
+        template <typename T>
+        static int polyTerms(const T *const coeffs, int size);
+
+        /**
+         * \brief Evaluates the first \a terms coefficients with Horner's scheme
+         *
+         * Common orders dispatch to a fully unrolled instantiation.
+         */
+        template <typename T>
+        static T evalPoly(const T *const coeffs, int terms, const T &x);
+
+        template <int N, typename T>
+        static T evalPolyFixed(const T *const coeffs, const T &x);
+
+        void updatePolyTerms(void);
+
+        float naturalFocalLength(void) const;
+
         Parameters mParameters;
 
         double m_inv_scale;
+        int m_poly_terms;
+        int m_inv_poly_terms;
     };
 
     typedef boost::shared_ptr<OCAMCamera> OCAMCameraPtr;
@@ -179,13 +261,9 @@ namespace camera_model
         T e = params[2];
         T xc[2] = {params[3], params[4]};
 
-        //T poly[SCARAMUZZA_POLY_SIZE];
-        //for (int i=0; i < SCARAMUZZA_POLY_SIZE; i++)
-        //    poly[i] = params[5+i];
-
-        T inv_poly[SCARAMUZZA_INV_POLY_SIZE];
-        for (int i = 0; i < SCARAMUZZA_INV_POLY_SIZE; i++)
-            inv_poly[i] = params[5 + SCARAMUZZA_POLY_SIZE + i];
+        // All coefficients are evaluated so that every one of them gets a
+        // gradient when the intrinsics are optimized.
+        const T *const inv_poly = params + 5 + SCARAMUZZA_POLY_SIZE;
 
         T norm_sqr = P_c[0] * P_c[0] + P_c[1] * P_c[1];
         T norm = T(0.0);
@@ -193,14 +271,7 @@ namespace camera_model
             norm = sqrt(norm_sqr);
 
         T theta = atan2(-P_c[2], norm);
-        T rho = T(0.0);
-        T theta_i = T(1.0);
-
-        for (int i = 0; i < SCARAMUZZA_INV_POLY_SIZE; i++)
-        {
-            rho += theta_i * inv_poly[i];
-            theta_i *= theta;
-        }
+        T rho = evalPolyFixed<SCARAMUZZA_INV_POLY_SIZE>(inv_poly, theta);
 
         T invNorm = T(1.0) / norm;
         T xn[2] = {
@@ -320,9 +391,7 @@ namespace camera_model
         T e = params[2];
         T xc[2] = {params[3], params[4]};
 
-        T inv_poly[SCARAMUZZA_INV_POLY_SIZE];
-        for (int i = 0; i < SCARAMUZZA_INV_POLY_SIZE; i++)
-            inv_poly[i] = params[5 + SCARAMUZZA_POLY_SIZE + i];
+        const T *const inv_poly = params + 5 + SCARAMUZZA_POLY_SIZE;
 
         T norm_sqr = P_c[0] * P_c[0] + P_c[1] * P_c[1];
         T norm = T(0.0);
@@ -330,14 +399,7 @@ namespace camera_model
             norm = sqrt(norm_sqr);
 
         T theta = atan2(-P_c[2], norm);
-        T rho = T(0.0);
-        T theta_i = T(1.0);
-
-        for (int i = 0; i < SCARAMUZZA_INV_POLY_SIZE; i++)
-        {
-            rho += theta_i * inv_poly[i];
-            theta_i *= theta;
-        }
+        T rho = evalPolyFixed<SCARAMUZZA_INV_POLY_SIZE>(inv_poly, theta);
 
         T invNorm = T(1.0) / norm;
         T xn[2] = {P_c[0] * invNorm * rho, P_c[1] * invNorm * rho};
@@ -345,6 +407,71 @@ namespace camera_model
         p(0) = xn[0] * c + xn[1] * d + xc[0];
         p(1) = xn[0] * e + xn[1] + xc[1];
     }
+
+    template <typename T>
+    int
+    OCAMCamera::polyTerms(const T *const coeffs, int size)
+    {
+        int terms = size;
+        while (terms > 0 && coeffs[terms - 1] == T(0.0))
+            --terms;
+
+        return terms;
+    }
+
+    template <int N, typename T>
+    T
+    OCAMCamera::evalPolyFixed(const T *const coeffs, const T &x)
+    {
+        T y = coeffs[N - 1];
+        for (int i = N - 2; i >= 0; --i)
+            y = y * x + coeffs[i];
+
+        return y;
+    }
+
+    template <typename T>
+    T
+    OCAMCamera::evalPoly(const T *const coeffs, int terms, const T &x)
+    {
+        switch (terms)
+        {
+        case 0:
+            return T(0.0);
+        case 1:
+            return coeffs[0];
+        case 2:
+            return evalPolyFixed<2>(coeffs, x);
+        case 3:
+            return evalPolyFixed<3>(coeffs, x);
+        case 4:
+            return evalPolyFixed<4>(coeffs, x);
+        case 5:
+            return evalPolyFixed<5>(coeffs, x);
+        case 6:
+            return evalPolyFixed<6>(coeffs, x);
+        case 7:
+            return evalPolyFixed<7>(coeffs, x);
+        case 8:
+            return evalPolyFixed<8>(coeffs, x);
+        case 9:
+            return evalPolyFixed<9>(coeffs, x);
+        case 10:
+            return evalPolyFixed<10>(coeffs, x);
+        case 11:
+            return evalPolyFixed<11>(coeffs, x);
+        case 12:
+            return evalPolyFixed<12>(coeffs, x);
+        default:
+        {
+            T y = coeffs[terms - 1];
+            for (int i = terms - 2; i >= 0; --i)
+                y = y * x + coeffs[i];
+
+            return y;
+        }
+        }
+    }
 } // namespace camera_model
 
 #endif
@@ -0,0 +1,172 @@
+#ifndef TILEDRECTIFYMAP_H
+#define TILEDRECTIFYMAP_H
+
+#include <boost/shared_ptr.hpp>
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <mutex>
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+#include <thread>
+#include <vector>
+
+#include "Camera.h"
+
+namespace camera_model
+{
+
+/**
+ * \brief Undistortion and rectification maps generated tile by tile on
+ *        demand
+ *
+ * The rectified view is divided into tiles whose maps are computed with
+ * Camera::initUndistortRectifyMapRegion() the first time they are needed.
+ * Tiles are kept in least-recently-used order and evicted once their total
+ * size exceeds the memory budget, so consumers that only read regions of
+ * very large frames never materialise the full maps.
+ *
+ * Tiles can be prefetched on a background thread. All member functions may
+ * be called from several threads at once; a tile is generated only once
+ * even if several threads request it together.
+ */
+class TiledRectifyMap
+{
+public:
+    /**
+     * \param K_rect camera matrix of the rectified view
+     * \param imageSize size of the rectified view, the image size of the
+     *        camera by default
+     * \param rmat rotation from the camera to the rectified frame
+     * \param tileSize size of the tiles, clipped at the image border
+     * \param memoryBudget bytes of tile maps kept before the least recently
+     *        used tiles are evicted
+     * \param m1type map format, see Camera::initUndistortRectifyMap();
+     *        the default fixed-point format is the most compact
+     */
+    TiledRectifyMap(const CameraConstPtr& camera,
+                    const cv::Mat& K_rect,
+                    cv::Size imageSize = cv::Size(0, 0),
+                    cv::Mat rmat = cv::Mat::eye(3, 3, CV_32F),
+                    cv::Size tileSize = cv::Size(256, 256),
+                    size_t memoryBudget = 64 << 20,
+                    int m1type = CV_16SC2);
+    ~TiledRectifyMap();
+
+    const cv::Size& imageSize(void) const;
+    const cv::Size& tileSize(void) const;
+    int tileCols(void) const;
+    int tileRows(void) const;
+
+    void setMemoryBudget(size_t memoryBudget);
+    size_t memoryBudget(void) const;
+
+    /**
+     * \brief Bytes of tile maps and number of tiles currently kept
+     */
+    size_t residentBytes(void) const;
+    size_t residentTiles(void) const;
+
+    /**
+     * \brief Number of stripes the tiles of a region are split into, <= 0
+     *        to let OpenCV choose (default)
+     *
+     * The stripes run on OpenCV's thread pool, so at most
+     * cv::getNumThreads() of them are remapped at once.
+     */
+    void setNumThreads(int numThreads);
+    int numThreads(void) const;
+
+    /**
+     * \brief Remaps the region roi of the rectified view
+     *
+     * dst receives roi.size() pixels of the type of src, which must have
+     * the image size of the camera. roi must lie inside the rectified
+     * view. Missing tiles are generated by the threads doing the remap.
+     * If a tile cannot be generated, the first such exception is rethrown
+     * once the other tiles are done.
+     */
+    void remap(const cv::Mat& src, cv::Mat& dst, const cv::Rect& roi,
+               int interpolation = cv::INTER_LINEAR,
+               int borderMode = cv::BORDER_CONSTANT);
+
+    /**
+     * \brief Copies the maps of the region roi into map1 and map2
+     */
+    void getMaps(const cv::Rect& roi, cv::Mat& map1, cv::Mat& map2);
+
+    /**
+     * \brief Queues the missing tiles of roi for generation on a
+     *        background thread and returns immediately
+     */
+    void prefetch(const cv::Rect& roi);
+
+    /**
+     * \brief Drops all tiles and pending prefetches
+     */
+    void clear(void);
+
+private:
+    struct Tile
+    {
+        cv::Rect rect;
+        cv::Mat map1;
+        cv::Mat map2;
+        size_t bytes;
+    };
+
+    struct TileEntry
+    {
+        boost::shared_ptr<const Tile> tile;
+        bool pending;
+        std::list<int>::iterator lruPosition;
+    };
+
+    /**
+     * \brief Returns tile i, generating it if necessary
+     */
+    boost::shared_ptr<const Tile> acquire(int i);
+
+    /**
+     * \brief Evicts least recently used tiles until the budget is met,
+     *        keeping tile keep; requires m_mutex
+     */
+    void evict(int keep);
+
+    /**
+     * \brief Indices of the tiles intersecting roi, clipped to the image
+     */
+    std::vector<int> tilesOf(const cv::Rect& roi) const;
+
+    void prefetchLoop(void);
+
+    CameraConstPtr m_camera;
+    cv::Mat m_K_rect;
+    cv::Mat m_rmat;
+    cv::Size m_imageSize;
+    cv::Size m_tileSize;
+    int m_tileCols;
+    int m_tileRows;
+    int m_m1type;
+    int m_numThreads;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_tileReady;
+    std::vector<TileEntry> m_tiles;
+    // most recently used tile first
+    std::list<int> m_lru;
+    size_t m_residentBytes;
+    size_t m_memoryBudget;
+
+    // background prefetching, started on the first call to prefetch()
+    std::thread m_prefetchThread;
+    std::condition_variable m_prefetchWake;
+    std::deque<int> m_prefetchQueue;
+    bool m_stop;
+};
+
+typedef boost::shared_ptr<TiledRectifyMap> TiledRectifyMapPtr;
+
+}
+
+#endif
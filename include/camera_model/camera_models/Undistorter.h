@@ -0,0 +1,154 @@
+#ifndef UNDISTORTER_H
+#define UNDISTORTER_H
+
+#include <boost/shared_ptr.hpp>
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include "Camera.h"
+
+namespace camera_model
+{
+
+/**
+ * \brief Undistorts and rectifies a stream of frames from one camera
+ *
+ * The undistorter generates the remap tables of the camera once, in the
+ * fixed-point CV_16SC2 format, and keeps them for its lifetime. Each frame
+ * is remapped tile by tile; tiles are small enough for their part of the
+ * maps and of the output to stay in cache, and are spread over the
+ * persistent thread pool of cv::parallel_for_().
+ *
+ * With cropping enabled, the output is restricted to validRoi(), a
+ * rectangle of the rectified view whose pixels all sample the inside of
+ * the source image. cameraMatrix() always describes the output images,
+ * i.e. it includes the offset of the crop.
+ *
+ * An Undistorter is not thread-safe; use one per stream.
+ */
+class Undistorter
+{
+public:
+    /**
+     * \brief Generates the maps of camera->initUndistortRectifyMap() with
+     *        the same arguments
+     *
+     * \param cropToValidRoi restrict the output to validRoi()
+     */
+    Undistorter(const CameraConstPtr& camera,
+                float fx = -1.0f, float fy = -1.0f,
+                cv::Size imageSize = cv::Size(0, 0),
+                float cx = -1.0f, float cy = -1.0f,
+                cv::Mat rmat = cv::Mat::eye(3, 3, CV_32F),
+                bool cropToValidRoi = false);
+
+    const CameraConstPtr& camera(void) const;
+
+    /**
+     * \brief Camera matrix of the output images
+     */
+    const cv::Mat& cameraMatrix(void) const;
+
+    /**
+     * \brief Size of the output images
+     */
+    cv::Size outputSize(void) const;
+
+    /**
+     * \brief Valid region of the full rectified view
+     *
+     * A valid rectangle obtained by greedy shrinking: starting from the
+     * full view, the border with the largest fraction of invalid pixels is
+     * moved in by one line until none is left. It is not necessarily the
+     * largest valid rectangle. Computed whether or not the output is
+     * cropped to it.
+     */
+    const cv::Rect& validRoi(void) const;
+    bool cropToValidRoi(void) const;
+
+    /**
+     * \brief Interpolation passed to cv::remap(), cv::INTER_LINEAR by
+     *        default
+     */
+    void setInterpolation(int interpolation);
+    int interpolation(void) const;
+
+    /**
+     * \brief Number of bands the tiles of a frame are split into, <= 0 to
+     *        let OpenCV choose (default)
+     *
+     * The bands run on OpenCV's thread pool, so at most cv::getNumThreads()
+     * of them are remapped at once.
+     */
+    void setNumThreads(int numThreads);
+    int numThreads(void) const;
+
+    /**
+     * \brief Size of the output tiles, 256 x 32 pixels by default
+     */
+    void setTileSize(const cv::Size& tileSize);
+    const cv::Size& tileSize(void) const;
+
+    /**
+     * \brief Converts 3-channel BGR frames to grayscale before remapping
+     *
+     * Remapping a single channel is about three times cheaper, so
+     * consumers that only need intensities should enable this. Frames
+     * with other channel counts are remapped as they are.
+     */
+    void setGrayscale(bool grayscale);
+    bool grayscale(void) const;
+
+    /**
+     * \brief Undistorts one frame
+     *
+     * dst is only reallocated if its size or type does not match the
+     * output, so passing the same matrix for every frame of a stream
+     * avoids all per-frame allocations. src must have the image size of
+     * the camera and must not share data with dst.
+     *
+     * \return time taken in seconds
+     */
+    double undistort(const cv::Mat& src, cv::Mat& dst);
+
+    /**
+     * \brief Latency of the last frame and mean latency over all frames,
+     *        in seconds
+     */
+    double lastLatency(void) const;
+    double meanLatency(void) const;
+    size_t frameCount(void) const;
+
+private:
+    void computeValidRoi(void);
+
+    CameraConstPtr m_camera;
+
+    // maps of the full rectified view, and views of them covering the output
+    cv::Mat m_map1;
+    cv::Mat m_map2;
+    cv::Mat m_outputMap1;
+    cv::Mat m_outputMap2;
+
+    cv::Mat m_K;
+    cv::Rect m_validRoi;
+    bool m_crop;
+
+    int m_interpolation;
+    int m_numThreads;
+    cv::Size m_tileSize;
+    bool m_grayscale;
+
+    // reused for the grayscale conversion
+    cv::Mat m_gray;
+
+    double m_lastLatency;
+    double m_totalLatency;
+    size_t m_frameCount;
+};
+
+typedef boost::shared_ptr<Undistorter> UndistorterPtr;
+
+}
+
+#endif
@@ -2,6 +2,7 @@
 #define GPL_H
 
 #include <algorithm>
+#include <boost/function.hpp>
 #include <cmath>
 #include <opencv2/core/core.hpp>
 
@@ -106,6 +107,16 @@ void UTMtoLL(double utmNorthing, double utmEasting,
 
 long int timestampDiff(uint64_t t1, uint64_t t2);
 
+/**
+ * \brief Splits [begin, end) into contiguous blocks and runs body(first, last)
+ *        on each block in its own thread
+ *
+ * The calling thread processes the first block. numThreads <= 0 selects the
+ * number of hardware threads; no more threads than indices are started.
+ */
+void parallelFor(int begin, int end, int numThreads,
+                 const boost::function<void (int, int)>& body);
+
 }
 
 #endif
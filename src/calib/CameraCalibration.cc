@@ -10,6 +10,7 @@
 #include <opencv2/core/eigen.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
 #include <opencv2/calib3d/calib3d.hpp>
+#include <thread>
 
 #include "camera_model/camera_models/CameraFactory.h"
 #include "camera_model/sparse_graph/Transform.h"
@@ -21,9 +22,50 @@
 namespace camera_model
 {
 
+CalibrationSolverOptions::CalibrationSolverOptions()
+ : numThreads(0)
+ , maxNumIterations(1000)
+ , linearSolverType(ceres::SPARSE_SCHUR)
+ , trustRegionStrategyType(ceres::LEVENBERG_MARQUARDT)
+ , useSchurOrdering(true)
+ , analyticDerivatives(false)
+ , perViewResiduals(false)
+ , incrementalInitialViews(3)
+ , incrementalMaxNumIterations(5)
+{
+
+}
+
+void
+CalibrationSolverOptions::apply(ceres::Solver::Options& options) const
+{
+    options.max_num_iterations = maxNumIterations;
+    options.num_threads = threadCount();
+    options.linear_solver_type = linearSolverType;
+    options.trust_region_strategy_type = trustRegionStrategyType;
+
+    // Ceres may have been built without a sparse linear algebra library
+    std::string error;
+    if (options.linear_solver_type == ceres::SPARSE_SCHUR && !options.IsValid(&error))
+    {
+        std::cerr << "# WARNING: " << error << " Using DENSE_SCHUR instead." << std::endl;
+        options.linear_solver_type = ceres::DENSE_SCHUR;
+    }
+}
+
+int
+CalibrationSolverOptions::threadCount(void) const
+{
+    return numThreads > 0 ? numThreads :
+        std::max(static_cast<int>(std::thread::hardware_concurrency()), 1);
+}
+
 CameraCalibration::CameraCalibration()
  : m_boardSize(cv::Size(0,0))
  , m_squareSize(0.0f)
+ , m_lossFunction(new ceres::CauchyLoss(1.0))
+ , m_quaternionParameterization(new EigenQuaternionParameterization)
+ , m_incremental(false)
  , m_verbose(false)
 {
 
@@ -36,6 +78,9 @@ CameraCalibration::CameraCalibration(const Camera::ModelType modelType,
                                      float squareSize)
  : m_boardSize(boardSize)
  , m_squareSize(squareSize)
+ , m_lossFunction(new ceres::CauchyLoss(1.0))
+ , m_quaternionParameterization(new EigenQuaternionParameterization)
+ , m_incremental(false)
  , m_verbose(false)
 {
     m_camera = CameraFactory::instance()->generateCamera(modelType, cameraName, imageSize);
@@ -46,6 +91,10 @@ CameraCalibration::clear(void)
 {
     m_imagePoints.clear();
     m_scenePoints.clear();
+
+    m_problem.reset();
+    m_viewPoses.clear();
+    m_intrinsicsCovariance.resize(0, 0);
 }
 
 void
@@ -62,6 +111,10 @@ CameraCalibration::addChessboardData(const std::vector<cv::Point2f>& corners)
         }
     }
     m_scenePoints.push_back(scenePointsInView);
+    if (m_incremental)
+    {
+        updateIncremental();
+    }
 }
 
 void 
@@ -69,13 +122,15 @@ CameraCalibration::addCornersData(const std::vector<cv::Point2f> &corners, const
 {
     m_imagePoints.push_back(corners);
     m_scenePoints.push_back(scenePoints);
+    if (m_incremental)
+    {
+        updateIncremental();
+    }
 }
 
 bool
 CameraCalibration::calibrate(void)
 {
-    int imageCount = m_imagePoints.size();
-    
     for (auto m : m_imagePoints)
         std::cout << "m_imagePoints: " << m << std::endl;
 
@@ -86,6 +141,91 @@ CameraCalibration::calibrate(void)
     std::vector<cv::Mat> tvecs;
     bool ret = calibrateHelper(m_camera, rvecs, tvecs);
 
+    updateEstimates(rvecs, tvecs);
+
+    return ret;
+}
+
+bool
+CameraCalibration::recalibrate(int maxNumIterations)
+{
+    if (!m_problem)
+    {
+        return calibrate();
+    }
+
+    if (m_imagePoints.empty())
+    {
+        return false;
+    }
+
+    // views added since the last solve
+    for (size_t i = m_viewPoses.size(); i < m_scenePoints.size(); ++i)
+    {
+        cv::Mat rvec, tvec;
+        m_camera->estimateExtrinsics(m_scenePoints.at(i), m_imagePoints.at(i), rvec, tvec);
+
+        addViewToProblem(rvec, tvec);
+    }
+
+    solveProblem(maxNumIterations);
+
+    std::vector<cv::Mat> rvecs;
+    std::vector<cv::Mat> tvecs;
+    problemPoses(rvecs, tvecs);
+
+    if (m_verbose)
+    {
+        double err = m_camera->reprojectionError(m_scenePoints, m_imagePoints, rvecs, tvecs);
+        std::cout << "[" << m_camera->cameraName() << "] " << "# INFO: Final reprojection error: "
+                  << err << " pixels" << std::endl;
+    }
+
+    updateEstimates(rvecs, tvecs);
+
+    return true;
+}
+
+bool
+CameraCalibration::removeView(int i)
+{
+    if (i < 0 || i >= sampleCount())
+    {
+        return false;
+    }
+
+    if (m_problem && i < static_cast<int>(m_viewPoses.size()))
+    {
+        // also removes the residual blocks of the view
+        m_problem->RemoveParameterBlock(m_viewPoses.at(i)->rotationData());
+        m_problem->RemoveParameterBlock(m_viewPoses.at(i)->translationData());
+
+        m_viewPoses.erase(m_viewPoses.begin() + i);
+    }
+
+    m_imagePoints.erase(m_imagePoints.begin() + i);
+    m_scenePoints.erase(m_scenePoints.begin() + i);
+
+    if (i < m_cameraPoses.rows)
+    {
+        cv::Mat cameraPoses(m_cameraPoses.rows - 1, m_cameraPoses.cols, m_cameraPoses.type());
+        for (int j = 0; j < cameraPoses.rows; ++j)
+        {
+            cv::Mat row = cameraPoses.row(j);
+            m_cameraPoses.row(j < i ? j : j + 1).copyTo(row);
+        }
+        m_cameraPoses = cameraPoses;
+    }
+
+    return true;
+}
+
+void
+CameraCalibration::updateEstimates(const std::vector<cv::Mat>& rvecs,
+                                   const std::vector<cv::Mat>& tvecs)
+{
+    int imageCount = m_imagePoints.size();
+
     m_cameraPoses = cv::Mat(imageCount, 6, CV_64F);
     for (int i = 0; i < imageCount; ++i)
     {
@@ -101,9 +241,9 @@ CameraCalibration::calibrate(void)
     std::vector<std::vector<cv::Point2f> > errVec(m_imagePoints.size());
     Eigen::Vector2d errSum = Eigen::Vector2d::Zero();
     size_t errCount = 0;
+    std::vector<cv::Point2f> estImagePoints;
     for (size_t i = 0; i < m_imagePoints.size(); ++i)
     {
-        std::vector<cv::Point2f> estImagePoints;
         m_camera->projectPoints(m_scenePoints.at(i), rvecs.at(i), tvecs.at(i),
                                 estImagePoints);
 
@@ -142,8 +282,6 @@ CameraCalibration::calibrate(void)
     measurementCovariance(1,0) = measurementCovariance(0,1);
 
     m_measurementCovariance = measurementCovariance;
-
-    return ret;
 }
 
 int
@@ -362,6 +500,10 @@ CameraCalibration::readChessboardData(const std::string& filename)
         return false;
     }
 
+    m_problem.reset();
+    m_viewPoses.clear();
+    m_intrinsicsCovariance.resize(0, 0);
+
     readData(ifs, m_boardSize.width);
     readData(ifs, m_boardSize.height);
     readData(ifs, m_squareSize);
@@ -433,9 +575,93 @@ CameraCalibration::setVerbose(bool verbose)
     m_verbose = verbose;
 }
 
+void
+CameraCalibration::setSolverOptions(const CalibrationSolverOptions& solverOptions)
+{
+    m_solverOptions = solverOptions;
+}
+
+const CalibrationSolverOptions&
+CameraCalibration::solverOptions(void) const
+{
+    return m_solverOptions;
+}
+
+void
+CameraCalibration::setIncremental(bool incremental)
+{
+    m_incremental = incremental;
+}
+
+bool
+CameraCalibration::incremental(void) const
+{
+    return m_incremental;
+}
+
+const Eigen::MatrixXd&
+CameraCalibration::intrinsicsCovariance(void) const
+{
+    return m_intrinsicsCovariance;
+}
+
+void
+CameraCalibration::updateIncremental(void)
+{
+    if (m_problem)
+    {
+        // warm start from the current estimates, with the pose of the new
+        // view fitted to the current intrinsics
+        recalibrate(m_solverOptions.incrementalMaxNumIterations);
+    }
+    else if (sampleCount() >= m_solverOptions.incrementalInitialViews)
+    {
+        calibrate();
+    }
+    else
+    {
+        return;
+    }
+
+    if (!computeIntrinsicsCovariance() && m_verbose)
+    {
+        std::cout << "[" << m_camera->cameraName() << "] "
+                  << "# INFO: Intrinsics are not observable yet." << std::endl;
+    }
+}
+
+bool
+CameraCalibration::computeIntrinsicsCovariance(void)
+{
+    m_intrinsicsCovariance.resize(0, 0);
+
+    ceres::Covariance::Options options;
+    options.num_threads = m_solverOptions.threadCount();
+
+    std::vector<std::pair<const double*, const double*> > blocks;
+    blocks.push_back(std::make_pair(m_intrinsicParams.data(), m_intrinsicParams.data()));
+
+    ceres::Covariance covariance(options);
+    if (!covariance.Compute(blocks, m_problem.get()))
+    {
+        return false;
+    }
+
+    // the covariance block is row-major, but it is symmetric
+    int n = m_intrinsicParams.size();
+    m_intrinsicsCovariance.resize(n, n);
+    covariance.GetCovarianceBlock(m_intrinsicParams.data(), m_intrinsicParams.data(),
+                                  m_intrinsicsCovariance.data());
+
+    // Ceres assumes residuals of unit variance
+    m_intrinsicsCovariance *= 0.5 * m_measurementCovariance.trace();
+
+    return true;
+}
+
 bool
 CameraCalibration::calibrateHelper(CameraPtr& camera,
-                                   std::vector<cv::Mat>& rvecs, std::vector<cv::Mat>& tvecs) const
+                                   std::vector<cv::Mat>& rvecs, std::vector<cv::Mat>& tvecs)
 {
     rvecs.assign(m_scenePoints.size(), cv::Mat());
     tvecs.assign(m_scenePoints.size(), cv::Mat());
@@ -459,7 +685,7 @@ CameraCalibration::calibrateHelper(CameraPtr& camera,
     }
 
     // STEP 3: optimization using ceres
-    optimize(camera, rvecs, tvecs);
+    optimize(rvecs, tvecs);
 
     if (m_verbose)
     {
@@ -474,29 +700,77 @@ CameraCalibration::calibrateHelper(CameraPtr& camera,
 }
 
 void
-CameraCalibration::optimize(CameraPtr& camera,
-                            std::vector<cv::Mat>& rvecs, std::vector<cv::Mat>& tvecs) const
+CameraCalibration::optimize(std::vector<cv::Mat>& rvecs, std::vector<cv::Mat>& tvecs)
 {
-    // Use ceres to do optimization
-    ceres::Problem problem;
+    resetProblem();
 
-    std::vector<Transform, Eigen::aligned_allocator<Transform> > transformVec(rvecs.size());
     for (size_t i = 0; i < rvecs.size(); ++i)
     {
-        Eigen::Vector3d rvec;
-        cv::cv2eigen(rvecs.at(i), rvec);
-
-        transformVec.at(i).rotation() = Eigen::AngleAxisd(rvec.norm(), rvec.normalized());
-        transformVec.at(i).translation() << tvecs[i].at<double>(0),
-                                            tvecs[i].at<double>(1),
-                                            tvecs[i].at<double>(2);
+        addViewToProblem(rvecs.at(i), tvecs.at(i));
     }
 
-    std::vector<double> intrinsicCameraParams;
-    m_camera->writeParameters(intrinsicCameraParams);
+    solveProblem();
 
-    // create residuals for each observation
-    for (size_t i = 0; i < m_imagePoints.size(); ++i)
+    problemPoses(rvecs, tvecs);
+}
+
+void
+CameraCalibration::resetProblem(void)
+{
+    m_problem.reset();
+    m_viewPoses.clear();
+
+    m_camera->writeParameters(m_intrinsicParams);
+
+    ceres::Problem::Options problemOptions;
+    problemOptions.loss_function_ownership = ceres::DO_NOT_TAKE_OWNERSHIP;
+    problemOptions.local_parameterization_ownership = ceres::DO_NOT_TAKE_OWNERSHIP;
+    // otherwise removing a view scans all residual blocks
+    problemOptions.enable_fast_removal = true;
+
+    m_problem.reset(new ceres::Problem(problemOptions));
+}
+
+void
+CameraCalibration::addViewToProblem(const cv::Mat& rvec, const cv::Mat& tvec)
+{
+    size_t i = m_viewPoses.size();
+
+    boost::shared_ptr<Transform> pose(new Transform);
+
+    Eigen::Vector3d r;
+    cv::cv2eigen(rvec, r);
+
+    pose->rotation() = Eigen::AngleAxisd(r.norm(), r.normalized());
+    pose->translation() << tvec.at<double>(0),
+                           tvec.at<double>(1),
+                           tvec.at<double>(2);
+
+    m_viewPoses.push_back(pose);
+
+    int flags = CAMERA_INTRINSICS | CAMERA_POSE;
+    if (m_solverOptions.analyticDerivatives)
+    {
+        flags |= ANALYTIC_DERIVATIVES;
+    }
+
+    if (m_solverOptions.perViewResiduals)
+    {
+        // one block for all corners of the view, with the robust loss
+        // applied to each corner inside
+        ceres::CostFunction* costFunction =
+            CostFunctionFactory::instance()->generateCostFunction(m_camera,
+                                                                  m_scenePoints.at(i),
+                                                                  m_imagePoints.at(i),
+                                                                  m_lossFunction.get(),
+                                                                  flags);
+
+        m_problem->AddResidualBlock(costFunction, NULL,
+                                    m_intrinsicParams.data(),
+                                    pose->rotationData(),
+                                    pose->translationData());
+    }
+    else
     {
         for (size_t j = 0; j < m_imagePoints.at(i).size(); ++j)
         {
@@ -504,29 +778,54 @@ CameraCalibration::optimize(CameraPtr& camera,
             const cv::Point2f& ipt = m_imagePoints.at(i).at(j);
 
             ceres::CostFunction* costFunction =
-                CostFunctionFactory::instance()->generateCostFunction(camera,
+                CostFunctionFactory::instance()->generateCostFunction(m_camera,
                                                                       Eigen::Vector3d(spt.x, spt.y, spt.z),
                                                                       Eigen::Vector2d(ipt.x, ipt.y),
-                                                                      CAMERA_INTRINSICS | CAMERA_POSE);
+                                                                      flags);
 
-            ceres::LossFunction* lossFunction = new ceres::CauchyLoss(1.0);
-            problem.AddResidualBlock(costFunction, lossFunction,
-                                     intrinsicCameraParams.data(),
-                                     transformVec.at(i).rotationData(),
-                                     transformVec.at(i).translationData());
+            m_problem->AddResidualBlock(costFunction, m_lossFunction.get(),
+                                        m_intrinsicParams.data(),
+                                        pose->rotationData(),
+                                        pose->translationData());
         }
+    }
 
-        ceres::LocalParameterization* quaternionParameterization =
-            new EigenQuaternionParameterization;
+    m_problem->SetParameterization(pose->rotationData(),
+                                   m_quaternionParameterization.get());
+}
 
-        problem.SetParameterization(transformVec.at(i).rotationData(),
-                                    quaternionParameterization);
-    }
+void
+CameraCalibration::solveProblem(int maxNumIterations)
+{
+    // start from the intrinsics of the camera, which may have been changed
+    // since the last solve; the size and thus the address of the block
+    // stay the same
+    m_camera->writeParameters(m_intrinsicParams);
 
     std::cout << "begin ceres" << std::endl;
     ceres::Solver::Options options;
-    options.max_num_iterations = 1000;
-    options.num_threads = 1;
+    m_solverOptions.apply(options);
+    if (maxNumIterations > 0)
+    {
+        options.max_num_iterations = maxNumIterations;
+    }
+
+    if (m_solverOptions.useSchurOrdering &&
+        ceres::IsSchurType(options.linear_solver_type))
+    {
+        // The first elimination group must be an independent set, so the
+        // rotations and translations of the views go into separate groups.
+        // The intrinsics, shared by all views, are eliminated last.
+        ceres::ParameterBlockOrdering* ordering = new ceres::ParameterBlockOrdering;
+        for (size_t i = 0; i < m_viewPoses.size(); ++i)
+        {
+            ordering->AddElementToGroup(m_viewPoses.at(i)->rotationData(), 0);
+            ordering->AddElementToGroup(m_viewPoses.at(i)->translationData(), 1);
+        }
+        ordering->AddElementToGroup(m_intrinsicParams.data(), 2);
+
+        options.linear_solver_ordering.reset(ordering);
+    }
 
     if (m_verbose)
     {
@@ -534,7 +833,7 @@ CameraCalibration::optimize(CameraPtr& camera,
     }
 
     ceres::Solver::Summary summary;
-    ceres::Solve(options, &problem, &summary);
+    ceres::Solve(options, m_problem.get(), &summary);
     std::cout << "end ceres" << std::endl;
 
     if (m_verbose)
@@ -542,19 +841,27 @@ CameraCalibration::optimize(CameraPtr& camera,
         std::cout << summary.FullReport() << std::endl;
     }
 
-    camera->readParameters(intrinsicCameraParams);
+    m_camera->readParameters(m_intrinsicParams);
+}
 
-    for (size_t i = 0; i < rvecs.size(); ++i)
+void
+CameraCalibration::problemPoses(std::vector<cv::Mat>& rvecs, std::vector<cv::Mat>& tvecs) const
+{
+    rvecs.resize(m_viewPoses.size());
+    tvecs.resize(m_viewPoses.size());
+
+    for (size_t i = 0; i < m_viewPoses.size(); ++i)
     {
-        Eigen::AngleAxisd aa(transformVec.at(i).rotation());
+        Eigen::AngleAxisd aa(m_viewPoses.at(i)->rotation());
 
         Eigen::Vector3d rvec = aa.angle() * aa.axis();
         cv::eigen2cv(rvec, rvecs.at(i));
 
         cv::Mat& tvec = tvecs.at(i);
-        tvec.at<double>(0) = transformVec.at(i).translation()(0);
-        tvec.at<double>(1) = transformVec.at(i).translation()(1);
-        tvec.at<double>(2) = transformVec.at(i).translation()(2);
+        tvec.create(3, 1, CV_64F);
+        tvec.at<double>(0) = m_viewPoses.at(i)->translation()(0);
+        tvec.at<double>(1) = m_viewPoses.at(i)->translation()(1);
+        tvec.at<double>(2) = m_viewPoses.at(i)->translation()(2);
     }
 }
 
@@ -1,17 +1,48 @@
 #include "camera_model/calib/StereoCameraCalibration.h"
 
+#include <algorithm>
 #include <boost/filesystem.hpp>
 #include <opencv2/core/eigen.hpp>
+#include <thread>
 
 #include "ceres/ceres.h"
 #include "camera_model/gpl/EigenQuaternionParameterization.h"
 #include "camera_model/gpl/EigenUtils.h"
 #include "camera_model/camera_models/CameraFactory.h"
 #include "camera_model/camera_models/CostFunctionFactory.h"
+#include "camera_model/camera_models/MapCache.h"
+#include "camera_model/gpl/gpl.h"
 
 namespace camera_model
 {
 
+namespace
+{
+
+/**
+ * \brief Focal length in pixels of a camera at its image centre
+ *
+ * The inverse of the angle between the rays of neighbouring pixels,
+ * averaged over both image directions. Works for all camera models.
+ */
+double
+centralFocalLength(const Camera& camera)
+{
+    Eigen::Vector2d p(camera.imageWidth() / 2.0, camera.imageHeight() / 2.0);
+
+    Eigen::Vector3d P, P_u, P_v;
+    camera.liftProjective(p, P);
+    camera.liftProjective(p + Eigen::Vector2d(1.0, 0.0), P_u);
+    camera.liftProjective(p + Eigen::Vector2d(0.0, 1.0), P_v);
+
+    double angle_u = atan2(P.cross(P_u).norm(), P.dot(P_u));
+    double angle_v = atan2(P.cross(P_v).norm(), P.dot(P_v));
+
+    return 2.0 / (angle_u + angle_v);
+}
+
+}
+
 StereoCameraCalibration::StereoCameraCalibration(Camera::ModelType modelType,
                                                  const std::string& cameraLeftName,
                                                  const std::string& cameraRightName,
@@ -20,6 +51,8 @@ StereoCameraCalibration::StereoCameraCalibration(Camera::ModelType modelType,
                                                  float squareSize)
  : m_calibLeft(modelType, cameraLeftName, imageSize, boardSize, squareSize)
  , m_calibRight(modelType, cameraRightName, imageSize, boardSize, squareSize)
+ , m_rectLeft(Eigen::Matrix3d::Identity())
+ , m_rectRight(Eigen::Matrix3d::Identity())
  , m_verbose(false)
 {
 
@@ -238,8 +271,25 @@ StereoCameraCalibration::calibrate(void)
                                 quaternionParameterization);
 
     ceres::Solver::Options options;
-    options.max_num_iterations = 1000;
-    options.num_threads = 8;
+    m_solverOptions.apply(options);
+
+    if (m_solverOptions.useSchurOrdering &&
+        ceres::IsSchurType(options.linear_solver_type))
+    {
+        // poses of the views first, then the parameters shared by all views
+        ceres::ParameterBlockOrdering* ordering = new ceres::ParameterBlockOrdering;
+        for (int i = 0; i < imageCount; ++i)
+        {
+            ordering->AddElementToGroup(extrinsicCameraLParams[i], 0);
+            ordering->AddElementToGroup(extrinsicCameraLParams[i] + 4, 1);
+        }
+        ordering->AddElementToGroup(intrinsicCameraLParams.data(), 2);
+        ordering->AddElementToGroup(intrinsicCameraRParams.data(), 2);
+        ordering->AddElementToGroup(m_q.coeffs().data(), 2);
+        ordering->AddElementToGroup(m_t.data(), 2);
+
+        options.linear_solver_ordering.reset(ordering);
+    }
 
     if (m_verbose)
     {
@@ -376,6 +426,150 @@ StereoCameraCalibration::drawResults(std::vector<cv::Mat>& imagesLeft,
     m_calibRight.drawResults(imagesRight);
 }
 
+cv::Mat
+StereoCameraCalibration::initStereoRectifyMaps(cv::Mat& mapLeft1, cv::Mat& mapLeft2,
+                                               cv::Mat& mapRight1, cv::Mat& mapRight2,
+                                               float fx, float fy,
+                                               cv::Size imageSize,
+                                               float cx, float cy,
+                                               int m1type)
+{
+    m_K_rect = initStereoRectifyMaps(*cameraLeft(), *cameraRight(), m_q, m_t,
+                                     mapLeft1, mapLeft2, mapRight1, mapRight2,
+                                     m_rectLeft, m_rectRight,
+                                     fx, fy, imageSize, cx, cy, m1type);
+
+    m_rectMaps[0] = mapLeft1;
+    m_rectMaps[1] = mapLeft2;
+    m_rectMaps[2] = mapRight1;
+    m_rectMaps[3] = mapRight2;
+
+    return m_K_rect;
+}
+
+const Eigen::Matrix3d&
+StereoCameraCalibration::rectificationLeft(void) const
+{
+    return m_rectLeft;
+}
+
+const Eigen::Matrix3d&
+StereoCameraCalibration::rectificationRight(void) const
+{
+    return m_rectRight;
+}
+
+void
+StereoCameraCalibration::stereoRectify(const Eigen::Quaterniond& q, const Eigen::Vector3d& t,
+                                       Eigen::Matrix3d& R_left, Eigen::Matrix3d& R_right)
+{
+    // rotate both cameras halfway towards each other
+    Eigen::AngleAxisd half(q.normalized());
+    half.angle() *= 0.5;
+    Eigen::Matrix3d r = half.toRotationMatrix();
+
+    // Left camera centre in the half-rotated right frame. Both half-rotated
+    // frames have the same orientation, so this is also the baseline.
+    Eigen::Vector3d b = r.transpose() * t;
+
+    // new axes, expressed in the half-rotated frames; the baseline axis is
+    // oriented to stay close to the original one so that the images are
+    // not flipped
+    Eigen::Vector3d e_x, e_y, e_z;
+    if (fabs(b(0)) >= fabs(b(1)))
+    {
+        e_x = (b(0) < 0.0 ? -b : b).normalized();
+        e_y = Eigen::Vector3d::UnitZ().cross(e_x).normalized();
+    }
+    else
+    {
+        e_y = (b(1) < 0.0 ? -b : b).normalized();
+        e_x = e_y.cross(Eigen::Vector3d::UnitZ()).normalized();
+    }
+    e_z = e_x.cross(e_y);
+
+    Eigen::Matrix3d R_w;
+    R_w.row(0) = e_x.transpose();
+    R_w.row(1) = e_y.transpose();
+    R_w.row(2) = e_z.transpose();
+
+    // R_right * q * R_left^T = I
+    R_left = R_w * r;
+    R_right = R_w * r.transpose();
+}
+
+cv::Mat
+StereoCameraCalibration::initStereoRectifyMaps(const Camera& cameraLeft,
+                                               const Camera& cameraRight,
+                                               const Eigen::Quaterniond& q,
+                                               const Eigen::Vector3d& t,
+                                               cv::Mat& mapLeft1, cv::Mat& mapLeft2,
+                                               cv::Mat& mapRight1, cv::Mat& mapRight2,
+                                               Eigen::Matrix3d& R_left,
+                                               Eigen::Matrix3d& R_right,
+                                               float fx, float fy,
+                                               cv::Size imageSize,
+                                               float cx, float cy,
+                                               int m1type)
+{
+    stereoRectify(q, t, R_left, R_right);
+
+    if (imageSize == cv::Size(0, 0))
+    {
+        imageSize = cv::Size(cameraLeft.imageWidth(), cameraLeft.imageHeight());
+    }
+
+    if (fx == -1.0f || fy == -1.0f)
+    {
+        fx = 0.5 * (centralFocalLength(cameraLeft) + centralFocalLength(cameraRight));
+        fy = fx;
+    }
+
+    if (cx == -1.0f || cy == -1.0f)
+    {
+        cx = imageSize.width / 2;
+        cy = imageSize.height / 2;
+    }
+
+    cv::Mat rmat[2];
+    cv::eigen2cv(R_left, rmat[0]);
+    cv::eigen2cv(R_right, rmat[1]);
+
+    cv::Mat K_rect = cv::Mat::eye(3, 3, CV_32F);
+    K_rect.at<float>(0,0) = fx;
+    K_rect.at<float>(1,1) = fy;
+    K_rect.at<float>(0,2) = cx;
+    K_rect.at<float>(1,2) = cy;
+
+    const Camera* cameras[2] = {&cameraLeft, &cameraRight};
+    cv::Mat* maps[4] = {&mapLeft1, &mapLeft2, &mapRight1, &mapRight2};
+
+    // One thread per camera, each splitting its map over half of the
+    // thread budget of the left camera, so that no more threads run than
+    // for a single map.
+    int numThreads = cameraLeft.numThreads();
+    if (numThreads <= 0)
+    {
+        numThreads = std::max(static_cast<int>(std::thread::hardware_concurrency()), 1);
+    }
+    int cameraThreads[2] = {std::max((numThreads + 1) / 2, 1),
+                            std::max(numThreads / 2, 1)};
+
+    auto generateMaps = [&](int begin, int end)
+    {
+        for (int i = begin; i < end; ++i)
+        {
+            cameras[i]->initUndistortRectifyMapRegion(*maps[2 * i], *maps[2 * i + 1],
+                                                      K_rect, cv::Rect(cv::Point(0, 0), imageSize),
+                                                      rmat[i], m1type, cameraThreads[i]);
+        }
+    };
+
+    parallelFor(0, 2, 2, generateMaps);
+
+    return K_rect;
+}
+
 void
 StereoCameraCalibration::writeParams(const std::string& directory) const
 {
@@ -399,6 +593,45 @@ StereoCameraCalibration::writeParams(const std::string& directory) const
               << "t_z" << m_t(2) << "}";
 
     fs.release();
+
+    if (m_K_rect.empty())
+    {
+        return;
+    }
+
+    cv::Mat rmat[2];
+    cv::eigen2cv(m_rectLeft, rmat[0]);
+    cv::eigen2cv(m_rectRight, rmat[1]);
+
+    cv::FileStorage fsRect(directory + "/rectification.yaml", cv::FileStorage::WRITE);
+
+    fsRect << "image_width" << m_rectMaps[0].cols;
+    fsRect << "image_height" << m_rectMaps[0].rows;
+    fsRect << "K_rect" << m_K_rect;
+    fsRect << "R_left" << rmat[0];
+    fsRect << "R_right" << rmat[1];
+    fsRect << "baseline" << m_t.norm();
+
+    fsRect.release();
+
+    // Store the maps as cache files with the keys MapCache computes for
+    // the same rectification, so that they are picked up directly by
+    // MapCache::initUndistortRectifyMap().
+    cv::Size imageSize = m_rectMaps[0].size();
+    float fx = m_K_rect.at<float>(0,0);
+    float fy = m_K_rect.at<float>(1,1);
+    float cx = m_K_rect.at<float>(0,2);
+    float cy = m_K_rect.at<float>(1,2);
+
+    uint64_t keyLeft = MapCache::key(*cameraLeft(), fx, fy, imageSize, cx, cy,
+                                     rmat[0], m_rectMaps[0].type());
+    MapCache::writeToFile(directory + "/rectification_left.map", keyLeft,
+                          m_rectMaps[0], m_rectMaps[1], m_K_rect);
+
+    uint64_t keyRight = MapCache::key(*cameraRight(), fx, fy, imageSize, cx, cy,
+                                      rmat[1], m_rectMaps[2].type());
+    MapCache::writeToFile(directory + "/rectification_right.map", keyRight,
+                          m_rectMaps[2], m_rectMaps[3], m_K_rect);
 }
 
 void
@@ -409,4 +642,18 @@ StereoCameraCalibration::setVerbose(bool verbose)
     m_calibRight.setVerbose(verbose);
 }
 
+void
+StereoCameraCalibration::setSolverOptions(const CalibrationSolverOptions& solverOptions)
+{
+    m_solverOptions = solverOptions;
+    m_calibLeft.setSolverOptions(solverOptions);
+    m_calibRight.setSolverOptions(solverOptions);
+}
+
+const CalibrationSolverOptions&
+StereoCameraCalibration::solverOptions(void) const
+{
+    return m_solverOptions;
+}
+
 }
@@ -0,0 +1,348 @@
+#include "camera_model/camera_models/BearingLUT.h"
+
+#include <algorithm>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+
+#include "camera_model/camera_models/MapCache.h"
+
+namespace camera_model
+{
+
+/**
+ * \brief Header of a table file, followed by rows * cols * 3 floats
+ *
+ * All fields are stored in host byte order.
+ */
+struct BearingLUTFileHeader
+{
+    char magic[8];
+    int version;
+    int imageWidth;
+    int imageHeight;
+    int step;
+    int cols;
+    int rows;
+    double maxAngularError;
+    // MapCache::cameraKey() of the camera
+    uint64_t cameraKey;
+};
+
+static const char kBearingLUTMagic[8] = {'B', 'E', 'A', 'R', 'L', 'U', 'T', '\0'};
+static const int kBearingLUTVersion = 2;
+
+BearingLUT::BearingLUT()
+ : m_imageWidth(0)
+ , m_imageHeight(0)
+ , m_step(1)
+ , m_cols(0)
+ , m_rows(0)
+ , m_invStep(1.0f)
+ , m_maxAngularError(0.0)
+ , m_cameraKey(0)
+ , m_data(0)
+{
+
+}
+
+BearingLUT::BearingLUT(const Camera& camera, int step)
+ : m_cameraKey(0)
+ , m_data(0)
+{
+    build(camera, step);
+}
+
+void
+BearingLUT::build(const Camera& camera, int step)
+{
+    m_imageWidth = camera.imageWidth();
+    m_imageHeight = camera.imageHeight();
+    m_step = std::max(step, 1);
+    m_invStep = 1.0f / m_step;
+    m_cameraKey = MapCache::cameraKey(camera);
+
+    // enough nodes to cover the last pixel, and at least one cell
+    m_cols = std::max((m_imageWidth - 1 + m_step - 1) / m_step + 1, 2);
+    m_rows = std::max((m_imageHeight - 1 + m_step - 1) / m_step + 1, 2);
+
+    boost::shared_ptr<std::vector<float> > table(new std::vector<float>(3 * m_cols * m_rows));
+
+    std::vector<double> U(2 * m_cols), V(2 * m_cols);
+    std::vector<double> X(2 * m_cols), Y(2 * m_cols), Z(2 * m_cols);
+
+    for (int c = 0; c < m_cols; ++c)
+    {
+        U[c] = c * m_step;
+    }
+
+    for (int r = 0; r < m_rows; ++r)
+    {
+        std::fill(V.begin(), V.end(), r * m_step);
+
+        camera.liftSphere(&U[0], &V[0], &X[0], &Y[0], &Z[0], m_cols);
+
+        float* row = &(*table)[3 * r * m_cols];
+        for (int c = 0; c < m_cols; ++c)
+        {
+            row[3 * c] = X[c];
+            row[3 * c + 1] = Y[c];
+            row[3 * c + 2] = Z[c];
+        }
+    }
+
+    m_table = table;
+    m_region.reset();
+    m_data = &(*table)[0];
+
+    // Interpolation error peaks inside the cells and along their edges,
+    // so compare against the camera at every cell centre and at the
+    // midpoints of the cell edges.
+    m_maxAngularError = 0.0;
+
+    for (int r = 0; r < 2 * m_rows - 1; ++r)
+    {
+        // even rows hold the horizontal edge midpoints, odd rows the
+        // cell centres and vertical edge midpoints
+        int n = 0;
+        for (int c = (r % 2 == 0) ? 1 : 0; c < 2 * m_cols - 1; c += (r % 2 == 0) ? 2 : 1)
+        {
+            U[n] = 0.5 * c * m_step;
+            ++n;
+        }
+        std::fill(V.begin(), V.begin() + n, 0.5 * r * m_step);
+
+        camera.liftSphere(&U[0], &V[0], &X[0], &Y[0], &Z[0], n);
+
+        for (int c = 0; c < n; ++c)
+        {
+            Eigen::Vector3d P;
+            lookup(U[c], V[c], P.data());
+
+            Eigen::Vector3d P_exact(X[c], Y[c], Z[c]);
+
+            double angle = atan2(P.cross(P_exact).norm(), P.dot(P_exact));
+            if (angle > m_maxAngularError)
+            {
+                m_maxAngularError = angle;
+            }
+        }
+    }
+}
+
+bool
+BearingLUT::empty(void) const
+{
+    return m_data == 0;
+}
+
+int
+BearingLUT::imageWidth(void) const
+{
+    return m_imageWidth;
+}
+
+int
+BearingLUT::imageHeight(void) const
+{
+    return m_imageHeight;
+}
+
+int
+BearingLUT::step(void) const
+{
+    return m_step;
+}
+
+int
+BearingLUT::cols(void) const
+{
+    return m_cols;
+}
+
+int
+BearingLUT::rows(void) const
+{
+    return m_rows;
+}
+
+double
+BearingLUT::maxAngularError(void) const
+{
+    return m_maxAngularError;
+}
+
+uint64_t
+BearingLUT::cameraKey(void) const
+{
+    return m_cameraKey;
+}
+
+const float*
+BearingLUT::data(void) const
+{
+    return m_data;
+}
+
+template <typename T>
+void
+BearingLUT::lookup(T u, T v, T* P) const
+{
+    T fu = u * T(m_invStep);
+    T fv = v * T(m_invStep);
+
+    int c = std::min(std::max(static_cast<int>(std::floor(fu)), 0), m_cols - 2);
+    int r = std::min(std::max(static_cast<int>(std::floor(fv)), 0), m_rows - 2);
+
+    T a = fu - T(c);
+    T b = fv - T(r);
+
+    const float* p00 = m_data + 3 * (r * m_cols + c);
+    const float* p01 = p00 + 3;
+    const float* p10 = p00 + 3 * m_cols;
+    const float* p11 = p10 + 3;
+
+    T w00 = (T(1) - a) * (T(1) - b);
+    T w01 = a * (T(1) - b);
+    T w10 = (T(1) - a) * b;
+    T w11 = a * b;
+
+    for (int k = 0; k < 3; ++k)
+    {
+        P[k] = w00 * p00[k] + w01 * p01[k] + w10 * p10[k] + w11 * p11[k];
+    }
+
+    T inv_norm = T(1) / std::sqrt(P[0] * P[0] + P[1] * P[1] + P[2] * P[2]);
+
+    P[0] *= inv_norm;
+    P[1] *= inv_norm;
+    P[2] *= inv_norm;
+}
+
+void
+BearingLUT::liftSphere(const Eigen::Vector2d& p, Eigen::Vector3d& P) const
+{
+    lookup(p(0), p(1), P.data());
+}
+
+void
+BearingLUT::liftSphere(const Eigen::Vector2f& p, Eigen::Vector3f& P) const
+{
+    lookup(p(0), p(1), P.data());
+}
+
+void
+BearingLUT::liftSphere(const float* p, float* P, size_t count) const
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        lookup(p[2 * i], p[2 * i + 1], P + 3 * i);
+    }
+}
+
+bool
+BearingLUT::writeToFile(const std::string& filename) const
+{
+    if (empty())
+    {
+        return false;
+    }
+
+    std::ofstream ofs(filename.c_str(), std::ios::out | std::ios::binary);
+    if (!ofs.is_open())
+    {
+        return false;
+    }
+
+    BearingLUTFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, kBearingLUTMagic, sizeof(header.magic));
+    header.version = kBearingLUTVersion;
+    header.imageWidth = m_imageWidth;
+    header.imageHeight = m_imageHeight;
+    header.step = m_step;
+    header.cols = m_cols;
+    header.rows = m_rows;
+    header.maxAngularError = m_maxAngularError;
+    header.cameraKey = m_cameraKey;
+
+    ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    ofs.write(reinterpret_cast<const char*>(m_data),
+              sizeof(float) * 3 * m_cols * m_rows);
+
+    return ofs.good();
+}
+
+bool
+BearingLUT::readFromFile(const std::string& filename)
+{
+    return mapFile(filename, 0);
+}
+
+bool
+BearingLUT::readFromFile(const std::string& filename, const Camera& camera)
+{
+    uint64_t cameraKey = MapCache::cameraKey(camera);
+
+    return mapFile(filename, &cameraKey);
+}
+
+bool
+BearingLUT::mapFile(const std::string& filename, const uint64_t* cameraKey)
+{
+    namespace bip = boost::interprocess;
+
+    boost::shared_ptr<bip::mapped_region> region;
+    try
+    {
+        bip::file_mapping file(filename.c_str(), bip::read_only);
+        region.reset(new bip::mapped_region(file, bip::read_only));
+    }
+    catch (const bip::interprocess_exception&)
+    {
+        return false;
+    }
+
+    if (region->get_size() < sizeof(BearingLUTFileHeader))
+    {
+        return false;
+    }
+
+    const char* address = static_cast<const char*>(region->get_address());
+
+    BearingLUTFileHeader header;
+    memcpy(&header, address, sizeof(header));
+
+    if (memcmp(header.magic, kBearingLUTMagic, sizeof(header.magic)) != 0 ||
+        header.version != kBearingLUTVersion ||
+        header.step < 1 || header.cols < 2 || header.rows < 2 ||
+        (cameraKey != 0 && header.cameraKey != *cameraKey))
+    {
+        return false;
+    }
+
+    size_t dataSize = sizeof(float) * 3 * static_cast<size_t>(header.cols) * header.rows;
+    if (region->get_size() != sizeof(header) + dataSize)
+    {
+        return false;
+    }
+
+    m_imageWidth = header.imageWidth;
+    m_imageHeight = header.imageHeight;
+    m_step = header.step;
+    m_invStep = 1.0f / m_step;
+    m_cols = header.cols;
+    m_rows = header.rows;
+    m_maxAngularError = header.maxAngularError;
+    m_cameraKey = header.cameraKey;
+
+    m_table.reset();
+    m_region = region;
+    m_data = reinterpret_cast<const float*>(address + sizeof(header));
+
+    return true;
+}
+
+}
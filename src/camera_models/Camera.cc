@@ -1,11 +1,119 @@
 #include "camera_model/camera_models/Camera.h"
 #include "camera_model/camera_models/ScaramuzzaCamera.h"
+#include "camera_model/gpl/gpl.h"
 
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <mutex>
 #include <opencv2/calib3d/calib3d.hpp>
+#include <opencv2/core/eigen.hpp>
 
 namespace camera_model
 {
 
+namespace
+{
+
+// points transformed per chunk in the allocation-free projection functions
+const size_t kPoseChunkSize = 256;
+
+// batches of at least this many points are undistorted in parallel
+const size_t kParallelPointCount = 4096;
+
+/**
+ * \brief Runs body over the points [0, count) on numThreads threads
+ *
+ * parallelFor() takes int bounds, so batches of more than INT_MAX points
+ * are processed in several passes.
+ */
+void
+parallelForPoints(size_t count, int numThreads,
+                  const boost::function<void (size_t, size_t)>& body)
+{
+    const size_t maxPass = static_cast<size_t>(std::numeric_limits<int>::max());
+
+    for (size_t base = 0; base < count; base += maxPass)
+    {
+        int n = static_cast<int>(std::min(count - base, maxPass));
+
+        auto pass = [&](int begin, int end)
+        {
+            body(base + begin, base + end);
+        };
+
+        parallelFor(0, n, numThreads, pass);
+    }
+}
+
+/**
+ * \brief Camera matrix coefficients of an optional K, identity if empty
+ */
+void
+cameraMatrixCoefficients(const cv::Mat& K, float& fx, float& fy,
+                         float& cx, float& cy, float& skew)
+{
+    if (K.empty())
+    {
+        fx = fy = 1.0f;
+        cx = cy = skew = 0.0f;
+        return;
+    }
+
+    cv::Mat K_d;
+    K.convertTo(K_d, CV_64F);
+
+    fx = K_d.at<double>(0,0);
+    fy = K_d.at<double>(1,1);
+    cx = K_d.at<double>(0,2);
+    cy = K_d.at<double>(1,2);
+    skew = K_d.at<double>(0,1);
+}
+
+/**
+ * \brief Converts an OpenCV rotation vector and translation to Eigen
+ *
+ * Uses the angle-axis form directly instead of cv::Rodrigues so that no
+ * temporary matrix is allocated.
+ */
+void
+poseFromRvecTvec(const cv::Mat& rvec, const cv::Mat& tvec,
+                 Eigen::Quaterniond& q, Eigen::Vector3d& t)
+{
+    Eigen::Vector3d r(rvec.at<double>(0), rvec.at<double>(1), rvec.at<double>(2));
+
+    double angle = r.norm();
+    if (angle < 1e-12)
+    {
+        q.setIdentity();
+    }
+    else
+    {
+        q = Eigen::AngleAxisd(angle, r / angle);
+    }
+
+    t << tvec.at<double>(0), tvec.at<double>(1), tvec.at<double>(2);
+}
+
+/**
+ * \brief Rotates and translates object points into packed camera coordinates
+ */
+void
+transformPoints(const cv::Point3f* objectPoints, size_t count,
+                const Eigen::Matrix3d& R, const Eigen::Vector3d& t,
+                double* P)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        const cv::Point3f& objectPoint = objectPoints[i];
+
+        Eigen::Map<Eigen::Vector3d>(P + 3 * i) =
+            R * Eigen::Vector3d(objectPoint.x, objectPoint.y, objectPoint.z) + t;
+    }
+}
+
+}
+
 Camera::Parameters::Parameters(ModelType modelType)
  : m_modelType(modelType)
  , m_imageWidth(0)
@@ -107,6 +215,33 @@ Camera::Parameters::nIntrinsics(void) const
     return m_nIntrinsics;
 }
 
+Camera::ReprojectionStats::ReprojectionStats()
+ : count(0)
+ , sum(0.0)
+ , sumSquared(0.0)
+ , max(0.0)
+{
+
+}
+
+double
+Camera::ReprojectionStats::mean(void) const
+{
+    return count == 0 ? 0.0 : sum / count;
+}
+
+double
+Camera::ReprojectionStats::rms(void) const
+{
+    return count == 0 ? 0.0 : sqrt(sumSquared / count);
+}
+
+Camera::Camera()
+ : m_numThreads(0)
+{
+
+}
+
 cv::Mat&
 Camera::mask(void)
 {
@@ -172,26 +307,50 @@ Camera::reprojectionError(const std::vector< std::vector<cv::Point3f> >& objectP
 
     for (int i = 0; i < imageCount; ++i)
     {
-        size_t pointCount = imagePoints.at(i).size();
+        Eigen::Quaterniond q;
+        Eigen::Vector3d t;
+        poseFromRvecTvec(rvecs.at(i), tvecs.at(i), q, t);
 
-        pointsSoFar += pointCount;
-
-        std::vector<cv::Point2f> estImagePoints;
-        projectPoints(objectPoints.at(i), rvecs.at(i), tvecs.at(i),
-                      estImagePoints);
-
-        double err = 0.0;
-        for (size_t j = 0; j < imagePoints.at(i).size(); ++j)
-        {
-            err += cv::norm(imagePoints.at(i).at(j) - estImagePoints.at(j));
-        }
+        ReprojectionStats stats =
+            reprojectionResiduals(objectPoints.at(i).data(), imagePoints.at(i).data(),
+                                  imagePoints.at(i).size(), q, t);
 
         if (computePerViewErrors)
         {
-            perViewErrors.at<double>(i) = err / pointCount;
+            perViewErrors.at<double>(i) = stats.mean();
         }
 
-        totalErr += err;
+        pointsSoFar += stats.count;
+        totalErr += stats.sum;
+    }
+
+    return totalErr / pointsSoFar;
+}
+
+double
+Camera::reprojectionError(const std::vector< std::vector<cv::Point3f> >& objectPoints,
+                          const std::vector< std::vector<cv::Point2f> >& imagePoints,
+                          const std::vector<cv::Mat>& rvecs,
+                          const std::vector<cv::Mat>& tvecs,
+                          std::vector<ReprojectionStats>& perViewStats) const
+{
+    perViewStats.resize(objectPoints.size());
+
+    size_t pointsSoFar = 0;
+    double totalErr = 0.0;
+
+    for (size_t i = 0; i < objectPoints.size(); ++i)
+    {
+        Eigen::Quaterniond q;
+        Eigen::Vector3d t;
+        poseFromRvecTvec(rvecs.at(i), tvecs.at(i), q, t);
+
+        perViewStats.at(i) =
+            reprojectionResiduals(objectPoints.at(i).data(), imagePoints.at(i).data(),
+                                  imagePoints.at(i).size(), q, t);
+
+        pointsSoFar += perViewStats.at(i).count;
+        totalErr += perViewStats.at(i).sum;
     }
 
     return totalErr / pointsSoFar;
@@ -211,6 +370,62 @@ Camera::reprojectionError(const Eigen::Vector3d& P,
     return (p - observed_p).norm();
 }
 
+Camera::ReprojectionStats
+Camera::reprojectionResiduals(const cv::Point3f* objectPoints,
+                              const cv::Point2f* imagePoints,
+                              size_t count,
+                              const Eigen::Quaterniond& camera_q,
+                              const Eigen::Vector3d& camera_t,
+                              double* residuals,
+                              cv::Point2f* estImagePoints) const
+{
+    Eigen::Matrix3d R = camera_q.toRotationMatrix();
+
+    double P[3 * kPoseChunkSize];
+    double p[2 * kPoseChunkSize];
+
+    ReprojectionStats stats;
+    stats.count = count;
+
+    for (size_t begin = 0; begin < count; begin += kPoseChunkSize)
+    {
+        size_t n = std::min(kPoseChunkSize, count - begin);
+
+        transformPoints(objectPoints + begin, n, R, camera_t, P);
+        spaceToPlane(P, p, n);
+
+        for (size_t i = 0; i < n; ++i)
+        {
+            const cv::Point2f& imagePoint = imagePoints[begin + i];
+
+            double du = p[2 * i] - imagePoint.x;
+            double dv = p[2 * i + 1] - imagePoint.y;
+
+            if (residuals)
+            {
+                residuals[2 * (begin + i)] = du;
+                residuals[2 * (begin + i) + 1] = dv;
+            }
+            if (estImagePoints)
+            {
+                estImagePoints[begin + i] = cv::Point2f(p[2 * i], p[2 * i + 1]);
+            }
+
+            double err2 = du * du + dv * dv;
+            double err = sqrt(err2);
+
+            stats.sum += err;
+            stats.sumSquared += err2;
+            if (err > stats.max)
+            {
+                stats.max = err;
+            }
+        }
+    }
+
+    return stats;
+}
+
 void
 Camera::projectPoints(const std::vector<cv::Point3f>& objectPoints,
                       const cv::Mat& rvec,
@@ -218,35 +433,946 @@ Camera::projectPoints(const std::vector<cv::Point3f>& objectPoints,
                       std::vector<cv::Point2f>& imagePoints) const
 {
     // project 3D object points to the image plane
-    imagePoints.reserve(objectPoints.size());
+    imagePoints.resize(objectPoints.size());
 
-    //double
-    cv::Mat R0;
-    cv::Rodrigues(rvec, R0);
+    Eigen::Quaterniond q;
+    Eigen::Vector3d t;
+    poseFromRvecTvec(rvec, tvec, q, t);
 
-    Eigen::MatrixXd R(3,3);
-    R << R0.at<double>(0,0), R0.at<double>(0,1), R0.at<double>(0,2),
-         R0.at<double>(1,0), R0.at<double>(1,1), R0.at<double>(1,2),
-         R0.at<double>(2,0), R0.at<double>(2,1), R0.at<double>(2,2);
+    projectPoints(objectPoints.data(), objectPoints.size(), q, t, imagePoints.data());
+}
 
-    Eigen::Vector3d t;
-    t << tvec.at<double>(0), tvec.at<double>(1), tvec.at<double>(2);
+void
+Camera::projectPoints(const cv::Point3f* objectPoints, size_t count,
+                      const Eigen::Quaterniond& camera_q,
+                      const Eigen::Vector3d& camera_t,
+                      cv::Point2f* imagePoints) const
+{
+    Eigen::Matrix3d R = camera_q.toRotationMatrix();
 
-    for (size_t i = 0; i < objectPoints.size(); ++i)
+    double P[3 * kPoseChunkSize];
+    double p[2 * kPoseChunkSize];
+
+    for (size_t begin = 0; begin < count; begin += kPoseChunkSize)
     {
-        const cv::Point3f& objectPoint = objectPoints.at(i);
+        size_t n = std::min(kPoseChunkSize, count - begin);
 
-        // Rotate and translate
-        Eigen::Vector3d P;
-        P << objectPoint.x, objectPoint.y, objectPoint.z;
+        transformPoints(objectPoints + begin, n, R, camera_t, P);
+        spaceToPlane(P, p, n);
 
-        P = R * P + t;
+        for (size_t i = 0; i < n; ++i)
+        {
+            imagePoints[begin + i] = cv::Point2f(p[2 * i], p[2 * i + 1]);
+        }
+    }
+}
+
+void
+Camera::spaceToPlane(const double* P, double* p, size_t count) const
+{
+    spaceToPlaneBatch(P, P + 1, P + 2, 3, p, p + 1, 2, count);
+}
 
+void
+Camera::spaceToPlane(const double* X, const double* Y, const double* Z,
+                     double* u, double* v, size_t count) const
+{
+    spaceToPlaneBatch(X, Y, Z, 1, u, v, 1, count);
+}
+
+void
+Camera::spaceToPlane(const Eigen::Matrix3Xd& P, Eigen::Matrix2Xd& p) const
+{
+    p.resize(2, P.cols());
+
+    spaceToPlane(P.data(), p.data(), P.cols());
+}
+
+void
+Camera::spaceToPlane(const double* P, double* p, double* J, size_t count) const
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        Eigen::Vector2d p_i;
+        Eigen::Matrix<double,2,3> J_i;
+        spaceToPlane(Eigen::Vector3d(P[3 * i], P[3 * i + 1], P[3 * i + 2]), p_i, J_i);
+
+        p[2 * i] = p_i(0);
+        p[2 * i + 1] = p_i(1);
+        Eigen::Map<Eigen::Matrix<double,2,3> >(J + 6 * i) = J_i;
+    }
+}
+
+void
+Camera::spaceToPlane(const Eigen::Matrix3Xd& P, Eigen::Matrix2Xd& p,
+                     Eigen::Matrix<double,2,Eigen::Dynamic>& J) const
+{
+    p.resize(2, P.cols());
+    J.resize(2, 3 * P.cols());
+
+    spaceToPlane(P.data(), p.data(), J.data(), P.cols());
+}
+
+void
+Camera::liftProjective(const double* p, double* P, size_t count) const
+{
+    liftProjectiveBatch(p, p + 1, 2, P, P + 1, P + 2, 3, count);
+}
+
+void
+Camera::liftProjective(const double* u, const double* v,
+                       double* X, double* Y, double* Z, size_t count) const
+{
+    liftProjectiveBatch(u, v, 1, X, Y, Z, 1, count);
+}
+
+void
+Camera::liftProjective(const Eigen::Matrix2Xd& p, Eigen::Matrix3Xd& P) const
+{
+    P.resize(3, p.cols());
+
+    liftProjective(p.data(), P.data(), p.cols());
+}
+
+void
+Camera::liftSphere(const double* p, double* P, size_t count) const
+{
+    liftSphereBatch(p, p + 1, 2, P, P + 1, P + 2, 3, count);
+}
+
+void
+Camera::liftSphere(const double* u, const double* v,
+                   double* X, double* Y, double* Z, size_t count) const
+{
+    liftSphereBatch(u, v, 1, X, Y, Z, 1, count);
+}
+
+void
+Camera::liftSphere(const Eigen::Matrix2Xd& p, Eigen::Matrix3Xd& P) const
+{
+    P.resize(3, p.cols());
+
+    liftSphere(p.data(), P.data(), p.cols());
+}
+
+void
+Camera::spaceToPlane(const Eigen::Vector3f& P, Eigen::Vector2f& p) const
+{
+    spaceToPlaneBatch(&P(0), &P(1), &P(2), 0, &p(0), &p(1), 0, 1);
+}
+
+void
+Camera::liftProjective(const Eigen::Vector2f& p, Eigen::Vector3f& P) const
+{
+    liftProjectiveBatch(&p(0), &p(1), 0, &P(0), &P(1), &P(2), 0, 1);
+}
+
+void
+Camera::liftSphere(const Eigen::Vector2f& p, Eigen::Vector3f& P) const
+{
+    liftSphereBatch(&p(0), &p(1), 0, &P(0), &P(1), &P(2), 0, 1);
+}
+
+void
+Camera::spaceToPlane(const float* P, float* p, size_t count) const
+{
+    spaceToPlaneBatch(P, P + 1, P + 2, 3, p, p + 1, 2, count);
+}
+
+void
+Camera::spaceToPlane(const float* X, const float* Y, const float* Z,
+                     float* u, float* v, size_t count) const
+{
+    spaceToPlaneBatch(X, Y, Z, 1, u, v, 1, count);
+}
+
+void
+Camera::spaceToPlane(const Eigen::Matrix3Xf& P, Eigen::Matrix2Xf& p) const
+{
+    p.resize(2, P.cols());
+
+    spaceToPlane(P.data(), p.data(), P.cols());
+}
+
+void
+Camera::liftProjective(const float* p, float* P, size_t count) const
+{
+    liftProjectiveBatch(p, p + 1, 2, P, P + 1, P + 2, 3, count);
+}
+
+void
+Camera::liftProjective(const float* u, const float* v,
+                       float* X, float* Y, float* Z, size_t count) const
+{
+    liftProjectiveBatch(u, v, 1, X, Y, Z, 1, count);
+}
+
+void
+Camera::liftProjective(const Eigen::Matrix2Xf& p, Eigen::Matrix3Xf& P) const
+{
+    P.resize(3, p.cols());
+
+    liftProjective(p.data(), P.data(), p.cols());
+}
+
+void
+Camera::liftSphere(const float* p, float* P, size_t count) const
+{
+    liftSphereBatch(p, p + 1, 2, P, P + 1, P + 2, 3, count);
+}
+
+void
+Camera::liftSphere(const float* u, const float* v,
+                   float* X, float* Y, float* Z, size_t count) const
+{
+    liftSphereBatch(u, v, 1, X, Y, Z, 1, count);
+}
+
+void
+Camera::liftSphere(const Eigen::Matrix2Xf& p, Eigen::Matrix3Xf& P) const
+{
+    P.resize(3, p.cols());
+
+    liftSphere(p.data(), P.data(), p.cols());
+}
+
+void
+Camera::undistortPoints(const float* p_d, float* p_u, size_t count,
+                        const cv::Mat& K_new) const
+{
+    float fx, fy, cx, cy, skew;
+    cameraMatrixCoefficients(K_new, fx, fy, cx, cy, skew);
+
+    // each chunk is read completely before it is written, so p_u may
+    // alias p_d
+    auto undistortRange = [&](size_t begin, size_t end)
+    {
+        float X[kPoseChunkSize], Y[kPoseChunkSize], Z[kPoseChunkSize];
+
+        for (size_t first = begin; first < end; first += kPoseChunkSize)
+        {
+            size_t n = std::min(kPoseChunkSize, end - first);
+
+            liftProjectiveBatch(p_d + 2 * first, p_d + 2 * first + 1, 2,
+                                X, Y, Z, 1, n);
+
+            float* p = p_u + 2 * first;
+            for (size_t i = 0; i < n; ++i)
+            {
+                float inv_z = 1.0f / Z[i];
+                float x = X[i] * inv_z;
+                float y = Y[i] * inv_z;
+
+                p[2 * i] = fx * x + skew * y + cx;
+                p[2 * i + 1] = fy * y + cy;
+            }
+        }
+    };
+
+    if (count < kParallelPointCount)
+    {
+        undistortRange(0, count);
+    }
+    else
+    {
+        parallelForPoints(count, m_numThreads, undistortRange);
+    }
+}
+
+void
+Camera::undistortPoints(const cv::Point2f* p_d, cv::Point2f* p_u, size_t count,
+                        const cv::Mat& K_new) const
+{
+    undistortPoints(&p_d->x, &p_u->x, count, K_new);
+}
+
+void
+Camera::distortPoints(const float* p_u, float* p_d, size_t count,
+                      const cv::Mat& K_new) const
+{
+    float fx, fy, cx, cy, skew;
+    cameraMatrixCoefficients(K_new, fx, fy, cx, cy, skew);
+
+    auto distortRange = [&](size_t begin, size_t end)
+    {
+        float X[kPoseChunkSize], Y[kPoseChunkSize], Z[kPoseChunkSize];
+        std::fill(Z, Z + kPoseChunkSize, 1.0f);
+
+        for (size_t first = begin; first < end; first += kPoseChunkSize)
+        {
+            size_t n = std::min(kPoseChunkSize, end - first);
+
+            const float* p = p_u + 2 * first;
+            for (size_t i = 0; i < n; ++i)
+            {
+                Y[i] = (p[2 * i + 1] - cy) / fy;
+                X[i] = (p[2 * i] - cx - skew * Y[i]) / fx;
+            }
+
+            spaceToPlaneBatch(X, Y, Z, 1, p_d + 2 * first, p_d + 2 * first + 1, 2, n);
+        }
+    };
+
+    if (count < kParallelPointCount)
+    {
+        distortRange(0, count);
+    }
+    else
+    {
+        parallelForPoints(count, m_numThreads, distortRange);
+    }
+}
+
+void
+Camera::distortPoints(const cv::Point2f* p_u, cv::Point2f* p_d, size_t count,
+                      const cv::Mat& K_new) const
+{
+    distortPoints(&p_u->x, &p_d->x, count, K_new);
+}
+
+void
+Camera::spaceToPlaneBatch(const double* x, const double* y, const double* z,
+                          int inStride,
+                          double* u, double* v, int outStride,
+                          size_t count) const
+{
+    for (size_t i = 0; i < count; ++i)
+    {
         Eigen::Vector2d p;
-        spaceToPlane(P, p);
+        spaceToPlane(Eigen::Vector3d(x[i * inStride], y[i * inStride], z[i * inStride]), p);
+
+        u[i * outStride] = p(0);
+        v[i * outStride] = p(1);
+    }
+}
+
+void
+Camera::liftProjectiveBatch(const double* u, const double* v, int inStride,
+                            double* x, double* y, double* z,
+                            int outStride, size_t count) const
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        Eigen::Vector3d P;
+        liftProjective(Eigen::Vector2d(u[i * inStride], v[i * inStride]), P);
+
+        x[i * outStride] = P(0);
+        y[i * outStride] = P(1);
+        z[i * outStride] = P(2);
+    }
+}
+
+void
+Camera::liftSphereBatch(const double* u, const double* v, int inStride,
+                        double* x, double* y, double* z,
+                        int outStride, size_t count) const
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        Eigen::Vector3d P;
+        liftSphere(Eigen::Vector2d(u[i * inStride], v[i * inStride]), P);
+
+        x[i * outStride] = P(0);
+        y[i * outStride] = P(1);
+        z[i * outStride] = P(2);
+    }
+}
+
+void
+Camera::spaceToPlaneBatch(const float* x, const float* y, const float* z,
+                          int inStride,
+                          float* u, float* v, int outStride,
+                          size_t count) const
+{
+    const size_t chunkSize = 256;
+    double P[3 * chunkSize], p[2 * chunkSize];
+
+    for (size_t begin = 0; begin < count; begin += chunkSize)
+    {
+        size_t n = std::min(chunkSize, count - begin);
+
+        for (size_t i = 0; i < n; ++i)
+        {
+            const size_t in = (begin + i) * inStride;
+
+            P[3 * i] = x[in];
+            P[3 * i + 1] = y[in];
+            P[3 * i + 2] = z[in];
+        }
+
+        spaceToPlaneBatch(P, P + 1, P + 2, 3, p, p + 1, 2, n);
+
+        for (size_t i = 0; i < n; ++i)
+        {
+            const size_t out = (begin + i) * outStride;
+
+            u[out] = p[2 * i];
+            v[out] = p[2 * i + 1];
+        }
+    }
+}
+
+void
+Camera::liftProjectiveBatch(const float* u, const float* v, int inStride,
+                            float* x, float* y, float* z,
+                            int outStride, size_t count) const
+{
+    const size_t chunkSize = 256;
+    double p[2 * chunkSize], P[3 * chunkSize];
+
+    for (size_t begin = 0; begin < count; begin += chunkSize)
+    {
+        size_t n = std::min(chunkSize, count - begin);
+
+        for (size_t i = 0; i < n; ++i)
+        {
+            const size_t in = (begin + i) * inStride;
+
+            p[2 * i] = u[in];
+            p[2 * i + 1] = v[in];
+        }
+
+        liftProjectiveBatch(p, p + 1, 2, P, P + 1, P + 2, 3, n);
+
+        for (size_t i = 0; i < n; ++i)
+        {
+            const size_t out = (begin + i) * outStride;
+
+            x[out] = P[3 * i];
+            y[out] = P[3 * i + 1];
+            z[out] = P[3 * i + 2];
+        }
+    }
+}
+
+void
+Camera::liftSphereBatch(const float* u, const float* v, int inStride,
+                        float* x, float* y, float* z,
+                        int outStride, size_t count) const
+{
+    const size_t chunkSize = 256;
+    double p[2 * chunkSize], P[3 * chunkSize];
+
+    for (size_t begin = 0; begin < count; begin += chunkSize)
+    {
+        size_t n = std::min(chunkSize, count - begin);
+
+        for (size_t i = 0; i < n; ++i)
+        {
+            const size_t in = (begin + i) * inStride;
+
+            p[2 * i] = u[in];
+            p[2 * i + 1] = v[in];
+        }
+
+        liftSphereBatch(p, p + 1, 2, P, P + 1, P + 2, 3, n);
+
+        for (size_t i = 0; i < n; ++i)
+        {
+            const size_t out = (begin + i) * outStride;
+
+            x[out] = P[3 * i];
+            y[out] = P[3 * i + 1];
+            z[out] = P[3 * i + 2];
+        }
+    }
+}
+
+void
+Camera::setNumThreads(int numThreads)
+{
+    m_numThreads = std::max(numThreads, 0);
+}
+
+int
+Camera::numThreads(void) const
+{
+    return m_numThreads;
+}
+
+namespace
+{
+
+/**
+ * \brief Allocates remap maps of the requested format
+ *
+ * \return m1type with values <= 0 replaced by CV_16SC2
+ */
+int
+createRemapMaps(const cv::Size& imageSize, int m1type, cv::Mat& map1, cv::Mat& map2)
+{
+    if (m1type <= 0)
+    {
+        m1type = CV_16SC2;
+    }
+    CV_Assert(m1type == CV_32FC1 || m1type == CV_32FC2 || m1type == CV_16SC2);
+
+    map1.create(imageSize, m1type);
+    if (m1type == CV_32FC1)
+    {
+        map2.create(imageSize, CV_32FC1);
+    }
+    else if (m1type == CV_16SC2)
+    {
+        map2.create(imageSize, CV_16UC1);
+    }
+    else
+    {
+        map2.release();
+    }
+
+    return m1type;
+}
+
+/**
+ * \brief Stores one row of image points in maps of type CV_32FC2 or CV_16SC2
+ */
+void
+storeRemapRow(const float* U, const float* V, int v,
+              cv::Mat& map1, cv::Mat& map2)
+{
+    if (map1.type() == CV_32FC2)
+    {
+        float* xy = map1.ptr<float>(v);
+        for (int u = 0; u < map1.cols; ++u)
+        {
+            xy[2 * u] = U[u];
+            xy[2 * u + 1] = V[u];
+        }
+    }
+    else
+    {
+        // same fixed-point encoding as cv::convertMaps()
+        short* xy = map1.ptr<short>(v);
+        ushort* a = map2.ptr<ushort>(v);
+        for (int u = 0; u < map1.cols; ++u)
+        {
+            int iu = cvRound(U[u] * cv::INTER_TAB_SIZE);
+            int iv = cvRound(V[u] * cv::INTER_TAB_SIZE);
+
+            xy[2 * u] = cv::saturate_cast<short>(iu >> cv::INTER_BITS);
+            xy[2 * u + 1] = cv::saturate_cast<short>(iv >> cv::INTER_BITS);
+            a[u] = static_cast<ushort>((iv & (cv::INTER_TAB_SIZE - 1)) * cv::INTER_TAB_SIZE +
+                                       (iu & (cv::INTER_TAB_SIZE - 1)));
+        }
+    }
+}
+
+/**
+ * \brief Weights of the grid nodes around a point at fraction a of a cell
+ *
+ * Linear interpolation uses nodes i and i + 1, cubic (Catmull-Rom)
+ * interpolation nodes i - 1 to i + 2.
+ */
+void
+interpolationWeights(float a, int interpolation, float* w)
+{
+    if (interpolation == cv::INTER_CUBIC)
+    {
+        float a2 = a * a;
+        float a3 = a2 * a;
+
+        w[0] = 0.5f * (-a3 + 2.0f * a2 - a);
+        w[1] = 0.5f * (3.0f * a3 - 5.0f * a2 + 2.0f);
+        w[2] = 0.5f * (-3.0f * a3 + 4.0f * a2 + a);
+        w[3] = 0.5f * (a3 - a2);
+    }
+    else
+    {
+        w[0] = 0.0f;
+        w[1] = 1.0f - a;
+        w[2] = a;
+        w[3] = 0.0f;
+    }
+}
+
+}
+
+void
+Camera::initRectifyMap(const cv::Size& imageSize,
+                       const boost::function<void (int, float*, float*, float*)>& rays,
+                       cv::Mat& map1, cv::Mat& map2, int m1type,
+                       int numThreads) const
+{
+    m1type = createRemapMaps(imageSize, m1type, map1, map2);
+
+    // each block of rows uses its own ray and image point buffers
+    auto fillRows = [&](int rowBegin, int rowEnd)
+    {
+        std::vector<float> X(imageSize.width), Y(imageSize.width), Z(imageSize.width);
+        std::vector<float> U(imageSize.width), V(imageSize.width);
+
+        for (int v = rowBegin; v < rowEnd; ++v)
+        {
+            rays(v, &X[0], &Y[0], &Z[0]);
+
+            if (m1type == CV_32FC1)
+            {
+                spaceToPlane(&X[0], &Y[0], &Z[0],
+                             map1.ptr<float>(v), map2.ptr<float>(v), imageSize.width);
+            }
+            else
+            {
+                spaceToPlane(&X[0], &Y[0], &Z[0], &U[0], &V[0], imageSize.width);
+                storeRemapRow(&U[0], &V[0], v, map1, map2);
+            }
+        }
+    };
+
+    parallelFor(0, imageSize.height, numThreads < 0 ? m_numThreads : numThreads, fillRows);
+}
+
+void
+Camera::initRectifyMap(const cv::Size& imageSize, const Eigen::Matrix3f& A,
+                       cv::Mat& map1, cv::Mat& map2, int m1type,
+                       const cv::Point& offset, int numThreads) const
+{
+    auto linearRays = [&](int v, float* X, float* Y, float* Z)
+    {
+        Eigen::Vector3f row = A.col(1) * (offset.y + v) + A.col(2);
+
+        for (int u = 0; u < imageSize.width; ++u)
+        {
+            X[u] = A(0,0) * (offset.x + u) + row(0);
+            Y[u] = A(1,0) * (offset.x + u) + row(1);
+            Z[u] = A(2,0) * (offset.x + u) + row(2);
+        }
+    };
+
+    initRectifyMap(imageSize, linearRays, map1, map2, m1type, numThreads);
+}
+
+void
+Camera::initUndistortRectifyMapRegion(cv::Mat& map1, cv::Mat& map2,
+                                      const cv::Mat& K_rect, const cv::Rect& roi,
+                                      cv::Mat rmat, int m1type,
+                                      int numThreads) const
+{
+    Eigen::Matrix3f K, R;
+    cv::cv2eigen(K_rect, K);
+    cv::cv2eigen(rmat, R);
+
+    Eigen::Matrix3f A = R.inverse() * K.inverse();
+
+    initRectifyMap(roi.size(), A, map1, map2, m1type, roi.tl(), numThreads);
+}
+
+void
+Camera::initCubemapMaps(std::vector<cv::Mat>& maps1, std::vector<cv::Mat>& maps2,
+                        int faceSize, cv::Mat rmat, int m1type) const
+{
+    Eigen::Matrix3f R;
+    cv::cv2eigen(rmat, R);
+
+    // rays are generated in the cube frame and rotated into the camera
+    Eigen::Matrix3f R_inv = R.transpose();
+
+    // coordinates of the pixel centres on a face at unit distance, shared
+    // by all faces and both image directions
+    std::vector<float> coords(faceSize);
+    for (int i = 0; i < faceSize; ++i)
+    {
+        coords[i] = 2.0f * (i + 0.5f) / faceSize - 1.0f;
+    }
+
+    auto faceRays = [&](int v, float* X, float* Y, float* Z)
+    {
+        int face = v / faceSize;
+        float b = coords[v % faceSize];
+
+        for (int u = 0; u < faceSize; ++u)
+        {
+            float a = coords[u];
+
+            Eigen::Vector3f P;
+            switch (face)
+            {
+            case 0: P << 1.0f, b, -a; break;
+            case 1: P << -1.0f, b, a; break;
+            case 2: P << a, 1.0f, -b; break;
+            case 3: P << a, -1.0f, b; break;
+            case 4: P << a, b, 1.0f; break;
+            default: P << -a, b, -1.0f; break;
+            }
+
+            P = R_inv * P;
+
+            X[u] = P(0);
+            Y[u] = P(1);
+            Z[u] = P(2);
+        }
+    };
+
+    cv::Mat map1, map2;
+    initRectifyMap(cv::Size(faceSize, 6 * faceSize), faceRays, map1, map2, m1type);
+
+    maps1.resize(6);
+    maps2.resize(6);
+    for (int i = 0; i < 6; ++i)
+    {
+        maps1[i] = map1.rowRange(i * faceSize, (i + 1) * faceSize);
+        maps2[i] = map2.empty() ? cv::Mat() : map2.rowRange(i * faceSize, (i + 1) * faceSize);
+    }
+}
+
+void
+Camera::initEquirectangularMap(cv::Mat& map1, cv::Mat& map2,
+                               const cv::Size& imageSize,
+                               float hfov, float vfov,
+                               cv::Mat rmat, int m1type) const
+{
+    Eigen::Matrix3f R;
+    cv::cv2eigen(rmat, R);
+    Eigen::Matrix3f R_inv = R.transpose();
+
+    // longitude depends only on the column and latitude only on the row
+    std::vector<float> sinLon(imageSize.width), cosLon(imageSize.width);
+    for (int u = 0; u < imageSize.width; ++u)
+    {
+        double lon = ((u + 0.5) / imageSize.width - 0.5) * hfov;
+        sinLon[u] = sin(lon);
+        cosLon[u] = cos(lon);
+    }
+
+    auto sphereRays = [&](int v, float* X, float* Y, float* Z)
+    {
+        double lat = ((v + 0.5) / imageSize.height - 0.5) * vfov;
+        float sinLat = sin(lat);
+        float cosLat = cos(lat);
+
+        for (int u = 0; u < imageSize.width; ++u)
+        {
+            Eigen::Vector3f P(cosLat * sinLon[u], sinLat, cosLat * cosLon[u]);
+            P = R_inv * P;
+
+            X[u] = P(0);
+            Y[u] = P(1);
+            Z[u] = P(2);
+        }
+    };
+
+    initRectifyMap(imageSize, sphereRays, map1, map2, m1type);
+}
+
+double
+Camera::initApproxUndistortRectifyMap(cv::Mat& map1, cv::Mat& map2,
+                                      const cv::Mat& K_rect, cv::Size imageSize,
+                                      cv::Mat rmat, int gridStep,
+                                      int interpolation, int m1type) const
+{
+    if (imageSize == cv::Size(0, 0))
+    {
+        imageSize = cv::Size(imageWidth(), imageHeight());
+    }
+
+    gridStep = std::max(gridStep, 1);
+
+    Eigen::Matrix3f K, R;
+    cv::cv2eigen(K_rect, K);
+    cv::cv2eigen(rmat, R);
+
+    // ray of pixel (u, v) is A * (u, v, 1)
+    Eigen::Matrix3f A = R.inverse() * K.inverse();
+
+    // Grid nodes sit on every gridStep-th pixel, with one extra node on
+    // each side for the cubic kernel. Node (c, r) covers pixel
+    // ((c - 1) * gridStep, (r - 1) * gridStep).
+    int cells_u = std::max((imageSize.width - 1 + gridStep - 1) / gridStep, 1);
+    int cells_v = std::max((imageSize.height - 1 + gridStep - 1) / gridStep, 1);
+    int cols = cells_u + 3;
+    int rows = cells_v + 3;
+
+    std::vector<float> gridU(cols * rows), gridV(cols * rows);
+
+    auto projectNodes = [&](int rowBegin, int rowEnd)
+    {
+        std::vector<float> X(cols), Y(cols), Z(cols);
+
+        for (int r = rowBegin; r < rowEnd; ++r)
+        {
+            Eigen::Vector3f row = A.col(1) * ((r - 1) * gridStep) + A.col(2);
+
+            for (int c = 0; c < cols; ++c)
+            {
+                X[c] = A(0,0) * ((c - 1) * gridStep) + row(0);
+                Y[c] = A(1,0) * ((c - 1) * gridStep) + row(1);
+                Z[c] = A(2,0) * ((c - 1) * gridStep) + row(2);
+            }
+
+            spaceToPlane(&X[0], &Y[0], &Z[0], &gridU[r * cols], &gridV[r * cols], cols);
+        }
+    };
+
+    parallelFor(0, rows, m_numThreads, projectNodes);
+
+    // cell and weights of every column, shared by all rows
+    std::vector<int> cellOfColumn(imageSize.width);
+    std::vector<float> columnWeights(4 * imageSize.width);
+    for (int u = 0; u < imageSize.width; ++u)
+    {
+        cellOfColumn[u] = std::min(u / gridStep, cells_u - 1);
+        interpolationWeights(float(u - cellOfColumn[u] * gridStep) / gridStep,
+                             interpolation, &columnWeights[4 * u]);
+    }
+
+    m1type = createRemapMaps(imageSize, m1type, map1, map2);
+
+    auto interpolateRows = [&](int rowBegin, int rowEnd)
+    {
+        // grid rows blended for the current image row
+        std::vector<float> blendU(cols), blendV(cols);
+        std::vector<float> U(imageSize.width), V(imageSize.width);
+
+        for (int v = rowBegin; v < rowEnd; ++v)
+        {
+            int cell = std::min(v / gridStep, cells_v - 1);
+
+            float w[4];
+            interpolationWeights(float(v - cell * gridStep) / gridStep, interpolation, w);
+
+            // nodes cell - 1 to cell + 2 are stored in rows cell to cell + 3
+            const float* gU = &gridU[cell * cols];
+            const float* gV = &gridV[cell * cols];
+            for (int c = 0; c < cols; ++c)
+            {
+                blendU[c] = w[0] * gU[c] + w[1] * gU[c + cols] + w[2] * gU[c + 2 * cols] + w[3] * gU[c + 3 * cols];
+                blendV[c] = w[0] * gV[c] + w[1] * gV[c + cols] + w[2] * gV[c + 2 * cols] + w[3] * gV[c + 3 * cols];
+            }
+
+            float* outU = (m1type == CV_32FC1) ? map1.ptr<float>(v) : &U[0];
+            float* outV = (m1type == CV_32FC1) ? map2.ptr<float>(v) : &V[0];
+
+            for (int u = 0; u < imageSize.width; ++u)
+            {
+                const float* cw = &columnWeights[4 * u];
+                const float* bU = &blendU[cellOfColumn[u]];
+                const float* bV = &blendV[cellOfColumn[u]];
+
+                outU[u] = cw[0] * bU[0] + cw[1] * bU[1] + cw[2] * bU[2] + cw[3] * bU[3];
+                outV[u] = cw[0] * bV[0] + cw[1] * bV[1] + cw[2] * bV[2] + cw[3] * bV[3];
+            }
+
+            if (m1type != CV_32FC1)
+            {
+                storeRemapRow(&U[0], &V[0], v, map1, map2);
+            }
+        }
+    };
+
+    parallelFor(0, imageSize.height, m_numThreads, interpolateRows);
 
-        imagePoints.push_back(cv::Point2f(p(0), p(1)));
+    // Every pixel is a grid node, so the map is exact.
+    if (gridStep == 1)
+    {
+        return 0.0;
+    }
+
+    // Validate at the cell centres and edge midpoints, where the
+    // interpolation error peaks. Only every validationStride-th cell in
+    // each direction and the last one are checked, which projects about
+    // one pixel in a thousand exactly. The interpolated value is
+    // recomputed from the grid so that the fixed-point quantisation is not
+    // counted.
+    const float halfStep = 0.5f * gridStep;
+    const int validationStride = static_cast<int>(std::ceil(std::sqrt(3072.0) / gridStep));
+
+    std::vector<int> checkedCells_u, checkedCells_v;
+    for (int c = 0; c < cells_u; ++c)
+    {
+        if (c % validationStride == 0 || c == cells_u - 1)
+        {
+            checkedCells_u.push_back(c);
+        }
+    }
+    for (int c = 0; c < cells_v; ++c)
+    {
+        if (c % validationStride == 0 || c == cells_v - 1)
+        {
+            checkedCells_v.push_back(c);
+        }
     }
+
+    // weights of the edges (t = 0) and the centres (t = 0.5) of a cell
+    float edgeWeights[4], centreWeights[4];
+    interpolationWeights(0.0f, interpolation, edgeWeights);
+    interpolationWeights(0.5f, interpolation, centreWeights);
+
+    double maxError = 0.0;
+    std::mutex maxErrorMutex;
+
+    auto validateRows = [&](int rowBegin, int rowEnd)
+    {
+        // centre, top edge midpoint and left edge midpoint of each cell
+        const int count = 3 * static_cast<int>(checkedCells_u.size());
+        std::vector<float> X(count), Y(count), Z(count), U(count), V(count);
+        std::vector<float> iu(count), iv(count), pu(count), pv(count);
+
+        double threadMaxError = 0.0;
+
+        for (int k = rowBegin; k < rowEnd; ++k)
+        {
+            int cell_v = checkedCells_v[k];
+
+            for (int l = 0; l < static_cast<int>(checkedCells_u.size()); ++l)
+            {
+                int cell_u = checkedCells_u[l];
+
+                for (int m = 0; m < 3; ++m)
+                {
+                    int i = 3 * l + m;
+
+                    const float* wu = (m == 2) ? edgeWeights : centreWeights;
+                    const float* wv = (m == 1) ? edgeWeights : centreWeights;
+
+                    pu[i] = cell_u * gridStep + ((m == 2) ? 0.0f : halfStep);
+                    pv[i] = cell_v * gridStep + ((m == 1) ? 0.0f : halfStep);
+
+                    Eigen::Vector3f P = A * Eigen::Vector3f(pu[i], pv[i], 1.0f);
+                    X[i] = P(0);
+                    Y[i] = P(1);
+                    Z[i] = P(2);
+
+                    float sumU = 0.0f, sumV = 0.0f;
+                    for (int a = 0; a < 4; ++a)
+                    {
+                        const float* gU = &gridU[(cell_v + a) * cols + cell_u];
+                        const float* gV = &gridV[(cell_v + a) * cols + cell_u];
+                        for (int b = 0; b < 4; ++b)
+                        {
+                            sumU += wv[a] * wu[b] * gU[b];
+                            sumV += wv[a] * wu[b] * gV[b];
+                        }
+                    }
+                    iu[i] = sumU;
+                    iv[i] = sumV;
+                }
+            }
+
+            spaceToPlane(&X[0], &Y[0], &Z[0], &U[0], &V[0], count);
+
+            for (int i = 0; i < count; ++i)
+            {
+                // only pixels of the map that sample the source image matter
+                if (pu[i] > imageSize.width - 1 || pv[i] > imageSize.height - 1 ||
+                    !(U[i] >= 0.0f && U[i] <= imageWidth() - 1 &&
+                      V[i] >= 0.0f && V[i] <= imageHeight() - 1))
+                {
+                    continue;
+                }
+
+                double du = iu[i] - U[i];
+                double dv = iv[i] - V[i];
+                threadMaxError = std::max(threadMaxError, std::sqrt(du * du + dv * dv));
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(maxErrorMutex);
+        maxError = std::max(maxError, threadMaxError);
+    };
+
+    parallelFor(0, static_cast<int>(checkedCells_v.size()), m_numThreads, validateRows);
+
+    return maxError;
 }
 
 }
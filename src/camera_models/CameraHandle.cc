@@ -0,0 +1,257 @@
+#include "camera_model/camera_models/CameraHandle.h"
+
+#include "camera_model/camera_models/CataCamera.h"
+#include "camera_model/camera_models/EquidistantCamera.h"
+#include "camera_model/camera_models/PinholeCamera.h"
+
+namespace camera_model
+{
+
+namespace
+{
+
+template <typename T>
+class SpaceToPlaneVisitor: public boost::static_visitor<>
+{
+public:
+    SpaceToPlaneVisitor(const T* P, T* p, size_t count)
+     : m_P(P), m_p(p), m_count(count)
+    {
+
+    }
+
+    template <typename Model>
+    void operator()(const Model& model) const
+    {
+        // copy the parameters so that the compiler can keep them in
+        // registers across the loop
+        const Model m = model;
+
+        for (size_t i = 0; i < m_count; ++i)
+        {
+            m.spaceToPlane(m_P + 3 * i, m_p + 2 * i);
+        }
+    }
+
+private:
+    const T* m_P;
+    T* m_p;
+    size_t m_count;
+};
+
+class LiftProjectiveVisitor: public boost::static_visitor<>
+{
+public:
+    LiftProjectiveVisitor(const double* p, double* P, size_t count, bool normalise)
+     : m_p(p), m_P(P), m_count(count), m_normalise(normalise)
+    {
+
+    }
+
+    template <typename Model>
+    void operator()(const Model& model) const
+    {
+        const Model m = model;
+
+        for (size_t i = 0; i < m_count; ++i)
+        {
+            double* P = m_P + 3 * i;
+            m.liftProjective(m_p + 2 * i, P);
+
+            if (m_normalise)
+            {
+                double inv_norm = 1.0 / std::sqrt(P[0] * P[0] + P[1] * P[1] + P[2] * P[2]);
+                P[0] *= inv_norm;
+                P[1] *= inv_norm;
+                P[2] *= inv_norm;
+            }
+        }
+    }
+
+private:
+    const double* m_p;
+    double* m_P;
+    size_t m_count;
+    bool m_normalise;
+};
+
+PinholeModel
+makeModel(const PinholeCamera::Parameters& params)
+{
+    PinholeModel model;
+    model.k1 = params.k1();
+    model.k2 = params.k2();
+    model.p1 = params.p1();
+    model.p2 = params.p2();
+    model.fx = params.fx();
+    model.fy = params.fy();
+    model.cx = params.cx();
+    model.cy = params.cy();
+
+    return model;
+}
+
+CataModel
+makeModel(const CataCamera::Parameters& params)
+{
+    CataModel model;
+    model.xi = params.xi();
+    model.k1 = params.k1();
+    model.k2 = params.k2();
+    model.p1 = params.p1();
+    model.p2 = params.p2();
+    model.gamma1 = params.gamma1();
+    model.gamma2 = params.gamma2();
+    model.u0 = params.u0();
+    model.v0 = params.v0();
+
+    return model;
+}
+
+EquidistantModel
+makeModel(const EquidistantCamera::Parameters& params)
+{
+    EquidistantModel model;
+    model.k2 = params.k2();
+    model.k3 = params.k3();
+    model.k4 = params.k4();
+    model.k5 = params.k5();
+    model.mu = params.mu();
+    model.mv = params.mv();
+    model.u0 = params.u0();
+    model.v0 = params.v0();
+
+    return model;
+}
+
+OCAMModel
+makeModel(const OCAMCamera::Parameters& params)
+{
+    OCAMModel model;
+    model.C = params.C();
+    model.D = params.D();
+    model.E = params.E();
+    model.center_x = params.center_x();
+    model.center_y = params.center_y();
+
+    model.poly_terms = 0;
+    for (int i = 0; i < SCARAMUZZA_POLY_SIZE; ++i)
+    {
+        model.poly[i] = params.poly(i);
+        if (model.poly[i] != 0.0)
+        {
+            model.poly_terms = i + 1;
+        }
+    }
+
+    model.inv_poly_terms = 0;
+    for (int i = 0; i < SCARAMUZZA_INV_POLY_SIZE; ++i)
+    {
+        model.inv_poly[i] = params.inv_poly(i);
+        if (model.inv_poly[i] != 0.0)
+        {
+            model.inv_poly_terms = i + 1;
+        }
+    }
+
+    model.inv_scale = 1.0 / (params.C() - params.D() * params.E());
+
+    return model;
+}
+
+}
+
+CameraHandle::CameraHandle()
+{
+    PinholeModel model;
+    model.k1 = model.k2 = model.p1 = model.p2 = 0.0;
+    model.fx = model.fy = 1.0;
+    model.cx = model.cy = 0.0;
+
+    m_model = model;
+}
+
+CameraHandle::CameraHandle(const Camera& camera)
+{
+    switch (camera.modelType())
+    {
+    case Camera::PINHOLE:
+        m_model = makeModel(static_cast<const PinholeCamera&>(camera).getParameters());
+        break;
+    case Camera::MEI:
+        m_model = makeModel(static_cast<const CataCamera&>(camera).getParameters());
+        break;
+    case Camera::KANNALA_BRANDT:
+        m_model = makeModel(static_cast<const EquidistantCamera&>(camera).getParameters());
+        break;
+    case Camera::SCARAMUZZA:
+        m_model = makeModel(static_cast<const OCAMCamera&>(camera).getParameters());
+        break;
+    }
+}
+
+Camera::ModelType
+CameraHandle::modelType(void) const
+{
+    switch (m_model.which())
+    {
+    case 1:
+        return Camera::MEI;
+    case 2:
+        return Camera::KANNALA_BRANDT;
+    case 3:
+        return Camera::SCARAMUZZA;
+    default:
+        return Camera::PINHOLE;
+    }
+}
+
+const CameraHandle::Model&
+CameraHandle::model(void) const
+{
+    return m_model;
+}
+
+void
+CameraHandle::spaceToPlane(const Eigen::Vector3d& P, Eigen::Vector2d& p) const
+{
+    spaceToPlane(P.data(), p.data(), 1);
+}
+
+void
+CameraHandle::liftProjective(const Eigen::Vector2d& p, Eigen::Vector3d& P) const
+{
+    liftProjective(p.data(), P.data(), 1);
+}
+
+void
+CameraHandle::liftSphere(const Eigen::Vector2d& p, Eigen::Vector3d& P) const
+{
+    liftSphere(p.data(), P.data(), 1);
+}
+
+void
+CameraHandle::spaceToPlane(const double* P, double* p, size_t count) const
+{
+    boost::apply_visitor(SpaceToPlaneVisitor<double>(P, p, count), m_model);
+}
+
+void
+CameraHandle::spaceToPlane(const float* P, float* p, size_t count) const
+{
+    boost::apply_visitor(SpaceToPlaneVisitor<float>(P, p, count), m_model);
+}
+
+void
+CameraHandle::liftProjective(const double* p, double* P, size_t count) const
+{
+    boost::apply_visitor(LiftProjectiveVisitor(p, P, count, false), m_model);
+}
+
+void
+CameraHandle::liftSphere(const double* p, double* P, size_t count) const
+{
+    boost::apply_visitor(LiftProjectiveVisitor(p, P, count, true), m_model);
+}
+
+}
@@ -5,6 +5,7 @@
 #include <eigen3/Eigen/Dense>
 #include <iomanip>
 #include <iostream>
+#include <limits>
 #include <opencv2/calib3d/calib3d.hpp>
 #include <opencv2/core/eigen.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
@@ -293,6 +294,9 @@ CataCamera::CataCamera()
  , m_inv_K22(1.0)
  , m_inv_K23(0.0)
  , m_noDistortion(true)
+ , m_undistortMethod(UNDISTORT_FIXED_POINT)
+ , m_undistortMaxIterations(8)
+ , m_undistortTolerance(0.0)
 {
 
 }
@@ -303,6 +307,9 @@ CataCamera::CataCamera(const std::string& cameraName,
                        double gamma1, double gamma2, double u0, double v0)
  : mParameters(cameraName, imageWidth, imageHeight,
                xi, k1, k2, p1, p2, gamma1, gamma2, u0, v0)
+ , m_undistortMethod(UNDISTORT_FIXED_POINT)
+ , m_undistortMaxIterations(8)
+ , m_undistortTolerance(0.0)
 {
     if ((mParameters.k1() == 0.0) &&
         (mParameters.k2() == 0.0) &&
@@ -325,6 +332,9 @@ CataCamera::CataCamera(const std::string& cameraName,
 
 CataCamera::CataCamera(const CataCamera::Parameters& params)
  : mParameters(params)
+ , m_undistortMethod(UNDISTORT_FIXED_POINT)
+ , m_undistortMaxIterations(8)
+ , m_undistortTolerance(0.0)
 {
     if ((mParameters.k1() == 0.0) &&
         (mParameters.k2() == 0.0) &&
@@ -475,61 +485,20 @@ CataCamera::estimateIntrinsics(const cv::Size& boardSize,
 void
 CataCamera::liftSphere(const Eigen::Vector2d& p, Eigen::Vector3d& P) const
 {
-    double mx_d, my_d,mx2_d, mxy_d, my2_d, mx_u, my_u;
-    double rho2_d, rho4_d, radDist_d, Dx_d, Dy_d, inv_denom_d;
+    double mx_d, my_d, mx_u, my_u;
     double lambda;
 
     // Lift points to normalised plane
     mx_d = m_inv_K11 * p(0) + m_inv_K13;
     my_d = m_inv_K22 * p(1) + m_inv_K23;
 
-    if (m_noDistortion)
-    {
-        mx_u = mx_d;
-        my_u = my_d;
-    }
-    else
+    mx_u = mx_d;
+    my_u = my_d;
+
+    if (!m_noDistortion)
     {
         // Apply inverse distortion model
-        if (0)
-        {
-            double k1 = mParameters.k1();
-            double k2 = mParameters.k2();
-            double p1 = mParameters.p1();
-            double p2 = mParameters.p2();
-
-            // Inverse distortion model
-            // proposed by Heikkila
-            mx2_d = mx_d*mx_d;
-            my2_d = my_d*my_d;
-            mxy_d = mx_d*my_d;
-            rho2_d = mx2_d+my2_d;
-            rho4_d = rho2_d*rho2_d;
-            radDist_d = k1*rho2_d+k2*rho4_d;
-            Dx_d = mx_d*radDist_d + p2*(rho2_d+2*mx2_d) + 2*p1*mxy_d;
-            Dy_d = my_d*radDist_d + p1*(rho2_d+2*my2_d) + 2*p2*mxy_d;
-            inv_denom_d = 1/(1+4*k1*rho2_d+6*k2*rho4_d+8*p1*my_d+8*p2*mx_d);
-
-            mx_u = mx_d - inv_denom_d*Dx_d;
-            my_u = my_d - inv_denom_d*Dy_d;
-        }
-        else
-        {
-            // Recursive distortion model
-            int n = 6;
-            Eigen::Vector2d d_u;
-            distortion(Eigen::Vector2d(mx_d, my_d), d_u);
-            // Approximate value
-            mx_u = mx_d - d_u(0);
-            my_u = my_d - d_u(1);
-
-            for (int i = 1; i < n; ++i)
-            {
-                distortion(Eigen::Vector2d(mx_u, my_u), d_u);
-                mx_u = mx_d - d_u(0);
-                my_u = my_d - d_u(1);
-            }
-        }
+        undistortPoint(mx_d, my_d, mx_u, my_u, false);
     }
 
     // Lift normalised points to the sphere (inv_hslash)
@@ -555,60 +524,19 @@ CataCamera::liftSphere(const Eigen::Vector2d& p, Eigen::Vector3d& P) const
 void
 CataCamera::liftProjective(const Eigen::Vector2d& p, Eigen::Vector3d& P) const
 {
-    double mx_d, my_d,mx2_d, mxy_d, my2_d, mx_u, my_u;
-    double rho2_d, rho4_d, radDist_d, Dx_d, Dy_d, inv_denom_d;
-    //double lambda;
+    double mx_d, my_d, mx_u, my_u, rho2_u;
 
     // Lift points to normalised plane
     mx_d = m_inv_K11 * p(0) + m_inv_K13;
     my_d = m_inv_K22 * p(1) + m_inv_K23;
 
-    if (m_noDistortion)
-    {
-        mx_u = mx_d;
-        my_u = my_d;
-    }
-    else
+    mx_u = mx_d;
+    my_u = my_d;
+
+    if (!m_noDistortion)
     {
-        if (0)
-        {
-            double k1 = mParameters.k1();
-            double k2 = mParameters.k2();
-            double p1 = mParameters.p1();
-            double p2 = mParameters.p2();
-
-            // Apply inverse distortion model
-            // proposed by Heikkila
-            mx2_d = mx_d*mx_d;
-            my2_d = my_d*my_d;
-            mxy_d = mx_d*my_d;
-            rho2_d = mx2_d+my2_d;
-            rho4_d = rho2_d*rho2_d;
-            radDist_d = k1*rho2_d+k2*rho4_d;
-            Dx_d = mx_d*radDist_d + p2*(rho2_d+2*mx2_d) + 2*p1*mxy_d;
-            Dy_d = my_d*radDist_d + p1*(rho2_d+2*my2_d) + 2*p2*mxy_d;
-            inv_denom_d = 1/(1+4*k1*rho2_d+6*k2*rho4_d+8*p1*my_d+8*p2*mx_d);
-
-            mx_u = mx_d - inv_denom_d*Dx_d;
-            my_u = my_d - inv_denom_d*Dy_d;
-        }
-        else
-        {
-            // Recursive distortion model
-            int n = 8;
-            Eigen::Vector2d d_u;
-            distortion(Eigen::Vector2d(mx_d, my_d), d_u);
-            // Approximate value
-            mx_u = mx_d - d_u(0);
-            my_u = my_d - d_u(1);
-
-            for (int i = 1; i < n; ++i)
-            {
-                distortion(Eigen::Vector2d(mx_u, my_u), d_u);
-                mx_u = mx_d - d_u(0);
-                my_u = my_d - d_u(1);
-            }
-        }
+        // Apply inverse distortion model
+        undistortPoint(mx_d, my_d, mx_u, my_u, false);
     }
 
     // Obtain a projective ray
@@ -619,9 +547,8 @@ CataCamera::liftProjective(const Eigen::Vector2d& p, Eigen::Vector3d& P) const
     }
     else
     {
-        // Reuse variable
-        rho2_d = mx_u * mx_u + my_u * my_u;
-        P << mx_u, my_u, 1.0 - xi * (rho2_d + 1.0) / (xi + sqrt(1.0 + (1.0 - xi * xi) * rho2_d));
+        rho2_u = mx_u * mx_u + my_u * my_u;
+        P << mx_u, my_u, 1.0 - xi * (rho2_u + 1.0) / (xi + sqrt(1.0 + (1.0 - xi * xi) * rho2_u));
     }
 }
 
@@ -658,75 +585,321 @@ CataCamera::spaceToPlane(const Eigen::Vector3d& P, Eigen::Vector2d& p) const
          mParameters.gamma2() * p_d(1) + mParameters.v0();
 }
 
-#if 0
-/** 
+/**
+ * \brief Projects a batch of 3D points to the image plane
+ *
+ * Same model as spaceToPlane(), evaluated in a single loop with the
+ * parameters held in locals.
+ */
+template <typename T>
+void
+CataCamera::spaceToPlaneBatchImpl(const T* x, const T* y, const T* z,
+                                  int inStride,
+                                  T* u, T* v, int outStride,
+                                  size_t count) const
+{
+    const T xi = mParameters.xi();
+    const T k1 = mParameters.k1();
+    const T k2 = mParameters.k2();
+    const T p1 = mParameters.p1();
+    const T p2 = mParameters.p2();
+    const T gamma1 = mParameters.gamma1();
+    const T gamma2 = mParameters.gamma2();
+    const T u0 = mParameters.u0();
+    const T v0 = mParameters.v0();
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        const size_t in = i * inStride;
+        const size_t out = i * outStride;
+
+        // Project points to the normalised plane
+        T norm = std::sqrt(x[in] * x[in] + y[in] * y[in] + z[in] * z[in]);
+        T zs = z[in] + xi * norm;
+        T mx_u = x[in] / zs;
+        T my_u = y[in] / zs;
+
+        T mx_d = mx_u;
+        T my_d = my_u;
+
+        if (!m_noDistortion)
+        {
+            // Apply distortion
+            T mx2_u = mx_u * mx_u;
+            T my2_u = my_u * my_u;
+            T mxy_u = mx_u * my_u;
+            T rho2_u = mx2_u + my2_u;
+            T rad_dist_u = k1 * rho2_u + k2 * rho2_u * rho2_u;
+
+            mx_d += mx_u * rad_dist_u + T(2.0) * p1 * mxy_u + p2 * (rho2_u + T(2.0) * mx2_u);
+            my_d += my_u * rad_dist_u + T(2.0) * p2 * mxy_u + p1 * (rho2_u + T(2.0) * my2_u);
+        }
+
+        // Apply generalised projection matrix
+        u[out] = gamma1 * mx_d + u0;
+        v[out] = gamma2 * my_d + v0;
+    }
+}
+
+/**
+ * \brief Lifts a batch of image points to the normalised plane and removes
+ *        distortion
+ *
+ * The distortion is inverted in double precision for both scalar types.
+ */
+template <typename T>
+void
+CataCamera::undistortNormalisedBatch(const T* u, const T* v, int inStride,
+                                     T* mx, T* my, int outStride,
+                                     size_t count) const
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        const size_t in = i * inStride;
+        const size_t out = i * outStride;
+
+        // Lift points to normalised plane
+        double mx_d = m_inv_K11 * u[in] + m_inv_K13;
+        double my_d = m_inv_K22 * v[in] + m_inv_K23;
+
+        double mx_u = mx_d;
+        double my_u = my_d;
+
+        if (!m_noDistortion)
+        {
+            undistortPoint(mx_d, my_d, mx_u, my_u, false);
+        }
+
+        mx[out] = mx_u;
+        my[out] = my_u;
+    }
+}
+
+/**
+ * \brief Lifts a batch of image points to their projective rays
+ */
+template <typename T>
+void
+CataCamera::liftProjectiveBatchImpl(const T* u, const T* v, int inStride,
+                                    T* x, T* y, T* z,
+                                    int outStride, size_t count) const
+{
+    undistortNormalisedBatch(u, v, inStride, x, y, outStride, count);
+
+    // Obtain a projective ray
+    const T xi = mParameters.xi();
+    for (size_t i = 0; i < count; ++i)
+    {
+        const size_t out = i * outStride;
+
+        T mx_u = x[out];
+        T my_u = y[out];
+        T rho2_u = mx_u * mx_u + my_u * my_u;
+
+        if (xi == T(1.0))
+        {
+            z[out] = (T(1.0) - rho2_u) / T(2.0);
+        }
+        else
+        {
+            z[out] = T(1.0) - xi * (rho2_u + T(1.0)) / (xi + std::sqrt(T(1.0) + (T(1.0) - xi * xi) * rho2_u));
+        }
+    }
+}
+
+/**
+ * \brief Lifts a batch of image points to the unit sphere
+ */
+template <typename T>
+void
+CataCamera::liftSphereBatchImpl(const T* u, const T* v, int inStride,
+                                T* x, T* y, T* z,
+                                int outStride, size_t count) const
+{
+    undistortNormalisedBatch(u, v, inStride, x, y, outStride, count);
+
+    // Lift normalised points to the sphere (inv_hslash)
+    const T xi = mParameters.xi();
+    for (size_t i = 0; i < count; ++i)
+    {
+        const size_t out = i * outStride;
+
+        T mx_u = x[out];
+        T my_u = y[out];
+        T rho2_u = mx_u * mx_u + my_u * my_u;
+
+        T lambda;
+        if (xi == T(1.0))
+        {
+            lambda = T(2.0) / (rho2_u + T(1.0));
+        }
+        else
+        {
+            lambda = (xi + std::sqrt(T(1.0) + (T(1.0) - xi * xi) * rho2_u)) / (T(1.0) + rho2_u);
+        }
+
+        x[out] = lambda * mx_u;
+        y[out] = lambda * my_u;
+        z[out] = lambda - xi;
+    }
+}
+
+void
+CataCamera::spaceToPlaneBatch(const double* x, const double* y, const double* z,
+                              int inStride,
+                              double* u, double* v, int outStride,
+                              size_t count) const
+{
+    spaceToPlaneBatchImpl(x, y, z, inStride, u, v, outStride, count);
+}
+
+void
+CataCamera::liftProjectiveBatch(const double* u, const double* v, int inStride,
+                                double* x, double* y, double* z,
+                                int outStride, size_t count) const
+{
+    liftProjectiveBatchImpl(u, v, inStride, x, y, z, outStride, count);
+}
+
+void
+CataCamera::liftSphereBatch(const double* u, const double* v, int inStride,
+                            double* x, double* y, double* z,
+                            int outStride, size_t count) const
+{
+    liftSphereBatchImpl(u, v, inStride, x, y, z, outStride, count);
+}
+
+void
+CataCamera::spaceToPlaneBatch(const float* x, const float* y, const float* z,
+                              int inStride,
+                              float* u, float* v, int outStride,
+                              size_t count) const
+{
+    spaceToPlaneBatchImpl(x, y, z, inStride, u, v, outStride, count);
+}
+
+void
+CataCamera::liftProjectiveBatch(const float* u, const float* v, int inStride,
+                                float* x, float* y, float* z,
+                                int outStride, size_t count) const
+{
+    liftProjectiveBatchImpl(u, v, inStride, x, y, z, outStride, count);
+}
+
+void
+CataCamera::liftSphereBatch(const float* u, const float* v, int inStride,
+                            float* x, float* y, float* z,
+                            int outStride, size_t count) const
+{
+    liftSphereBatchImpl(u, v, inStride, x, y, z, outStride, count);
+}
+
+/**
  * \brief Project a 3D point to the image plane and calculate Jacobian
  *
  * \param P 3D point coordinates
  * \param p return value, contains the image point coordinates
+ * \param J return value, jacobian of p w.r.t. P
  */
 void
 CataCamera::spaceToPlane(const Eigen::Vector3d& P, Eigen::Vector2d& p,
-                        Eigen::Matrix<double,2,3>& J) const
+                         Eigen::Matrix<double,2,3>& J) const
 {
     double xi = mParameters.xi();
+    double norm = P.norm();
 
-    Eigen::Vector2d p_u, p_d;
-    double norm, inv_denom;
-    double dxdmx, dydmx, dxdmy, dydmy;
-
-    norm = P.norm();
     // Project points to the normalised plane
-    inv_denom = 1.0 / (P(2) + xi * norm);
-    p_u << inv_denom * P(0), inv_denom * P(1);
-
-    // Calculate jacobian
-    inv_denom = inv_denom * inv_denom / norm;
-    double dudx = inv_denom * (norm * P(2) + xi * (P(1) * P(1) + P(2) * P(2)));
-    double dvdx = -inv_denom * xi * P(0) * P(1);
-    double dudy = dvdx;
-    double dvdy = inv_denom * (norm * P(2) + xi * (P(0) * P(0) + P(2) * P(2)));
-    inv_denom = inv_denom * (-xi * P(2) - norm); // reuse variable
-    double dudz = P(0) * inv_denom;
-    double dvdz = P(1) * inv_denom;
+    double inv_denom = 1.0 / (P(2) + xi * norm);
+    Eigen::Vector2d p_u(inv_denom * P(0), inv_denom * P(1));
+
+    // Jacobian of the normalised point w.r.t. P, with
+    // d(denom)/dP = e_z + xi * P / |P|
+    Eigen::RowVector3d ddenom = (xi / norm) * P.transpose();
+    ddenom(2) += 1.0;
 
+    Eigen::Matrix<double,2,3> J_u;
+    J_u.row(0) = -p_u(0) * inv_denom * ddenom;
+    J_u.row(1) = -p_u(1) * inv_denom * ddenom;
+    J_u(0,0) += inv_denom;
+    J_u(1,1) += inv_denom;
+
+    Eigen::Vector2d p_d;
     if (m_noDistortion)
     {
         p_d = p_u;
     }
     else
     {
-        // Apply distortion
+        // Apply distortion, J_d is the jacobian of p_d w.r.t. p_u
         Eigen::Vector2d d_u;
-        distortion(p_u, d_u);
+        Eigen::Matrix2d J_d;
+        distortion(p_u, d_u, J_d);
         p_d = p_u + d_u;
+        J_u = J_d * J_u;
     }
 
     double gamma1 = mParameters.gamma1();
     double gamma2 = mParameters.gamma2();
 
-    // Make the product of the jacobians
-    // and add projection matrix jacobian
-    inv_denom = gamma1 * (dudx * dxdmx + dvdx * dxdmy); // reuse
-    dvdx = gamma2 * (dudx * dydmx + dvdx * dydmy);
-    dudx = inv_denom;
-
-    inv_denom = gamma1 * (dudy * dxdmx + dvdy * dxdmy); // reuse
-    dvdy = gamma2 * (dudy * dydmx + dvdy * dydmy);
-    dudy = inv_denom;
-
-    inv_denom = gamma1 * (dudz * dxdmx + dvdz * dxdmy); // reuse
-    dvdz = gamma2 * (dudz * dydmx + dvdz * dydmy);
-    dudz = inv_denom;
-    
     // Apply generalised projection matrix
     p << gamma1 * p_d(0) + mParameters.u0(),
          gamma2 * p_d(1) + mParameters.v0();
 
-    J << dudx, dudy, dudz,
-         dvdx, dvdy, dvdz;
+    J << gamma1 * J_u.row(0),
+         gamma2 * J_u.row(1);
+}
+
+/**
+ * \brief Project a 3D point to the image plane and calculate Jacobians
+ *
+ * \param P 3D point coordinates
+ * \param p return value, contains the image point coordinates
+ * \param J return value, jacobian of p w.r.t. P
+ * \param J_params return value, jacobian of p w.r.t.
+ *        xi, k1, k2, p1, p2, gamma1, gamma2, u0, v0
+ */
+void
+CataCamera::spaceToPlane(const Eigen::Vector3d& P, Eigen::Vector2d& p,
+                         Eigen::Matrix<double,2,3>& J,
+                         Eigen::Matrix<double,2,Eigen::Dynamic>& J_params) const
+{
+    spaceToPlane(P, p, J);
+
+    double gamma1 = mParameters.gamma1();
+    double gamma2 = mParameters.gamma2();
+
+    double norm = P.norm();
+    double inv_denom = 1.0 / (P(2) + mParameters.xi() * norm);
+    Eigen::Vector2d p_u(inv_denom * P(0), inv_denom * P(1));
+
+    double mx2_u = p_u(0) * p_u(0);
+    double my2_u = p_u(1) * p_u(1);
+    double mxy_u = p_u(0) * p_u(1);
+    double rho2_u = mx2_u + my2_u;
+
+    // xi only enters through the normalised point
+    Eigen::Vector2d dp_d_dxi = -norm * inv_denom * p_u;
+    if (!m_noDistortion)
+    {
+        Eigen::Vector2d d_u;
+        Eigen::Matrix2d J_d;
+        distortion(p_u, d_u, J_d);
+        dp_d_dxi = J_d * dp_d_dxi;
+    }
+
+    double mx_d = (p(0) - mParameters.u0()) / gamma1;
+    double my_d = (p(1) - mParameters.v0()) / gamma2;
+
+    J_params.resize(2, 9);
+    J_params << gamma1 * dp_d_dxi(0),
+                gamma1 * p_u(0) * rho2_u, gamma1 * p_u(0) * rho2_u * rho2_u,
+                gamma1 * 2.0 * mxy_u, gamma1 * (rho2_u + 2.0 * mx2_u),
+                mx_d, 0.0, 1.0, 0.0,
+                gamma2 * dp_d_dxi(1),
+                gamma2 * p_u(1) * rho2_u, gamma2 * p_u(1) * rho2_u * rho2_u,
+                gamma2 * (rho2_u + 2.0 * my2_u), gamma2 * 2.0 * mxy_u,
+                0.0, my_d, 0.0, 1.0;
 }
-#endif
 
 /** 
  * \brief Projects an undistorted 2D point p_u to the image plane
@@ -817,35 +990,201 @@ CataCamera::distortion(const Eigen::Vector2d& p_u, Eigen::Vector2d& d_u,
 }
 
 void
-CataCamera::initUndistortMap(cv::Mat& map1, cv::Mat& map2, double fScale) const
+CataCamera::setUndistortionMethod(UndistortionMethod method,
+                                  int maxIterations,
+                                  double tolerance)
 {
-    cv::Size imageSize(mParameters.imageWidth(), mParameters.imageHeight());
+    m_undistortMethod = method;
+    m_undistortMaxIterations = maxIterations;
+    m_undistortTolerance = tolerance;
+}
 
-    cv::Mat mapX = cv::Mat::zeros(imageSize, CV_32F);
-    cv::Mat mapY = cv::Mat::zeros(imageSize, CV_32F);
+Camera::UndistortionMethod
+CataCamera::undistortionMethod(void) const
+{
+    return m_undistortMethod;
+}
 
-    for (int v = 0; v < imageSize.height; ++v)
+double
+CataCamera::undistort(const Eigen::Vector2d& p_d, Eigen::Vector2d& p_u) const
+{
+    double mx_u = p_d(0);
+    double my_u = p_d(1);
+    double residual = 0.0;
+
+    if (!m_noDistortion)
     {
-        for (int u = 0; u < imageSize.width; ++u)
+        residual = undistortPoint(p_d(0), p_d(1), mx_u, my_u, true);
+    }
+
+    p_u << mx_u, my_u;
+
+    return residual;
+}
+
+void
+CataCamera::undistort(const double* p_d, double* p_u, size_t count,
+                      double* residuals) const
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        double mx_u = p_d[2 * i];
+        double my_u = p_d[2 * i + 1];
+        double residual = 0.0;
+
+        if (!m_noDistortion)
         {
-            double mx_u = m_inv_K11 / fScale * u + m_inv_K13 / fScale;
-            double my_u = m_inv_K22 / fScale * v + m_inv_K23 / fScale;
+            residual = undistortPoint(p_d[2 * i], p_d[2 * i + 1], mx_u, my_u,
+                                      residuals != 0);
+        }
 
-            double xi = mParameters.xi();
-            double d2 = mx_u * mx_u + my_u * my_u;
+        p_u[2 * i] = mx_u;
+        p_u[2 * i + 1] = my_u;
+
+        if (residuals)
+        {
+            residuals[i] = residual;
+        }
+    }
+}
+
+/**
+ * \brief Solves p_u + d_u(p_u) = p_d for a point on the normalised plane
+ *
+ * \param mx_d, my_d distorted coordinates
+ * \param mx_u, my_u return value, undistorted coordinates
+ * \param computeResidual whether the fixed-point model should evaluate the
+ *        final residual (Newton always has it at hand)
+ * \return norm of the residual, or 0 if it was not computed
+ */
+double
+CataCamera::undistortPoint(double mx_d, double my_d,
+                           double& mx_u, double& my_u,
+                           bool computeResidual) const
+{
+    const double k1 = mParameters.k1();
+    const double k2 = mParameters.k2();
+    const double p1 = mParameters.p1();
+    const double p2 = mParameters.p2();
+    const double tol2 = m_undistortTolerance * m_undistortTolerance;
+
+    mx_u = mx_d;
+    my_u = my_d;
+
+    if (m_undistortMethod == UNDISTORT_FIXED_POINT)
+    {
+        // Recursive distortion model
+        for (int i = 0; i < m_undistortMaxIterations; ++i)
+        {
+            double mx2_u = mx_u * mx_u;
+            double my2_u = my_u * my_u;
+            double mxy_u = mx_u * my_u;
+            double rho2_u = mx2_u + my2_u;
+            double rad_dist_u = k1 * rho2_u + k2 * rho2_u * rho2_u;
+            double mx_n = mx_d - (mx_u * rad_dist_u + 2.0 * p1 * mxy_u + p2 * (rho2_u + 2.0 * mx2_u));
+            double my_n = my_d - (my_u * rad_dist_u + 2.0 * p2 * mxy_u + p1 * (rho2_u + 2.0 * my2_u));
+
+            double step2 = (mx_n - mx_u) * (mx_n - mx_u) + (my_n - my_u) * (my_n - my_u);
+
+            mx_u = mx_n;
+            my_u = my_n;
+
+            if (step2 <= tol2)
+            {
+                break;
+            }
+        }
+
+        if (!computeResidual)
+        {
+            return 0.0;
+        }
 
-            Eigen::Vector3d P;
-            P << mx_u, my_u, 1.0 - xi * (d2 + 1.0) / (xi + sqrt(1.0 + (1.0 - xi * xi) * d2));
+        Eigen::Vector2d d_u;
+        distortion(Eigen::Vector2d(mx_u, my_u), d_u);
+
+        return Eigen::Vector2d(mx_u + d_u(0) - mx_d, my_u + d_u(1) - my_d).norm();
+    }
+
+    // Newton's method with step halving whenever the residual grows
+    double res2_prev = std::numeric_limits<double>::max();
+    double step_x = 0.0, step_y = 0.0;
+    double res2 = 0.0;
+
+    for (int i = 0; ; ++i)
+    {
+        double mx2_u = mx_u * mx_u;
+        double my2_u = my_u * my_u;
+        double mxy_u = mx_u * my_u;
+        double rho2_u = mx2_u + my2_u;
+        double rad_dist_u = k1 * rho2_u + k2 * rho2_u * rho2_u;
+        double f_x = mx_u + mx_u * rad_dist_u + 2.0 * p1 * mxy_u + p2 * (rho2_u + 2.0 * mx2_u) - mx_d;
+        double f_y = my_u + my_u * rad_dist_u + 2.0 * p2 * mxy_u + p1 * (rho2_u + 2.0 * my2_u) - my_d;
+
+        res2 = f_x * f_x + f_y * f_y;
 
-            Eigen::Vector2d p;
-            spaceToPlane(P, p);
+        if (res2 <= tol2 || i >= m_undistortMaxIterations)
+        {
+            break;
+        }
 
-            mapX.at<float>(v,u) = p(0);
-            mapY.at<float>(v,u) = p(1);
+        if (res2 > res2_prev)
+        {
+            // Overshot: retreat halfway along the previous step
+            step_x *= 0.5;
+            step_y *= 0.5;
+            mx_u += step_x;
+            my_u += step_y;
+            continue;
+        }
+
+        // Jacobian of p_u + d_u(p_u), see distortion()
+        double dxdmx = 1.0 + rad_dist_u + k1 * 2.0 * mx2_u + k2 * rho2_u * 4.0 * mx2_u + 2.0 * p1 * my_u + 6.0 * p2 * mx_u;
+        double dydmx = k1 * 2.0 * mxy_u + k2 * 4.0 * rho2_u * mxy_u + p1 * 2.0 * mx_u + 2.0 * p2 * my_u;
+        double dxdmy = dydmx;
+        double dydmy = 1.0 + rad_dist_u + k1 * 2.0 * my2_u + k2 * rho2_u * 4.0 * my2_u + 6.0 * p1 * my_u + 2.0 * p2 * mx_u;
+
+        double det = dxdmx * dydmy - dxdmy * dydmx;
+        if (fabs(det) < 1e-12)
+        {
+            break;
         }
+
+        step_x = (dydmy * f_x - dxdmy * f_y) / det;
+        step_y = (dxdmx * f_y - dydmx * f_x) / det;
+
+        mx_u -= step_x;
+        my_u -= step_y;
+        res2_prev = res2;
     }
 
-    cv::convertMaps(mapX, mapY, map1, map2, CV_32FC1, false);
+    return sqrt(res2);
+}
+
+void
+CataCamera::initUndistortMap(cv::Mat& map1, cv::Mat& map2, double fScale,
+                             int m1type) const
+{
+    cv::Size imageSize(mParameters.imageWidth(), mParameters.imageHeight());
+
+    double xi = mParameters.xi();
+
+    auto rays = [&](int v, float* X, float* Y, float* Z)
+    {
+        double my_u = m_inv_K22 / fScale * v + m_inv_K23 / fScale;
+
+        for (int u = 0; u < imageSize.width; ++u)
+        {
+            double mx_u = m_inv_K11 / fScale * u + m_inv_K13 / fScale;
+            double d2 = mx_u * mx_u + my_u * my_u;
+
+            X[u] = mx_u;
+            Y[u] = my_u;
+            Z[u] = 1.0 - xi * (d2 + 1.0) / (xi + sqrt(1.0 + (1.0 - xi * xi) * d2));
+        }
+    };
+
+    initRectifyMap(imageSize, rays, map1, map2, m1type);
 }
 
 cv::Mat
@@ -853,16 +1192,13 @@ CataCamera::initUndistortRectifyMap(cv::Mat& map1, cv::Mat& map2,
                                     float fx, float fy,
                                     cv::Size imageSize,
                                     float cx, float cy,
-                                    cv::Mat rmat) const
+                                    cv::Mat rmat, int m1type) const
 {
     if (imageSize == cv::Size(0, 0))
     {
         imageSize = cv::Size(mParameters.imageWidth(), mParameters.imageHeight());
     }
 
-    cv::Mat mapX = cv::Mat::zeros(imageSize.height, imageSize.width, CV_32F);
-    cv::Mat mapY = cv::Mat::zeros(imageSize.height, imageSize.width, CV_32F);
-
     Eigen::Matrix3f K_rect;
 
     if (cx == -1.0f && cy == -1.0f)
@@ -890,24 +1226,10 @@ CataCamera::initUndistortRectifyMap(cv::Mat& map1, cv::Mat& map2,
     cv::cv2eigen(rmat, R);
     R_inv = R.inverse();
 
-    for (int v = 0; v < imageSize.height; ++v)
-    {
-        for (int u = 0; u < imageSize.width; ++u)
-        {
-            Eigen::Vector3f xo;
-            xo << u, v, 1;
-
-            Eigen::Vector3f uo = R_inv * K_rect_inv * xo;
-
-            Eigen::Vector2d p;
-            spaceToPlane(uo.cast<double>(), p);
-
-            mapX.at<float>(v,u) = p(0);
-            mapY.at<float>(v,u) = p(1);
-        }
-    }
+    // ray of pixel (u, v) is A * (u, v, 1)
+    Eigen::Matrix3f A = R_inv * K_rect_inv;
 
-    cv::convertMaps(mapX, mapY, map1, map2, CV_32FC1, false);
+    initRectifyMap(imageSize, A, map1, map2, m1type);
 
     cv::Mat K_rect_cv;
     cv::eigen2cv(K_rect, K_rect_cv);
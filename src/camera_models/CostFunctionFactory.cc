@@ -1,10 +1,13 @@
 #include "camera_model/camera_models/CostFunctionFactory.h"
 
+#include <algorithm>
+
 #include "ceres/ceres.h"
 #include "camera_model/camera_models/CataCamera.h"
 #include "camera_model/camera_models/EquidistantCamera.h"
 #include "camera_model/camera_models/PinholeCamera.h"
 #include "camera_model/camera_models/ScaramuzzaCamera.h"
+#include "camera_model/gpl/EigenUtils.h"
 
 namespace camera_model
 {
@@ -417,6 +420,290 @@ private:
     Eigen::Vector2d m_observed_p_r;
 };
 
+/**
+ * \brief Jacobian of R(q) * P with respect to q = (x, y, z, w)
+ *
+ * As in ceres::QuaternionRotatePoint(), R(q) is the rotation of the
+ * normalised quaternion. It is computed as g(q) / |q|^2 with
+ * g(q) = (w^2 - v.v) P + 2 (v.P) v + 2 w (v x P), where v = (x, y, z).
+ */
+Eigen::Matrix<double, 3, 4>
+rotatePointJacobian(const double* const q, const Eigen::Vector3d& P)
+{
+    Eigen::Map<const Eigen::Vector4d> q_vec(q);
+    Eigen::Map<const Eigen::Vector3d> v(q);
+    double w = q[3];
+
+    double n = q_vec.squaredNorm();
+    double vP = v.dot(P);
+    Eigen::Vector3d vxP = v.cross(P);
+
+    Eigen::Vector3d g = (w * w - v.squaredNorm()) * P + 2.0 * vP * v + 2.0 * w * vxP;
+
+    Eigen::Matrix<double, 3, 4> J_g;
+    J_g.leftCols<3>() = 2.0 * (vP * Eigen::Matrix3d::Identity() + v * P.transpose()
+                               - P * v.transpose() - w * skew(P));
+    J_g.col(3) = 2.0 * (w * P + vxP);
+
+    return J_g / n - (2.0 / (n * n)) * g * q_vec.transpose();
+}
+
+/**
+ * \brief Instance of the model CameraT with the given intrinsics, owned by
+ *        the calling thread
+ *
+ * Lets cost functions use the analytic member functions of the models
+ * while residuals are evaluated concurrently. The intrinsics are only read
+ * when they have changed; models build their unprojection tables lazily,
+ * so reading them costs no more than copying the parameters.
+ */
+template<class CameraT, int N>
+const CameraT&
+threadLocalCamera(const double* const intrinsic_params)
+{
+    static thread_local CameraT camera;
+    static thread_local std::vector<double> params;
+
+    if (params.size() != N ||
+        !std::equal(intrinsic_params, intrinsic_params + N, params.begin()))
+    {
+        params.assign(intrinsic_params, intrinsic_params + N);
+        camera.readParameters(params);
+    }
+
+    return camera;
+}
+
+/**
+ * \brief Reprojection error over the intrinsics and the camera pose with
+ *        analytic derivatives
+ *
+ * Same residual as ReprojectionError1, but the Jacobians come from the
+ * analytic Camera::spaceToPlane() of the model instead of dual numbers
+ * as wide as all parameter blocks together.
+ */
+template<class CameraT, int N>
+class AnalyticReprojectionError1 : public ceres::SizedCostFunction<2, N, 4, 3>
+{
+public:
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+    AnalyticReprojectionError1(const Eigen::Vector3d& observed_P,
+                               const Eigen::Vector2d& observed_p,
+                               const Eigen::Matrix2d& sqrtPrecisionMat = Eigen::Matrix2d::Identity())
+        : m_observed_P(observed_P), m_observed_p(observed_p)
+        , m_sqrtPrecisionMat(sqrtPrecisionMat) {}
+
+    virtual bool Evaluate(double const* const* parameters,
+                          double* residuals,
+                          double** jacobians) const
+    {
+        static thread_local Eigen::Matrix<double, 2, Eigen::Dynamic> J_params;
+
+        const CameraT& camera = threadLocalCamera<CameraT, N>(parameters[0]);
+
+        const double* const q = parameters[1];
+        const double* const t = parameters[2];
+
+        // Convert quaternion from Eigen convention (x, y, z, w)
+        // to Ceres convention (w, x, y, z)
+        double q_ceres[4] = {q[3], q[0], q[1], q[2]};
+
+        Eigen::Vector3d P_c;
+        ceres::QuaternionRotatePoint(q_ceres, m_observed_P.data(), P_c.data());
+        P_c += Eigen::Vector3d(t[0], t[1], t[2]);
+
+        Eigen::Vector2d predicted_p;
+        Eigen::Matrix<double, 2, 3> J_P;
+        if (jacobians == 0)
+        {
+            camera.spaceToPlane(P_c, predicted_p);
+        }
+        else
+        {
+            camera.spaceToPlane(P_c, predicted_p, J_P, J_params);
+        }
+
+        Eigen::Map<Eigen::Vector2d> e_weighted(residuals);
+        e_weighted = m_sqrtPrecisionMat * (predicted_p - m_observed_p);
+
+        if (jacobians == 0)
+        {
+            return true;
+        }
+
+        if (jacobians[0] != 0)
+        {
+            Eigen::Map<Eigen::Matrix<double, 2, N, Eigen::RowMajor> > J_intrinsics(jacobians[0]);
+            J_intrinsics = m_sqrtPrecisionMat * J_params;
+        }
+
+        Eigen::Matrix<double, 2, 3> J_t = m_sqrtPrecisionMat * J_P;
+
+        if (jacobians[1] != 0)
+        {
+            Eigen::Map<Eigen::Matrix<double, 2, 4, Eigen::RowMajor> > J_q(jacobians[1]);
+            J_q = J_t * rotatePointJacobian(q, m_observed_P);
+        }
+
+        if (jacobians[2] != 0)
+        {
+            Eigen::Map<Eigen::Matrix<double, 2, 3, Eigen::RowMajor> > J_t_map(jacobians[2]);
+            J_t_map = J_t;
+        }
+
+        return true;
+    }
+
+private:
+    // observed 3D point
+    Eigen::Vector3d m_observed_P;
+
+    // observed 2D point
+    Eigen::Vector2d m_observed_p;
+
+    // square root of precision matrix
+    Eigen::Matrix2d m_sqrtPrecisionMat;
+};
+
+/**
+ * \brief Reprojection errors of all corners of one view over the
+ *        intrinsics and the camera pose
+ *
+ * One residual block per view instead of one per corner saves Ceres the
+ * bookkeeping of thousands of blocks, and the pose is converted to a
+ * rotation matrix once per evaluation. The Jacobians are analytic, as in
+ * AnalyticReprojectionError1.
+ *
+ * Ceres applies a loss function to a whole residual block, so the robust
+ * loss of the corners is applied here instead: the residual e of each
+ * corner is replaced by sqrt(rho(s) / s) * e with s = |e|^2, which keeps
+ * the cost 1/2 * sum rho(s) of one robust residual block per corner.
+ */
+template<class CameraT, int N>
+class ViewReprojectionError : public ceres::CostFunction
+{
+public:
+    ViewReprojectionError(const std::vector<cv::Point3f>& observed_P,
+                          const std::vector<cv::Point2f>& observed_p,
+                          const ceres::LossFunction* lossFunction)
+        : m_observed_P(observed_P), m_observed_p(observed_p)
+        , m_lossFunction(lossFunction)
+    {
+        set_num_residuals(2 * observed_p.size());
+        mutable_parameter_block_sizes()->push_back(N);
+        mutable_parameter_block_sizes()->push_back(4);
+        mutable_parameter_block_sizes()->push_back(3);
+    }
+
+    virtual bool Evaluate(double const* const* parameters,
+                          double* residuals,
+                          double** jacobians) const
+    {
+        static thread_local Eigen::Matrix<double, 2, Eigen::Dynamic> J_params;
+
+        const CameraT& camera = threadLocalCamera<CameraT, N>(parameters[0]);
+
+        const double* const q = parameters[1];
+        const double* const t = parameters[2];
+
+        Eigen::Matrix3d R = Eigen::Quaterniond(q[3], q[0], q[1], q[2]).normalized().toRotationMatrix();
+        Eigen::Vector3d t_vec(t[0], t[1], t[2]);
+
+        for (size_t i = 0; i < m_observed_p.size(); ++i)
+        {
+            const cv::Point3f& spt = m_observed_P.at(i);
+            const cv::Point2f& ipt = m_observed_p.at(i);
+
+            Eigen::Vector3d P(spt.x, spt.y, spt.z);
+            Eigen::Vector3d P_c = R * P + t_vec;
+
+            Eigen::Vector2d predicted_p;
+            Eigen::Matrix<double, 2, 3> J_P;
+            if (jacobians == 0)
+            {
+                camera.spaceToPlane(P_c, predicted_p);
+            }
+            else
+            {
+                camera.spaceToPlane(P_c, predicted_p, J_P, J_params);
+            }
+
+            Eigen::Vector2d e = predicted_p - Eigen::Vector2d(ipt.x, ipt.y);
+
+            // robust residual w * e and its derivative w.r.t. e
+            double w = 1.0;
+            Eigen::Matrix2d J_e = Eigen::Matrix2d::Identity();
+            if (m_lossFunction)
+            {
+                double s = e.squaredNorm();
+                double rho[3];
+                m_lossFunction->Evaluate(s, rho);
+
+                // For small s the exact expressions cancel badly. Since
+                // rho(0) = 0, rho(s) / s = rho'(s) - rho''(s) s / 2 + O(s^2)
+                // and its derivative is rho''(s) / 2 + O(s).
+                double dw_ds;
+                if (s < 1e-6)
+                {
+                    w = std::sqrt(rho[1] - 0.5 * rho[2] * s);
+                    dw_ds = rho[2] / (4.0 * w);
+                }
+                else
+                {
+                    w = std::sqrt(rho[0] / s);
+                    dw_ds = (rho[1] * s - rho[0]) / (2.0 * s * s * w);
+                }
+
+                J_e = w * Eigen::Matrix2d::Identity() + 2.0 * dw_ds * e * e.transpose();
+            }
+
+            residuals[2 * i] = w * e(0);
+            residuals[2 * i + 1] = w * e(1);
+
+            if (jacobians == 0)
+            {
+                continue;
+            }
+
+            if (jacobians[0] != 0)
+            {
+                Eigen::Map<Eigen::Matrix<double, Eigen::Dynamic, N, Eigen::RowMajor> >
+                    J_intrinsics(jacobians[0], num_residuals(), N);
+                J_intrinsics.template middleRows<2>(2 * i) = J_e * J_params;
+            }
+
+            Eigen::Matrix<double, 2, 3> J_t = J_e * J_P;
+
+            if (jacobians[1] != 0)
+            {
+                Eigen::Map<Eigen::Matrix<double, Eigen::Dynamic, 4, Eigen::RowMajor> >
+                    J_q(jacobians[1], num_residuals(), 4);
+                J_q.template middleRows<2>(2 * i) = J_t * rotatePointJacobian(q, P);
+            }
+
+            if (jacobians[2] != 0)
+            {
+                Eigen::Map<Eigen::Matrix<double, Eigen::Dynamic, 3, Eigen::RowMajor> >
+                    J_t_map(jacobians[2], num_residuals(), 3);
+                J_t_map.template middleRows<2>(2 * i) = J_t;
+            }
+        }
+
+        return true;
+    }
+
+private:
+    // observed 3D points
+    std::vector<cv::Point3f> m_observed_P;
+
+    // observed 2D points
+    std::vector<cv::Point2f> m_observed_p;
+
+    // not owned
+    const ceres::LossFunction* m_lossFunction;
+};
+
 boost::shared_ptr<CostFunctionFactory> CostFunctionFactory::m_instance;
 
 CostFunctionFactory::CostFunctionFactory()
@@ -444,11 +731,16 @@ CostFunctionFactory::generateCostFunction(const CameraConstPtr& camera,
     ceres::CostFunction* costFunction = 0;
 
     std::vector<double> intrinsic_params;
-    camera->writeParameters(intrinsic_params);
 
-    switch (flags)
+    switch (flags & ~ANALYTIC_DERIVATIVES)
     {
     case CAMERA_INTRINSICS | CAMERA_POSE:
+        if (flags & ANALYTIC_DERIVATIVES)
+        {
+            return generateCostFunction(camera, observed_P, observed_p,
+                                        Eigen::Matrix2d::Identity(), flags);
+        }
+
         switch (camera->modelType())
         {
         case Camera::KANNALA_BRANDT:
@@ -474,6 +766,7 @@ CostFunctionFactory::generateCostFunction(const CameraConstPtr& camera,
         }
         break;
     case CAMERA_ODOMETRY_TRANSFORM | ODOMETRY_6D_POSE:
+        camera->writeParameters(intrinsic_params);
         switch (camera->modelType())
         {
         case Camera::KANNALA_BRANDT:
@@ -512,12 +805,33 @@ CostFunctionFactory::generateCostFunction(const CameraConstPtr& camera,
 {
     ceres::CostFunction* costFunction = 0;
 
-    std::vector<double> intrinsic_params;
-    camera->writeParameters(intrinsic_params);
-
-    switch (flags)
+    switch (flags & ~ANALYTIC_DERIVATIVES)
     {
     case CAMERA_INTRINSICS | CAMERA_POSE:
+        if (flags & ANALYTIC_DERIVATIVES)
+        {
+            switch (camera->modelType())
+            {
+            case Camera::KANNALA_BRANDT:
+                costFunction =
+                    new AnalyticReprojectionError1<EquidistantCamera, 8>(observed_P, observed_p, sqrtPrecisionMat);
+                break;
+            case Camera::PINHOLE:
+                costFunction =
+                    new AnalyticReprojectionError1<PinholeCamera, 8>(observed_P, observed_p, sqrtPrecisionMat);
+                break;
+            case Camera::MEI:
+                costFunction =
+                    new AnalyticReprojectionError1<CataCamera, 9>(observed_P, observed_p, sqrtPrecisionMat);
+                break;
+            case Camera::SCARAMUZZA:
+                costFunction =
+                    new AnalyticReprojectionError1<OCAMCamera, SCARAMUZZA_CAMERA_NUM_PARAMS>(observed_P, observed_p, sqrtPrecisionMat);
+                break;
+            }
+            break;
+        }
+
         switch (camera->modelType())
         {
         case Camera::KANNALA_BRANDT:
@@ -554,12 +868,14 @@ CostFunctionFactory::generateCostFunction(const CameraConstPtr& camera,
 {
     ceres::CostFunction* costFunction = 0;
 
+    // only the cases with fixed intrinsics copy them into the residual
     std::vector<double> intrinsic_params;
-    camera->writeParameters(intrinsic_params);
 
-    switch (flags)
+    switch (flags & ~ANALYTIC_DERIVATIVES)
     {
     case CAMERA_POSE | POINT_3D:
+        camera->writeParameters(intrinsic_params);
+
         switch (camera->modelType())
         {
         case Camera::KANNALA_BRANDT:
@@ -585,6 +901,8 @@ CostFunctionFactory::generateCostFunction(const CameraConstPtr& camera,
         }
         break;
     case CAMERA_ODOMETRY_TRANSFORM | ODOMETRY_3D_POSE | POINT_3D:
+        camera->writeParameters(intrinsic_params);
+
         switch (camera->modelType())
         {
         case Camera::KANNALA_BRANDT:
@@ -646,6 +964,8 @@ CostFunctionFactory::generateCostFunction(const CameraConstPtr& camera,
         }
         break;
     case CAMERA_ODOMETRY_TRANSFORM | ODOMETRY_6D_POSE | POINT_3D:
+        camera->writeParameters(intrinsic_params);
+
         switch (camera->modelType())
         {
         case Camera::KANNALA_BRANDT:
@@ -842,11 +1162,11 @@ CostFunctionFactory::generateCostFunction(const CameraConstPtr& camera,
     ceres::CostFunction* costFunction = 0;
 
     std::vector<double> intrinsic_params;
-    camera->writeParameters(intrinsic_params);
 
-    switch (flags)
+    switch (flags & ~ANALYTIC_DERIVATIVES)
     {
     case CAMERA_ODOMETRY_TRANSFORM | ODOMETRY_6D_POSE | POINT_3D:
+        camera->writeParameters(intrinsic_params);
         switch (camera->modelType())
         {
         case Camera::KANNALA_BRANDT:
@@ -985,7 +1305,7 @@ CostFunctionFactory::generateCostFunction(const CameraConstPtr& camera,
     std::vector<double> intrinsic_params;
     camera->writeParameters(intrinsic_params);
 
-    switch (flags)
+    switch (flags & ~ANALYTIC_DERIVATIVES)
     {
     case CAMERA_ODOMETRY_TRANSFORM | POINT_3D:
         switch (camera->modelType())
@@ -1067,7 +1387,7 @@ CostFunctionFactory::generateCostFunction(const CameraConstPtr& camera,
     std::vector<double> intrinsic_params;
     camera->writeParameters(intrinsic_params);
 
-    switch (flags)
+    switch (flags & ~ANALYTIC_DERIVATIVES)
     {
     case POINT_3D:
         switch (camera->modelType())
@@ -1140,5 +1460,42 @@ CostFunctionFactory::generateCostFunction(const CameraConstPtr& cameraL,
     return costFunction;
 }
 
+ceres::CostFunction*
+CostFunctionFactory::generateCostFunction(const CameraConstPtr& camera,
+        const std::vector<cv::Point3f>& observed_P,
+        const std::vector<cv::Point2f>& observed_p,
+        const ceres::LossFunction* lossFunction,
+        int flags) const
+{
+    ceres::CostFunction* costFunction = 0;
+
+    switch (flags & ~ANALYTIC_DERIVATIVES)
+    {
+    case CAMERA_INTRINSICS | CAMERA_POSE:
+        switch (camera->modelType())
+        {
+        case Camera::KANNALA_BRANDT:
+            costFunction =
+                new ViewReprojectionError<EquidistantCamera, 8>(observed_P, observed_p, lossFunction);
+            break;
+        case Camera::PINHOLE:
+            costFunction =
+                new ViewReprojectionError<PinholeCamera, 8>(observed_P, observed_p, lossFunction);
+            break;
+        case Camera::MEI:
+            costFunction =
+                new ViewReprojectionError<CataCamera, 9>(observed_P, observed_p, lossFunction);
+            break;
+        case Camera::SCARAMUZZA:
+            costFunction =
+                new ViewReprojectionError<OCAMCamera, SCARAMUZZA_CAMERA_NUM_PARAMS>(observed_P, observed_p, lossFunction);
+            break;
+        }
+        break;
+    }
+
+    return costFunction;
+}
+
 }
 
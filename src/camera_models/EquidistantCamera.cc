@@ -1,5 +1,6 @@
 #include "camera_model/camera_models/EquidistantCamera.h"
 
+#include <algorithm>
 #include <cmath>
 #include <cstdio>
 #include <eigen3/Eigen/Dense>
@@ -471,14 +472,231 @@ void
 EquidistantCamera::spaceToPlane(const Eigen::Vector3d& P, Eigen::Vector2d& p,
                                 Eigen::Matrix<double,2,3>& J) const
 {
-    double theta = acos(P(2) / P.norm());
-    double phi = atan2(P(1), P(0));
+    double k2 = mParameters.k2();
+    double k3 = mParameters.k3();
+    double k4 = mParameters.k4();
+    double k5 = mParameters.k5();
 
-    Eigen::Vector2d p_u = r(mParameters.k2(), mParameters.k3(), mParameters.k4(), mParameters.k5(), theta) * Eigen::Vector2d(cos(phi), sin(phi));
+    double rho = hypot(P(0), P(1));
+    double theta = atan2(rho, P(2));
+
+    Eigen::Matrix<double,2,3> J_u;
+    Eigen::Vector2d p_u;
+    if (rho == 0.0)
+    {
+        // On the optical axis the model reduces to P.xy / z
+        p_u.setZero();
+        J_u << 1.0 / P(2), 0.0, 0.0,
+               0.0, 1.0 / P(2), 0.0;
+    }
+    else
+    {
+        double cos_phi = P(0) / rho;
+        double sin_phi = P(1) / rho;
+
+        double theta2 = theta * theta;
+        double r_theta = r(k2, k3, k4, k5, theta);
+        double dr_dtheta = 1.0 + theta2 * (3.0 * k2 + theta2 * (5.0 * k3 + theta2 * (7.0 * k4 + theta2 * 9.0 * k5)));
+
+        p_u << r_theta * cos_phi, r_theta * sin_phi;
+
+        // d(theta)/dP = (z * cos(phi), z * sin(phi), -rho) / |P|^2
+        double inv_norm2 = 1.0 / (rho * rho + P(2) * P(2));
+        Eigen::RowVector3d dtheta(P(2) * cos_phi * inv_norm2,
+                                  P(2) * sin_phi * inv_norm2,
+                                  -rho * inv_norm2);
+
+        J_u.row(0) = dr_dtheta * cos_phi * dtheta;
+        J_u.row(1) = dr_dtheta * sin_phi * dtheta;
+
+        // change of the direction (cos(phi), sin(phi)) in the image plane
+        double r_rho = r_theta / rho;
+        J_u(0,0) += r_rho * sin_phi * sin_phi;
+        J_u(0,1) -= r_rho * sin_phi * cos_phi;
+        J_u(1,0) -= r_rho * sin_phi * cos_phi;
+        J_u(1,1) += r_rho * cos_phi * cos_phi;
+    }
 
     // Apply generalised projection matrix
     p << mParameters.mu() * p_u(0) + mParameters.u0(),
          mParameters.mv() * p_u(1) + mParameters.v0();
+
+    J << mParameters.mu() * J_u.row(0),
+         mParameters.mv() * J_u.row(1);
+}
+
+/**
+ * \brief Project a 3D point to the image plane and calculate Jacobians
+ *
+ * \param P 3D point coordinates
+ * \param p return value, contains the image point coordinates
+ * \param J return value, jacobian of p w.r.t. P
+ * \param J_params return value, jacobian of p w.r.t.
+ *        k2, k3, k4, k5, mu, mv, u0, v0
+ */
+void
+EquidistantCamera::spaceToPlane(const Eigen::Vector3d& P, Eigen::Vector2d& p,
+                                Eigen::Matrix<double,2,3>& J,
+                                Eigen::Matrix<double,2,Eigen::Dynamic>& J_params) const
+{
+    spaceToPlane(P, p, J);
+
+    double rho = hypot(P(0), P(1));
+    double theta = atan2(rho, P(2));
+
+    double cos_phi = 0.0;
+    double sin_phi = 0.0;
+    if (rho != 0.0)
+    {
+        cos_phi = P(0) / rho;
+        sin_phi = P(1) / rho;
+    }
+
+    double mu = mParameters.mu();
+    double mv = mParameters.mv();
+
+    double theta2 = theta * theta;
+    double theta3 = theta2 * theta;
+    double theta5 = theta3 * theta2;
+    double theta7 = theta5 * theta2;
+    double theta9 = theta7 * theta2;
+
+    J_params.resize(2, 8);
+    J_params << mu * theta3 * cos_phi, mu * theta5 * cos_phi,
+                mu * theta7 * cos_phi, mu * theta9 * cos_phi,
+                (p(0) - mParameters.u0()) / mu, 0.0, 1.0, 0.0,
+                mv * theta3 * sin_phi, mv * theta5 * sin_phi,
+                mv * theta7 * sin_phi, mv * theta9 * sin_phi,
+                0.0, (p(1) - mParameters.v0()) / mv, 0.0, 1.0;
+}
+
+/**
+ * \brief Projects a batch of 3D points to the image plane
+ *
+ * Same model as spaceToPlane(). The polar angle comes from atan2 of the
+ * radial and axial components, and the azimuth is applied through the
+ * normalised radial direction instead of atan2/cos/sin.
+ */
+template <typename T>
+void
+EquidistantCamera::spaceToPlaneBatchImpl(const T* x, const T* y, const T* z,
+                                         int inStride,
+                                         T* u, T* v, int outStride,
+                                         size_t count) const
+{
+    const T k2 = mParameters.k2();
+    const T k3 = mParameters.k3();
+    const T k4 = mParameters.k4();
+    const T k5 = mParameters.k5();
+    const T mu = mParameters.mu();
+    const T mv = mParameters.mv();
+    const T u0 = mParameters.u0();
+    const T v0 = mParameters.v0();
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        const size_t in = i * inStride;
+        const size_t out = i * outStride;
+
+        T rho = std::sqrt(x[in] * x[in] + y[in] * y[in]);
+        T theta = std::atan2(rho, z[in]);
+        T theta2 = theta * theta;
+
+        T r_theta = theta * (T(1.0) + theta2 * (k2 + theta2 * (k3 + theta2 * (k4 + theta2 * k5))));
+
+        T mx_u = r_theta;
+        T my_u = T(0.0);
+        if (rho > T(0.0))
+        {
+            mx_u = r_theta * x[in] / rho;
+            my_u = r_theta * y[in] / rho;
+        }
+
+        // Apply generalised projection matrix
+        u[out] = mu * mx_u + u0;
+        v[out] = mv * my_u + v0;
+    }
+}
+
+/**
+ * \brief Lifts a batch of image points to their projective rays
+ *
+ * The polar angle is recovered in double precision for both scalar types.
+ */
+template <typename T>
+void
+EquidistantCamera::liftProjectiveBatchImpl(const T* u, const T* v, int inStride,
+                                           T* x, T* y, T* z,
+                                           int outStride, size_t count) const
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        const size_t in = i * inStride;
+        const size_t out = i * outStride;
+
+        // Lift points to normalised plane
+        Eigen::Vector2d p_u(m_inv_K11 * u[in] + m_inv_K13,
+                            m_inv_K22 * v[in] + m_inv_K23);
+
+        // Obtain a projective ray
+        double theta, phi;
+        backprojectSymmetric(p_u, theta, phi);
+
+        double sin_theta = sin(theta);
+        x[out] = sin_theta * cos(phi);
+        y[out] = sin_theta * sin(phi);
+        z[out] = cos(theta);
+    }
+}
+
+void
+EquidistantCamera::spaceToPlaneBatch(const double* x, const double* y, const double* z,
+                                     int inStride,
+                                     double* u, double* v, int outStride,
+                                     size_t count) const
+{
+    spaceToPlaneBatchImpl(x, y, z, inStride, u, v, outStride, count);
+}
+
+void
+EquidistantCamera::liftProjectiveBatch(const double* u, const double* v, int inStride,
+                                       double* x, double* y, double* z,
+                                       int outStride, size_t count) const
+{
+    liftProjectiveBatchImpl(u, v, inStride, x, y, z, outStride, count);
+}
+
+void
+EquidistantCamera::liftSphereBatch(const double* u, const double* v, int inStride,
+                                   double* x, double* y, double* z,
+                                   int outStride, size_t count) const
+{
+    liftProjectiveBatchImpl(u, v, inStride, x, y, z, outStride, count);
+}
+
+void
+EquidistantCamera::spaceToPlaneBatch(const float* x, const float* y, const float* z,
+                                     int inStride,
+                                     float* u, float* v, int outStride,
+                                     size_t count) const
+{
+    spaceToPlaneBatchImpl(x, y, z, inStride, u, v, outStride, count);
+}
+
+void
+EquidistantCamera::liftProjectiveBatch(const float* u, const float* v, int inStride,
+                                       float* x, float* y, float* z,
+                                       int outStride, size_t count) const
+{
+    liftProjectiveBatchImpl(u, v, inStride, x, y, z, outStride, count);
+}
+
+void
+EquidistantCamera::liftSphereBatch(const float* u, const float* v, int inStride,
+                                   float* x, float* y, float* z,
+                                   int outStride, size_t count) const
+{
+    liftProjectiveBatchImpl(u, v, inStride, x, y, z, outStride, count);
 }
 
 /** 
@@ -510,35 +728,29 @@ EquidistantCamera::undistToPlane(const Eigen::Vector2d& p_u, Eigen::Vector2d& p)
 }
 
 void
-EquidistantCamera::initUndistortMap(cv::Mat& map1, cv::Mat& map2, double fScale) const
+EquidistantCamera::initUndistortMap(cv::Mat& map1, cv::Mat& map2, double fScale,
+                                    int m1type) const
 {
     cv::Size imageSize(mParameters.imageWidth(), mParameters.imageHeight());
 
-    cv::Mat mapX = cv::Mat::zeros(imageSize, CV_32F);
-    cv::Mat mapY = cv::Mat::zeros(imageSize, CV_32F);
-
-    for (int v = 0; v < imageSize.height; ++v)
+    auto rays = [&](int v, float* X, float* Y, float* Z)
     {
+        double my_u = m_inv_K22 / fScale * v + m_inv_K23 / fScale;
+
         for (int u = 0; u < imageSize.width; ++u)
         {
             double mx_u = m_inv_K11 / fScale * u + m_inv_K13 / fScale;
-            double my_u = m_inv_K22 / fScale * v + m_inv_K23 / fScale;
 
             double theta, phi;
             backprojectSymmetric(Eigen::Vector2d(mx_u, my_u), theta, phi);
 
-            Eigen::Vector3d P;
-            P << sin(theta) * cos(phi), sin(theta) * sin(phi), cos(theta);
-
-            Eigen::Vector2d p;
-            spaceToPlane(P, p);
-
-            mapX.at<float>(v,u) = p(0);
-            mapY.at<float>(v,u) = p(1);
+            X[u] = sin(theta) * cos(phi);
+            Y[u] = sin(theta) * sin(phi);
+            Z[u] = cos(theta);
         }
-    }
+    };
 
-    cv::convertMaps(mapX, mapY, map1, map2, CV_32FC1, false);
+    initRectifyMap(imageSize, rays, map1, map2, m1type);
 }
 
 cv::Mat
@@ -546,16 +758,13 @@ EquidistantCamera::initUndistortRectifyMap(cv::Mat& map1, cv::Mat& map2,
                                            float fx, float fy,
                                            cv::Size imageSize,
                                            float cx, float cy,
-                                           cv::Mat rmat) const
+                                           cv::Mat rmat, int m1type) const
 {
     if (imageSize == cv::Size(0, 0))
     {
         imageSize = cv::Size(mParameters.imageWidth(), mParameters.imageHeight());
     }
 
-    cv::Mat mapX = cv::Mat::zeros(imageSize.height, imageSize.width, CV_32F);
-    cv::Mat mapY = cv::Mat::zeros(imageSize.height, imageSize.width, CV_32F);
-
     Eigen::Matrix3f K_rect;
 
     if (cx == -1.0f && cy == -1.0f)
@@ -583,24 +792,10 @@ EquidistantCamera::initUndistortRectifyMap(cv::Mat& map1, cv::Mat& map2,
     cv::cv2eigen(rmat, R);
     R_inv = R.inverse();
 
-    for (int v = 0; v < imageSize.height; ++v)
-    {
-        for (int u = 0; u < imageSize.width; ++u)
-        {
-            Eigen::Vector3f xo;
-            xo << u, v, 1;
-
-            Eigen::Vector3f uo = R_inv * K_rect_inv * xo;
-
-            Eigen::Vector2d p;
-            spaceToPlane(uo.cast<double>(), p);
-
-            mapX.at<float>(v,u) = p(0);
-            mapY.at<float>(v,u) = p(1);
-        }
-    }
+    // ray of pixel (u, v) is A * (u, v, 1)
+    Eigen::Matrix3f A = R_inv * K_rect_inv;
 
-    cv::convertMaps(mapX, mapY, map1, map2, CV_32FC1, false);
+    initRectifyMap(imageSize, A, map1, map2, m1type);
 
     cv::Mat K_rect_cv;
     cv::eigen2cv(K_rect, K_rect_cv);
@@ -629,6 +824,8 @@ EquidistantCamera::setParameters(const EquidistantCamera::Parameters& parameters
     m_inv_K13 = -mParameters.u0() / mParameters.mu();
     m_inv_K22 = 1.0 / mParameters.mv();
     m_inv_K23 = -mParameters.v0() / mParameters.mv();
+
+    m_thetaTable.reset();
 }
 
 void
@@ -728,6 +925,14 @@ EquidistantCamera::backprojectSymmetric(const Eigen::Vector2d& p_u,
         phi = atan2(p_u(1), p_u(0));
     }
 
+    boost::shared_ptr<const ThetaTable> table = thetaTable();
+    if (p_u_norm <= table->maxR)
+    {
+        theta = thetaFromTable(*table, p_u_norm);
+        return;
+    }
+
+    // Outside the monotonic range of r(theta): search all polynomial roots
     int npow = 9;
     if (mParameters.k5() == 0.0)
     {
@@ -817,4 +1022,146 @@ EquidistantCamera::backprojectSymmetric(const Eigen::Vector2d& p_u,
     }
 }
 
+/**
+ * \brief Returns the theta(r) table, building it on first use
+ *
+ * Concurrent callers may each build a table; all of them are identical
+ * and the first one stored is kept.
+ */
+boost::shared_ptr<const EquidistantCamera::ThetaTable>
+EquidistantCamera::thetaTable(void) const
+{
+    boost::shared_ptr<const ThetaTable> table = boost::atomic_load(&m_thetaTable);
+    if (table)
+    {
+        return table;
+    }
+
+    table = buildThetaTable();
+
+    boost::shared_ptr<const ThetaTable> expected;
+    if (!boost::atomic_compare_exchange(&m_thetaTable, &expected, table))
+    {
+        table = expected;
+    }
+
+    return table;
+}
+
+/**
+ * \brief Tabulates the inverse of r(theta) for backprojectSymmetric()
+ *
+ * r(theta) = theta + k2 theta^3 + k3 theta^5 + k4 theta^7 + k5 theta^9 is
+ * monotonic from 0 up to the first stationary point (or pi). On that range
+ * the smallest non-negative root of r(theta) = r, which the companion
+ * matrix solver would return, is the unique one, so it can be read from a
+ * table and refined with Newton's method.
+ */
+boost::shared_ptr<const EquidistantCamera::ThetaTable>
+EquidistantCamera::buildThetaTable(void) const
+{
+    const double k2 = mParameters.k2();
+    const double k3 = mParameters.k3();
+    const double k4 = mParameters.k4();
+    const double k5 = mParameters.k5();
+
+    boost::shared_ptr<ThetaTable> table(new ThetaTable);
+
+    // find the end of the monotonic range
+    const int nScanSteps = 4096;
+    table->thetaMax = 0.0;
+    for (int i = 1; i <= nScanSteps; ++i)
+    {
+        double theta = M_PI * i / nScanSteps;
+        double theta2 = theta * theta;
+        double dr = 1.0 + theta2 * (3.0 * k2 + theta2 * (5.0 * k3 + theta2 * (7.0 * k4 + theta2 * 9.0 * k5)));
+
+        if (dr <= 0.0)
+        {
+            break;
+        }
+
+        table->thetaMax = theta;
+    }
+
+    table->invStep = 0.0;
+    table->maxR = -1.0;
+
+    if (table->thetaMax <= 0.0)
+    {
+        return table;
+    }
+
+    const int nEntries = 1024;
+    const double maxR = r(k2, k3, k4, k5, table->thetaMax);
+    const double step = maxR / (nEntries - 1);
+
+    table->theta.resize(nEntries);
+    table->theta.at(0) = 0.0;
+
+    // invert r(theta) by bisection; the table is only built once
+    double lo = 0.0;
+    for (int i = 1; i < nEntries; ++i)
+    {
+        double target = step * i;
+        double hi = table->thetaMax;
+
+        for (int j = 0; j < 60; ++j)
+        {
+            double mid = 0.5 * (lo + hi);
+            if (r(k2, k3, k4, k5, mid) < target)
+            {
+                lo = mid;
+            }
+            else
+            {
+                hi = mid;
+            }
+        }
+
+        table->theta.at(i) = 0.5 * (lo + hi);
+    }
+
+    table->invStep = 1.0 / step;
+    table->maxR = maxR;
+
+    return table;
+}
+
+/**
+ * \brief Interpolates theta for a radius inside the table range and
+ *        polishes it with Newton's method on r(theta)
+ */
+double
+EquidistantCamera::thetaFromTable(const ThetaTable& table, double r_theta) const
+{
+    const double k2 = mParameters.k2();
+    const double k3 = mParameters.k3();
+    const double k4 = mParameters.k4();
+    const double k5 = mParameters.k5();
+
+    double t = r_theta * table.invStep;
+    int idx = std::min(static_cast<int>(t), static_cast<int>(table.theta.size()) - 2);
+    double alpha = t - idx;
+
+    double theta = (1.0 - alpha) * table.theta[idx] + alpha * table.theta[idx + 1];
+
+    for (int i = 0; i < 4; ++i)
+    {
+        double theta2 = theta * theta;
+        double f = theta * (1.0 + theta2 * (k2 + theta2 * (k3 + theta2 * (k4 + theta2 * k5)))) - r_theta;
+        double df = 1.0 + theta2 * (3.0 * k2 + theta2 * (5.0 * k3 + theta2 * (7.0 * k4 + theta2 * 9.0 * k5)));
+
+        double step = f / df;
+        theta = std::min(std::max(theta - step, 0.0), table.thetaMax);
+
+        if (fabs(step) < 1e-15)
+        {
+            break;
+        }
+    }
+
+    return theta;
+}
+
 }
@@ -0,0 +1,399 @@
+#include "camera_model/camera_models/MapCache.h"
+
+#include <atomic>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/shared_ptr.hpp>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <unistd.h>
+#include <vector>
+
+namespace camera_model
+{
+
+/**
+ * \brief Header of a map cache file
+ *
+ * The header is followed by the rows of map1 and then those of map2, if
+ * map2 is not empty. All fields are stored in host byte order.
+ */
+struct MapCacheFileHeader
+{
+    char magic[8];
+    int version;
+    int width;
+    int height;
+    int map1Type;
+    int map2Type;
+    int reserved;
+    uint64_t key;
+    float K_rect[9];
+    int reserved2;
+};
+
+static const char kMapCacheMagic[8] = {'C', 'A', 'M', 'M', 'A', 'P', 'S', '\0'};
+static const int kMapCacheVersion = 1;
+
+namespace
+{
+
+/**
+ * \brief 64-bit FNV-1a hash
+ */
+class Hasher
+{
+public:
+    Hasher()
+     : m_hash(14695981039346656037ULL)
+    {
+
+    }
+
+    template <typename T>
+    void add(const T& value)
+    {
+        add(&value, sizeof(value));
+    }
+
+    void add(const void* data, size_t size)
+    {
+        const unsigned char* bytes = static_cast<const unsigned char*>(data);
+        for (size_t i = 0; i < size; ++i)
+        {
+            m_hash ^= bytes[i];
+            m_hash *= 1099511628211ULL;
+        }
+    }
+
+    uint64_t hash(void) const
+    {
+        return m_hash;
+    }
+
+private:
+    uint64_t m_hash;
+};
+
+size_t
+mapSize(int width, int height, int type)
+{
+    if (type < 0)
+    {
+        return 0;
+    }
+
+    return static_cast<size_t>(width) * height * CV_ELEM_SIZE(type);
+}
+
+typedef boost::shared_ptr<boost::interprocess::mapped_region> MappedRegionPtr;
+
+#if CV_VERSION_MAJOR >= 4
+typedef cv::AccessFlag MatAccessFlag;
+#else
+typedef int MatAccessFlag;
+#endif
+
+/**
+ * \brief Allocator of matrices that point into a mapped file
+ *
+ * Never allocates; the UMatData of each matrix holds a reference to the
+ * mapped region, which is released together with the last copy of the
+ * matrix.
+ */
+class MappedRegionAllocator : public cv::MatAllocator
+{
+public:
+    MappedRegionAllocator()
+    {
+
+    }
+
+    cv::UMatData* allocate(int dims, const int* sizes, int type,
+                           void* data, size_t* step, MatAccessFlag flags,
+                           cv::UMatUsageFlags usageFlags) const
+    {
+        // matrices created by OpenCV from ours use the default allocator
+        return cv::Mat::getStdAllocator()->allocate(dims, sizes, type, data,
+                                                    step, flags, usageFlags);
+    }
+
+    bool allocate(cv::UMatData* data, MatAccessFlag accessflags,
+                  cv::UMatUsageFlags usageFlags) const
+    {
+        return cv::Mat::getStdAllocator()->allocate(data, accessflags, usageFlags);
+    }
+
+    void deallocate(cv::UMatData* u) const
+    {
+        if (u == 0)
+        {
+            return;
+        }
+
+        delete static_cast<MappedRegionPtr*>(u->userdata);
+        delete u;
+    }
+
+    /**
+     * \brief Matrix of size rows x cols at address inside region that
+     *        keeps region mapped
+     */
+    cv::Mat wrap(int rows, int cols, int type, char* address,
+                 const MappedRegionPtr& region) const
+    {
+        cv::Mat mat(rows, cols, type, address);
+
+        cv::UMatData* u = new cv::UMatData(this);
+        u->data = u->origdata = reinterpret_cast<uchar*>(address);
+        u->size = mat.total() * mat.elemSize();
+        u->flags |= cv::UMatData::USER_ALLOCATED;
+        u->userdata = new MappedRegionPtr(region);
+        u->refcount = 1;
+
+        mat.u = u;
+        mat.allocator = this;
+
+        return mat;
+    }
+};
+
+const MappedRegionAllocator kMappedRegionAllocator;
+
+std::atomic<unsigned int> tmpFileCounter(0);
+
+}
+
+MapCache::MapCache()
+ : m_lastLoadWasHit(false)
+{
+
+}
+
+cv::Mat
+MapCache::initUndistortRectifyMap(const std::string& filename,
+                                  const Camera& camera,
+                                  cv::Mat& map1, cv::Mat& map2,
+                                  float fx, float fy,
+                                  cv::Size imageSize,
+                                  float cx, float cy,
+                                  cv::Mat rmat, int m1type)
+{
+    uint64_t k = key(camera, fx, fy, imageSize, cx, cy, rmat, m1type);
+
+    cv::Mat K_rect;
+    if (readFromFile(filename, k, map1, map2, K_rect))
+    {
+        m_lastLoadWasHit = true;
+        return K_rect;
+    }
+
+    m_lastLoadWasHit = false;
+
+    K_rect = camera.initUndistortRectifyMap(map1, map2, fx, fy, imageSize,
+                                            cx, cy, rmat, m1type);
+
+    writeToFile(filename, k, map1, map2, K_rect);
+
+    return K_rect;
+}
+
+bool
+MapCache::lastLoadWasHit(void) const
+{
+    return m_lastLoadWasHit;
+}
+
+uint64_t
+MapCache::key(const Camera& camera,
+              float fx, float fy, cv::Size imageSize,
+              float cx, float cy, const cv::Mat& rmat,
+              int m1type)
+{
+    Hasher hasher;
+
+    hasher.add(kMapCacheVersion);
+    hasher.add(cameraKey(camera));
+
+    hasher.add(fx);
+    hasher.add(fy);
+    hasher.add(cx);
+    hasher.add(cy);
+    hasher.add(imageSize.width);
+    hasher.add(imageSize.height);
+
+    cv::Mat R;
+    rmat.convertTo(R, CV_64F);
+    for (int r = 0; r < R.rows; ++r)
+    {
+        for (int c = 0; c < R.cols; ++c)
+        {
+            hasher.add(R.at<double>(r, c));
+        }
+    }
+
+    // all values <= 0 select the same format
+    hasher.add(m1type <= 0 ? int(CV_16SC2) : m1type);
+
+    return hasher.hash();
+}
+
+uint64_t
+MapCache::cameraKey(const Camera& camera)
+{
+    Hasher hasher;
+
+    hasher.add(static_cast<int>(camera.modelType()));
+    hasher.add(camera.imageWidth());
+    hasher.add(camera.imageHeight());
+
+    std::vector<double> parameters;
+    camera.writeParameters(parameters);
+    for (size_t i = 0; i < parameters.size(); ++i)
+    {
+        hasher.add(parameters.at(i));
+    }
+
+    return hasher.hash();
+}
+
+bool
+MapCache::writeToFile(const std::string& filename, uint64_t key,
+                      const cv::Mat& map1, const cv::Mat& map2,
+                      const cv::Mat& K_rect)
+{
+    if (map1.empty() || (!map2.empty() && map2.size() != map1.size()) ||
+        K_rect.rows != 3 || K_rect.cols != 3)
+    {
+        return false;
+    }
+
+    MapCacheFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, kMapCacheMagic, sizeof(header.magic));
+    header.version = kMapCacheVersion;
+    header.width = map1.cols;
+    header.height = map1.rows;
+    header.map1Type = map1.type();
+    header.map2Type = map2.empty() ? -1 : map2.type();
+    header.key = key;
+
+    cv::Mat K;
+    K_rect.convertTo(K, CV_32F);
+    for (int i = 0; i < 9; ++i)
+    {
+        header.K_rect[i] = K.at<float>(i / 3, i % 3);
+    }
+
+    // write to a temporary file and rename it over the old one, so that
+    // readers never see a partially written file. The name is unique to
+    // this process and call, as several processes may rebuild the same
+    // cache at once.
+    std::ostringstream oss;
+    oss << filename << "." << getpid() << "." << tmpFileCounter++ << ".tmp";
+    std::string tmpFilename = oss.str();
+    {
+        std::ofstream ofs(tmpFilename.c_str(), std::ios::out | std::ios::binary);
+        if (!ofs.is_open())
+        {
+            return false;
+        }
+
+        ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+        const cv::Mat* maps[2] = {&map1, &map2};
+        for (int m = 0; m < 2; ++m)
+        {
+            const cv::Mat& map = *maps[m];
+            for (int r = 0; r < map.rows; ++r)
+            {
+                ofs.write(reinterpret_cast<const char*>(map.ptr(r)),
+                          map.cols * map.elemSize());
+            }
+        }
+
+        if (!ofs.good())
+        {
+            ofs.close();
+            std::remove(tmpFilename.c_str());
+            return false;
+        }
+    }
+
+    if (std::rename(tmpFilename.c_str(), filename.c_str()) != 0)
+    {
+        std::remove(tmpFilename.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+bool
+MapCache::readFromFile(const std::string& filename, uint64_t key,
+                       cv::Mat& map1, cv::Mat& map2, cv::Mat& K_rect)
+{
+    namespace bip = boost::interprocess;
+
+    // copy-on-write, so that the maps can be handed out as writable
+    // matrices without touching the file
+    boost::shared_ptr<bip::mapped_region> region;
+    try
+    {
+        bip::file_mapping file(filename.c_str(), bip::read_only);
+        region.reset(new bip::mapped_region(file, bip::copy_on_write));
+    }
+    catch (const bip::interprocess_exception&)
+    {
+        return false;
+    }
+
+    if (region->get_size() < sizeof(MapCacheFileHeader))
+    {
+        return false;
+    }
+
+    char* address = static_cast<char*>(region->get_address());
+
+    MapCacheFileHeader header;
+    memcpy(&header, address, sizeof(header));
+
+    if (memcmp(header.magic, kMapCacheMagic, sizeof(header.magic)) != 0 ||
+        header.version != kMapCacheVersion || header.key != key ||
+        header.width < 1 || header.height < 1 || header.map1Type < 0)
+    {
+        return false;
+    }
+
+    size_t map1Size = mapSize(header.width, header.height, header.map1Type);
+    size_t map2Size = mapSize(header.width, header.height, header.map2Type);
+    if (region->get_size() != sizeof(header) + map1Size + map2Size)
+    {
+        return false;
+    }
+
+    // the maps keep the region mapped for as long as they are referenced
+    map1 = kMappedRegionAllocator.wrap(header.height, header.width, header.map1Type,
+                                       address + sizeof(header), region);
+    if (header.map2Type < 0)
+    {
+        map2.release();
+    }
+    else
+    {
+        map2 = kMappedRegionAllocator.wrap(header.height, header.width, header.map2Type,
+                                           address + sizeof(header) + map1Size, region);
+    }
+
+    K_rect = cv::Mat(3, 3, CV_32F);
+    for (int i = 0; i < 9; ++i)
+    {
+        K_rect.at<float>(i / 3, i % 3) = header.K_rect[i];
+    }
+
+    return true;
+}
+
+}
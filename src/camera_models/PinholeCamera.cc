@@ -1,13 +1,16 @@
 #include "camera_model/camera_models/PinholeCamera.h"
 
+#include <algorithm>
 #include <cmath>
 #include <cstdio>
 #include <eigen3/Eigen/Dense>
 #include <iomanip>
+#include <limits>
 #include <opencv2/calib3d/calib3d.hpp>
 #include <opencv2/core/eigen.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
 
+#include "camera_model/camera_models/PinholeCameraSimd.h"
 #include "camera_model/gpl/gpl.h"
 
 namespace camera_model
@@ -265,6 +268,9 @@ PinholeCamera::PinholeCamera()
  , m_inv_K22(1.0)
  , m_inv_K23(0.0)
  , m_noDistortion(true)
+ , m_undistortMethod(UNDISTORT_FIXED_POINT)
+ , m_undistortMaxIterations(8)
+ , m_undistortTolerance(0.0)
 {
 
 }
@@ -275,6 +281,9 @@ PinholeCamera::PinholeCamera(const std::string& cameraName,
                              double fx, double fy, double cx, double cy)
  : mParameters(cameraName, imageWidth, imageHeight,
                k1, k2, p1, p2, fx, fy, cx, cy)
+ , m_undistortMethod(UNDISTORT_FIXED_POINT)
+ , m_undistortMaxIterations(8)
+ , m_undistortTolerance(0.0)
 {
     if ((mParameters.k1() == 0.0) &&
         (mParameters.k2() == 0.0) &&
@@ -297,6 +306,9 @@ PinholeCamera::PinholeCamera(const std::string& cameraName,
 
 PinholeCamera::PinholeCamera(const PinholeCamera::Parameters& params)
  : mParameters(params)
+ , m_undistortMethod(UNDISTORT_FIXED_POINT)
+ , m_undistortMaxIterations(8)
+ , m_undistortTolerance(0.0)
 {
     if ((mParameters.k1() == 0.0) &&
         (mParameters.k2() == 0.0) &&
@@ -449,60 +461,16 @@ PinholeCamera::liftSphere(const Eigen::Vector2d& p, Eigen::Vector3d& P) const
 void
 PinholeCamera::liftProjective(const Eigen::Vector2d& p, Eigen::Vector3d& P) const
 {
-    double mx_d, my_d,mx2_d, mxy_d, my2_d, mx_u, my_u;
-    double rho2_d, rho4_d, radDist_d, Dx_d, Dy_d, inv_denom_d;
-    //double lambda;
-
     // Lift points to normalised plane
-    mx_d = m_inv_K11 * p(0) + m_inv_K13;
-    my_d = m_inv_K22 * p(1) + m_inv_K23;
+    double mx_d = m_inv_K11 * p(0) + m_inv_K13;
+    double my_d = m_inv_K22 * p(1) + m_inv_K23;
 
-    if (m_noDistortion)
-    {
-        mx_u = mx_d;
-        my_u = my_d;
-    }
-    else
+    double mx_u = mx_d;
+    double my_u = my_d;
+
+    if (!m_noDistortion)
     {
-        if (0)
-        {
-            double k1 = mParameters.k1();
-            double k2 = mParameters.k2();
-            double p1 = mParameters.p1();
-            double p2 = mParameters.p2();
-
-            // Apply inverse distortion model
-            // proposed by Heikkila
-            mx2_d = mx_d*mx_d;
-            my2_d = my_d*my_d;
-            mxy_d = mx_d*my_d;
-            rho2_d = mx2_d+my2_d;
-            rho4_d = rho2_d*rho2_d;
-            radDist_d = k1*rho2_d+k2*rho4_d;
-            Dx_d = mx_d*radDist_d + p2*(rho2_d+2*mx2_d) + 2*p1*mxy_d;
-            Dy_d = my_d*radDist_d + p1*(rho2_d+2*my2_d) + 2*p2*mxy_d;
-            inv_denom_d = 1/(1+4*k1*rho2_d+6*k2*rho4_d+8*p1*my_d+8*p2*mx_d);
-
-            mx_u = mx_d - inv_denom_d*Dx_d;
-            my_u = my_d - inv_denom_d*Dy_d;
-        }
-        else
-        {
-            // Recursive distortion model
-            int n = 8;
-            Eigen::Vector2d d_u;
-            distortion(Eigen::Vector2d(mx_d, my_d), d_u);
-            // Approximate value
-            mx_u = mx_d - d_u(0);
-            my_u = my_d - d_u(1);
-
-            for (int i = 1; i < n; ++i)
-            {
-                distortion(Eigen::Vector2d(mx_u, my_u), d_u);
-                mx_u = mx_d - d_u(0);
-                my_u = my_d - d_u(1);
-            }
-        }
+        undistortPoint(mx_d, my_d, mx_u, my_u, false);
     }
 
     // Obtain a projective ray
@@ -541,72 +509,247 @@ PinholeCamera::spaceToPlane(const Eigen::Vector3d& P, Eigen::Vector2d& p) const
          mParameters.fy() * p_d(1) + mParameters.cy();
 }
 
-#if 0
+/**
+ * \brief Projects a batch of 3D points to the image plane
+ *
+ * Separate coordinate arrays go straight to the SIMD kernels; strided
+ * input is deinterleaved through small stack buffers first.
+ */
+template <typename T>
+void
+PinholeCamera::spaceToPlaneBatchImpl(const T* x, const T* y, const T* z,
+                                     int inStride,
+                                     T* u, T* v, int outStride,
+                                     size_t count) const
+{
+    T params[8] = {T(mParameters.k1()), T(mParameters.k2()),
+                   T(mParameters.p1()), T(mParameters.p2()),
+                   T(mParameters.fx()), T(mParameters.fy()),
+                   T(mParameters.cx()), T(mParameters.cy())};
+
+    if (inStride == 1 && outStride == 1)
+    {
+        pinholeSpaceToPlaneSimd(params, x, y, z, u, v, count);
+        return;
+    }
+
+    const size_t chunkSize = 256;
+    T xs[chunkSize], ys[chunkSize], zs[chunkSize];
+    T us[chunkSize], vs[chunkSize];
+
+    for (size_t begin = 0; begin < count; begin += chunkSize)
+    {
+        size_t n = std::min(chunkSize, count - begin);
+
+        for (size_t i = 0; i < n; ++i)
+        {
+            const size_t in = (begin + i) * inStride;
+
+            xs[i] = x[in];
+            ys[i] = y[in];
+            zs[i] = z[in];
+        }
+
+        pinholeSpaceToPlaneSimd(params, xs, ys, zs, us, vs, n);
+
+        for (size_t i = 0; i < n; ++i)
+        {
+            const size_t out = (begin + i) * outStride;
+
+            u[out] = us[i];
+            v[out] = vs[i];
+        }
+    }
+}
+
+/**
+ * \brief Lifts a batch of image points to their projective rays
+ *
+ * The distortion is inverted in double precision for both scalar types.
+ */
+template <typename T>
+void
+PinholeCamera::liftProjectiveBatchImpl(const T* u, const T* v, int inStride,
+                                       T* x, T* y, T* z,
+                                       int outStride, size_t count) const
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        const size_t in = i * inStride;
+        const size_t out = i * outStride;
+
+        // Lift points to normalised plane
+        double mx_d = m_inv_K11 * u[in] + m_inv_K13;
+        double my_d = m_inv_K22 * v[in] + m_inv_K23;
+
+        double mx_u = mx_d;
+        double my_u = my_d;
+
+        if (!m_noDistortion)
+        {
+            undistortPoint(mx_d, my_d, mx_u, my_u, false);
+        }
+
+        // Obtain a projective ray
+        x[out] = mx_u;
+        y[out] = my_u;
+        z[out] = T(1.0);
+    }
+}
+
+template <typename T>
+void
+PinholeCamera::liftSphereBatchImpl(const T* u, const T* v, int inStride,
+                                   T* x, T* y, T* z,
+                                   int outStride, size_t count) const
+{
+    liftProjectiveBatchImpl(u, v, inStride, x, y, z, outStride, count);
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        const size_t out = i * outStride;
+
+        T inv_norm = T(1.0) / std::sqrt(x[out] * x[out] + y[out] * y[out] + T(1.0));
+
+        x[out] *= inv_norm;
+        y[out] *= inv_norm;
+        z[out] = inv_norm;
+    }
+}
+
+void
+PinholeCamera::spaceToPlaneBatch(const double* x, const double* y, const double* z,
+                                 int inStride,
+                                 double* u, double* v, int outStride,
+                                 size_t count) const
+{
+    spaceToPlaneBatchImpl(x, y, z, inStride, u, v, outStride, count);
+}
+
+void
+PinholeCamera::liftProjectiveBatch(const double* u, const double* v, int inStride,
+                                   double* x, double* y, double* z,
+                                   int outStride, size_t count) const
+{
+    liftProjectiveBatchImpl(u, v, inStride, x, y, z, outStride, count);
+}
+
+void
+PinholeCamera::liftSphereBatch(const double* u, const double* v, int inStride,
+                               double* x, double* y, double* z,
+                               int outStride, size_t count) const
+{
+    liftSphereBatchImpl(u, v, inStride, x, y, z, outStride, count);
+}
+
+void
+PinholeCamera::spaceToPlaneBatch(const float* x, const float* y, const float* z,
+                                 int inStride,
+                                 float* u, float* v, int outStride,
+                                 size_t count) const
+{
+    spaceToPlaneBatchImpl(x, y, z, inStride, u, v, outStride, count);
+}
+
+void
+PinholeCamera::liftProjectiveBatch(const float* u, const float* v, int inStride,
+                                   float* x, float* y, float* z,
+                                   int outStride, size_t count) const
+{
+    liftProjectiveBatchImpl(u, v, inStride, x, y, z, outStride, count);
+}
+
+void
+PinholeCamera::liftSphereBatch(const float* u, const float* v, int inStride,
+                               float* x, float* y, float* z,
+                               int outStride, size_t count) const
+{
+    liftSphereBatchImpl(u, v, inStride, x, y, z, outStride, count);
+}
+
 /**
  * \brief Project a 3D point to the image plane and calculate Jacobian
  *
  * \param P 3D point coordinates
  * \param p return value, contains the image point coordinates
+ * \param J return value, jacobian of p w.r.t. P
  */
 void
 PinholeCamera::spaceToPlane(const Eigen::Vector3d& P, Eigen::Vector2d& p,
                             Eigen::Matrix<double,2,3>& J) const
 {
-    Eigen::Vector2d p_u, p_d;
-    double norm, inv_denom;
-    double dxdmx, dydmx, dxdmy, dydmy;
-
-    norm = P.norm();
     // Project points to the normalised plane
-    inv_denom = 1.0 / P(2);
-    p_u << inv_denom * P(0), inv_denom * P(1);
-
-    // Calculate jacobian
-    double dudx = inv_denom;
-    double dvdx = 0.0;
-    double dudy = 0.0;
-    double dvdy = inv_denom;
-    inv_denom = - inv_denom * inv_denom;
-    double dudz = P(0) * inv_denom;
-    double dvdz = P(1) * inv_denom;
+    double inv_z = 1.0 / P(2);
+    Eigen::Vector2d p_u(inv_z * P(0), inv_z * P(1));
+
+    // Jacobian of the normalised point w.r.t. P
+    Eigen::Matrix<double,2,3> J_u;
+    J_u << inv_z, 0.0, -p_u(0) * inv_z,
+           0.0, inv_z, -p_u(1) * inv_z;
 
+    Eigen::Vector2d p_d;
     if (m_noDistortion)
     {
         p_d = p_u;
     }
     else
     {
-        // Apply distortion
+        // Apply distortion, J_d is the jacobian of p_d w.r.t. p_u
         Eigen::Vector2d d_u;
-        distortion(p_u, d_u);
+        Eigen::Matrix2d J_d;
+        distortion(p_u, d_u, J_d);
         p_d = p_u + d_u;
+        J_u = J_d * J_u;
     }
 
     double fx = mParameters.fx();
     double fy = mParameters.fy();
 
-    // Make the product of the jacobians
-    // and add projection matrix jacobian
-    inv_denom = fx * (dudx * dxdmx + dvdx * dxdmy); // reuse
-    dvdx = fy * (dudx * dydmx + dvdx * dydmy);
-    dudx = inv_denom;
-
-    inv_denom = fx * (dudy * dxdmx + dvdy * dxdmy); // reuse
-    dvdy = fy * (dudy * dydmx + dvdy * dydmy);
-    dudy = inv_denom;
-
-    inv_denom = fx * (dudz * dxdmx + dvdz * dxdmy); // reuse
-    dvdz = fy * (dudz * dydmx + dvdz * dydmy);
-    dudz = inv_denom;
-
     // Apply generalised projection matrix
     p << fx * p_d(0) + mParameters.cx(),
          fy * p_d(1) + mParameters.cy();
 
-    J << dudx, dudy, dudz,
-         dvdx, dvdy, dvdz;
+    J << fx * J_u.row(0),
+         fy * J_u.row(1);
+}
+
+/**
+ * \brief Project a 3D point to the image plane and calculate Jacobians
+ *
+ * \param P 3D point coordinates
+ * \param p return value, contains the image point coordinates
+ * \param J return value, jacobian of p w.r.t. P
+ * \param J_params return value, jacobian of p w.r.t.
+ *        k1, k2, p1, p2, fx, fy, cx, cy
+ */
+void
+PinholeCamera::spaceToPlane(const Eigen::Vector3d& P, Eigen::Vector2d& p,
+                            Eigen::Matrix<double,2,3>& J,
+                            Eigen::Matrix<double,2,Eigen::Dynamic>& J_params) const
+{
+    spaceToPlane(P, p, J);
+
+    double fx = mParameters.fx();
+    double fy = mParameters.fy();
+
+    double mx_u = P(0) / P(2);
+    double my_u = P(1) / P(2);
+    double mx2_u = mx_u * mx_u;
+    double my2_u = my_u * my_u;
+    double mxy_u = mx_u * my_u;
+    double rho2_u = mx2_u + my2_u;
+
+    double mx_d = (p(0) - mParameters.cx()) / fx;
+    double my_d = (p(1) - mParameters.cy()) / fy;
+
+    J_params.resize(2, 8);
+    J_params << fx * mx_u * rho2_u, fx * mx_u * rho2_u * rho2_u,
+                fx * 2.0 * mxy_u, fx * (rho2_u + 2.0 * mx2_u),
+                mx_d, 0.0, 1.0, 0.0,
+                fy * my_u * rho2_u, fy * my_u * rho2_u * rho2_u,
+                fy * (rho2_u + 2.0 * my2_u), fy * 2.0 * mxy_u,
+                0.0, my_d, 0.0, 1.0;
 }
-#endif
 
 /**
  * \brief Projects an undistorted 2D point p_u to the image plane
@@ -697,32 +840,189 @@ PinholeCamera::distortion(const Eigen::Vector2d& p_u, Eigen::Vector2d& d_u,
 }
 
 void
-PinholeCamera::initUndistortMap(cv::Mat& map1, cv::Mat& map2, double fScale) const
+PinholeCamera::setUndistortionMethod(UndistortionMethod method,
+                                     int maxIterations,
+                                     double tolerance)
 {
-    cv::Size imageSize(mParameters.imageWidth(), mParameters.imageHeight());
+    m_undistortMethod = method;
+    m_undistortMaxIterations = maxIterations;
+    m_undistortTolerance = tolerance;
+}
+
+Camera::UndistortionMethod
+PinholeCamera::undistortionMethod(void) const
+{
+    return m_undistortMethod;
+}
+
+double
+PinholeCamera::undistort(const Eigen::Vector2d& p_d, Eigen::Vector2d& p_u) const
+{
+    double mx_u = p_d(0);
+    double my_u = p_d(1);
+    double residual = 0.0;
+
+    if (!m_noDistortion)
+    {
+        residual = undistortPoint(p_d(0), p_d(1), mx_u, my_u, true);
+    }
+
+    p_u << mx_u, my_u;
+
+    return residual;
+}
+
+void
+PinholeCamera::undistort(const double* p_d, double* p_u, size_t count,
+                         double* residuals) const
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        double mx_u = p_d[2 * i];
+        double my_u = p_d[2 * i + 1];
+        double residual = 0.0;
+
+        if (!m_noDistortion)
+        {
+            residual = undistortPoint(p_d[2 * i], p_d[2 * i + 1], mx_u, my_u,
+                                      residuals != 0);
+        }
+
+        p_u[2 * i] = mx_u;
+        p_u[2 * i + 1] = my_u;
+
+        if (residuals)
+        {
+            residuals[i] = residual;
+        }
+    }
+}
+
+/**
+ * \brief Solves p_u + d_u(p_u) = p_d for a point on the normalised plane
+ *
+ * \param mx_d, my_d distorted coordinates
+ * \param mx_u, my_u return value, undistorted coordinates
+ * \param computeResidual whether the fixed-point model should evaluate the
+ *        final residual (Newton always has it at hand)
+ * \return norm of the residual, or 0 if it was not computed
+ */
+double
+PinholeCamera::undistortPoint(double mx_d, double my_d,
+                              double& mx_u, double& my_u,
+                              bool computeResidual) const
+{
+    const double k1 = mParameters.k1();
+    const double k2 = mParameters.k2();
+    const double p1 = mParameters.p1();
+    const double p2 = mParameters.p2();
+    const double tol2 = m_undistortTolerance * m_undistortTolerance;
 
-    cv::Mat mapX = cv::Mat::zeros(imageSize, CV_32F);
-    cv::Mat mapY = cv::Mat::zeros(imageSize, CV_32F);
+    mx_u = mx_d;
+    my_u = my_d;
 
-    for (int v = 0; v < imageSize.height; ++v)
+    if (m_undistortMethod == UNDISTORT_FIXED_POINT)
     {
-        for (int u = 0; u < imageSize.width; ++u)
+        // Recursive distortion model
+        for (int i = 0; i < m_undistortMaxIterations; ++i)
         {
-            double mx_u = m_inv_K11 / fScale * u + m_inv_K13 / fScale;
-            double my_u = m_inv_K22 / fScale * v + m_inv_K23 / fScale;
+            double mx2_u = mx_u * mx_u;
+            double my2_u = my_u * my_u;
+            double mxy_u = mx_u * my_u;
+            double rho2_u = mx2_u + my2_u;
+            double rad_dist_u = k1 * rho2_u + k2 * rho2_u * rho2_u;
+            double mx_n = mx_d - (mx_u * rad_dist_u + 2.0 * p1 * mxy_u + p2 * (rho2_u + 2.0 * mx2_u));
+            double my_n = my_d - (my_u * rad_dist_u + 2.0 * p2 * mxy_u + p1 * (rho2_u + 2.0 * my2_u));
+
+            double step2 = (mx_n - mx_u) * (mx_n - mx_u) + (my_n - my_u) * (my_n - my_u);
 
-            Eigen::Vector3d P;
-            P << mx_u, my_u, 1.0;
+            mx_u = mx_n;
+            my_u = my_n;
 
-            Eigen::Vector2d p;
-            spaceToPlane(P, p);
+            if (step2 <= tol2)
+            {
+                break;
+            }
+        }
 
-            mapX.at<float>(v,u) = p(0);
-            mapY.at<float>(v,u) = p(1);
+        if (!computeResidual)
+        {
+            return 0.0;
         }
+
+        Eigen::Vector2d d_u;
+        distortion(Eigen::Vector2d(mx_u, my_u), d_u);
+
+        return Eigen::Vector2d(mx_u + d_u(0) - mx_d, my_u + d_u(1) - my_d).norm();
     }
 
-    cv::convertMaps(mapX, mapY, map1, map2, CV_32FC1, false);
+    // Newton's method with step halving whenever the residual grows
+    double res2_prev = std::numeric_limits<double>::max();
+    double step_x = 0.0, step_y = 0.0;
+    double res2 = 0.0;
+
+    for (int i = 0; ; ++i)
+    {
+        double mx2_u = mx_u * mx_u;
+        double my2_u = my_u * my_u;
+        double mxy_u = mx_u * my_u;
+        double rho2_u = mx2_u + my2_u;
+        double rad_dist_u = k1 * rho2_u + k2 * rho2_u * rho2_u;
+        double f_x = mx_u + mx_u * rad_dist_u + 2.0 * p1 * mxy_u + p2 * (rho2_u + 2.0 * mx2_u) - mx_d;
+        double f_y = my_u + my_u * rad_dist_u + 2.0 * p2 * mxy_u + p1 * (rho2_u + 2.0 * my2_u) - my_d;
+
+        res2 = f_x * f_x + f_y * f_y;
+
+        if (res2 <= tol2 || i >= m_undistortMaxIterations)
+        {
+            break;
+        }
+
+        if (res2 > res2_prev)
+        {
+            // Overshot: retreat halfway along the previous step
+            step_x *= 0.5;
+            step_y *= 0.5;
+            mx_u += step_x;
+            my_u += step_y;
+            continue;
+        }
+
+        // Jacobian of p_u + d_u(p_u), see distortion()
+        double dxdmx = 1.0 + rad_dist_u + k1 * 2.0 * mx2_u + k2 * rho2_u * 4.0 * mx2_u + 2.0 * p1 * my_u + 6.0 * p2 * mx_u;
+        double dydmx = k1 * 2.0 * mxy_u + k2 * 4.0 * rho2_u * mxy_u + p1 * 2.0 * mx_u + 2.0 * p2 * my_u;
+        double dxdmy = dydmx;
+        double dydmy = 1.0 + rad_dist_u + k1 * 2.0 * my2_u + k2 * rho2_u * 4.0 * my2_u + 6.0 * p1 * my_u + 2.0 * p2 * mx_u;
+
+        double det = dxdmx * dydmy - dxdmy * dydmx;
+        if (fabs(det) < 1e-12)
+        {
+            break;
+        }
+
+        step_x = (dydmy * f_x - dxdmy * f_y) / det;
+        step_y = (dxdmx * f_y - dydmx * f_x) / det;
+
+        mx_u -= step_x;
+        my_u -= step_y;
+        res2_prev = res2;
+    }
+
+    return sqrt(res2);
+}
+
+void
+PinholeCamera::initUndistortMap(cv::Mat& map1, cv::Mat& map2, double fScale,
+                                int m1type) const
+{
+    cv::Size imageSize(mParameters.imageWidth(), mParameters.imageHeight());
+
+    Eigen::Matrix3f K_inv;
+    K_inv << m_inv_K11 / fScale, 0, m_inv_K13 / fScale,
+             0, m_inv_K22 / fScale, m_inv_K23 / fScale,
+             0, 0, 1;
+
+    initRectifyMap(imageSize, K_inv, map1, map2, m1type);
 }
 
 cv::Mat
@@ -730,16 +1030,13 @@ PinholeCamera::initUndistortRectifyMap(cv::Mat& map1, cv::Mat& map2,
                                        float fx, float fy,
                                        cv::Size imageSize,
                                        float cx, float cy,
-                                       cv::Mat rmat) const
+                                       cv::Mat rmat, int m1type) const
 {
     if (imageSize == cv::Size(0, 0))
     {
         imageSize = cv::Size(mParameters.imageWidth(), mParameters.imageHeight());
     }
 
-    cv::Mat mapX = cv::Mat::zeros(imageSize.height, imageSize.width, CV_32F);
-    cv::Mat mapY = cv::Mat::zeros(imageSize.height, imageSize.width, CV_32F);
-
     Eigen::Matrix3f R, R_inv;
     cv::cv2eigen(rmat, R);
     R_inv = R.inverse();
@@ -768,24 +1065,10 @@ PinholeCamera::initUndistortRectifyMap(cv::Mat& map1, cv::Mat& map2,
 
     Eigen::Matrix3f K_rect_inv = K_rect.inverse();
 
-    for (int v = 0; v < imageSize.height; ++v)
-    {
-        for (int u = 0; u < imageSize.width; ++u)
-        {
-            Eigen::Vector3f xo;
-            xo << u, v, 1;
-
-            Eigen::Vector3f uo = R_inv * K_rect_inv * xo;
-
-            Eigen::Vector2d p;
-            spaceToPlane(uo.cast<double>(), p);
-
-            mapX.at<float>(v,u) = p(0);
-            mapY.at<float>(v,u) = p(1);
-        }
-    }
+    // ray of pixel (u, v) is A * (u, v, 1)
+    Eigen::Matrix3f A = R_inv * K_rect_inv;
 
-    cv::convertMaps(mapX, mapY, map1, map2, CV_32FC1, false);
+    initRectifyMap(imageSize, A, map1, map2, m1type);
 
     cv::Mat K_rect_cv;
     cv::eigen2cv(K_rect, K_rect_cv);
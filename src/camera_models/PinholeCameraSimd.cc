@@ -0,0 +1,320 @@
+#include "camera_model/camera_models/PinholeCameraSimd.h"
+
+#include <atomic>
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CAMERA_MODEL_SIMD_X86
+#define CAMERA_MODEL_ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+#define CAMERA_MODEL_ALWAYS_INLINE inline
+#endif
+
+namespace camera_model
+{
+
+#ifdef CAMERA_MODEL_SIMD_X86
+// The helpers below are always inlined, so the ABI of vector arguments
+// never crosses a call boundary.
+#pragma GCC diagnostic ignored "-Wpsabi"
+
+// GCC/Clang vector extensions: the same kernel source is compiled for each
+// instruction set by inlining it into a function with the matching target.
+typedef double v4d __attribute__((vector_size(32)));
+typedef double v8d __attribute__((vector_size(64)));
+typedef float v8f __attribute__((vector_size(32)));
+typedef float v16f __attribute__((vector_size(64)));
+#endif
+
+template <typename V, typename T>
+static CAMERA_MODEL_ALWAYS_INLINE V
+load(const T* p)
+{
+    V v;
+    std::memcpy(&v, p, sizeof(V));
+    return v;
+}
+
+template <typename V, typename T>
+static CAMERA_MODEL_ALWAYS_INLINE void
+store(T* p, const V& v)
+{
+    std::memcpy(p, &v, sizeof(V));
+}
+
+template <typename V, typename T>
+static CAMERA_MODEL_ALWAYS_INLINE V
+splat(T s)
+{
+    return V() + s;
+}
+
+/**
+ * \brief Distortion of one lane group, see PinholeCamera::distortion()
+ */
+template <typename V>
+static CAMERA_MODEL_ALWAYS_INLINE void
+distortionCore(const V& mx, const V& my,
+               const V& k1, const V& k2, const V& p1, const V& p2,
+               V& dx, V& dy)
+{
+    V mx2 = mx * mx;
+    V my2 = my * my;
+    V mxy = mx * my;
+    V rho2 = mx2 + my2;
+    V rad_dist = (k1 + k2 * rho2) * rho2;
+
+    dx = mx * rad_dist + (p1 + p1) * mxy + p2 * (rho2 + mx2 + mx2);
+    dy = my * rad_dist + (p2 + p2) * mxy + p1 * (rho2 + my2 + my2);
+}
+
+template <typename V, typename T>
+static CAMERA_MODEL_ALWAYS_INLINE void
+distortionKernel(const T* params,
+                 const T* mx, const T* my,
+                 T* dx, T* dy, size_t count)
+{
+    const size_t width = sizeof(V) / sizeof(T);
+
+    const V k1 = splat<V>(params[0]);
+    const V k2 = splat<V>(params[1]);
+    const V p1 = splat<V>(params[2]);
+    const V p2 = splat<V>(params[3]);
+
+    size_t i = 0;
+    for (; i + width <= count; i += width)
+    {
+        V dx_v, dy_v;
+        distortionCore(load<V>(mx + i), load<V>(my + i), k1, k2, p1, p2, dx_v, dy_v);
+
+        store(dx + i, dx_v);
+        store(dy + i, dy_v);
+    }
+
+    for (; i < count; ++i)
+    {
+        distortionCore(mx[i], my[i], params[0], params[1], params[2], params[3],
+                       dx[i], dy[i]);
+    }
+}
+
+template <typename V, typename T>
+static CAMERA_MODEL_ALWAYS_INLINE void
+spaceToPlaneKernel(const T* params,
+                   const T* x, const T* y, const T* z,
+                   T* u, T* v, size_t count)
+{
+    const size_t width = sizeof(V) / sizeof(T);
+
+    const V k1 = splat<V>(params[0]);
+    const V k2 = splat<V>(params[1]);
+    const V p1 = splat<V>(params[2]);
+    const V p2 = splat<V>(params[3]);
+    const V fx = splat<V>(params[4]);
+    const V fy = splat<V>(params[5]);
+    const V cx = splat<V>(params[6]);
+    const V cy = splat<V>(params[7]);
+
+    size_t i = 0;
+    for (; i + width <= count; i += width)
+    {
+        // Project points to the normalised plane
+        V z_v = load<V>(z + i);
+        V mx = load<V>(x + i) / z_v;
+        V my = load<V>(y + i) / z_v;
+
+        // Apply distortion
+        V dx, dy;
+        distortionCore(mx, my, k1, k2, p1, p2, dx, dy);
+
+        // Apply generalised projection matrix
+        store(u + i, fx * (mx + dx) + cx);
+        store(v + i, fy * (my + dy) + cy);
+    }
+
+    for (; i < count; ++i)
+    {
+        T mx = x[i] / z[i];
+        T my = y[i] / z[i];
+
+        T dx, dy;
+        distortionCore(mx, my, params[0], params[1], params[2], params[3], dx, dy);
+
+        u[i] = params[4] * (mx + dx) + params[6];
+        v[i] = params[5] * (my + dy) + params[7];
+    }
+}
+
+#ifdef CAMERA_MODEL_SIMD_X86
+__attribute__((target("avx2,fma"))) static void
+spaceToPlaneAvx2(const double* params, const double* x, const double* y, const double* z,
+                 double* u, double* v, size_t count)
+{
+    spaceToPlaneKernel<v4d>(params, x, y, z, u, v, count);
+}
+
+__attribute__((target("avx2,fma"))) static void
+spaceToPlaneAvx2(const float* params, const float* x, const float* y, const float* z,
+                 float* u, float* v, size_t count)
+{
+    spaceToPlaneKernel<v8f>(params, x, y, z, u, v, count);
+}
+
+__attribute__((target("avx512f"))) static void
+spaceToPlaneAvx512(const double* params, const double* x, const double* y, const double* z,
+                   double* u, double* v, size_t count)
+{
+    spaceToPlaneKernel<v8d>(params, x, y, z, u, v, count);
+}
+
+__attribute__((target("avx512f"))) static void
+spaceToPlaneAvx512(const float* params, const float* x, const float* y, const float* z,
+                   float* u, float* v, size_t count)
+{
+    spaceToPlaneKernel<v16f>(params, x, y, z, u, v, count);
+}
+
+__attribute__((target("avx2,fma"))) static void
+distortionAvx2(const double* params, const double* mx, const double* my,
+               double* dx, double* dy, size_t count)
+{
+    distortionKernel<v4d>(params, mx, my, dx, dy, count);
+}
+
+__attribute__((target("avx2,fma"))) static void
+distortionAvx2(const float* params, const float* mx, const float* my,
+               float* dx, float* dy, size_t count)
+{
+    distortionKernel<v8f>(params, mx, my, dx, dy, count);
+}
+
+__attribute__((target("avx512f"))) static void
+distortionAvx512(const double* params, const double* mx, const double* my,
+                 double* dx, double* dy, size_t count)
+{
+    distortionKernel<v8d>(params, mx, my, dx, dy, count);
+}
+
+__attribute__((target("avx512f"))) static void
+distortionAvx512(const float* params, const float* mx, const float* my,
+                 float* dx, float* dy, size_t count)
+{
+    distortionKernel<v16f>(params, mx, my, dx, dy, count);
+}
+#endif
+
+static PinholeSimdIsa
+detectPinholeSimdIsa(void)
+{
+#ifdef CAMERA_MODEL_SIMD_X86
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx512f"))
+    {
+        return PINHOLE_SIMD_AVX512;
+    }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    {
+        return PINHOLE_SIMD_AVX2;
+    }
+#endif
+    return PINHOLE_SIMD_SCALAR;
+}
+
+// Read by every projecting thread while setPinholeSimdIsa() may change it
+static std::atomic<int>&
+activePinholeSimdIsa(void)
+{
+    static std::atomic<int> isa(detectPinholeSimdIsa());
+    return isa;
+}
+
+PinholeSimdIsa
+pinholeSimdIsa(void)
+{
+    return static_cast<PinholeSimdIsa>(activePinholeSimdIsa().load(std::memory_order_relaxed));
+}
+
+void
+setPinholeSimdIsa(PinholeSimdIsa isa)
+{
+    PinholeSimdIsa best = detectPinholeSimdIsa();
+
+    activePinholeSimdIsa().store((isa < best) ? isa : best, std::memory_order_relaxed);
+}
+
+template <typename T>
+static void
+pinholeSpaceToPlaneDispatch(const T* params,
+                            const T* x, const T* y, const T* z,
+                            T* u, T* v, size_t count)
+{
+    switch (pinholeSimdIsa())
+    {
+#ifdef CAMERA_MODEL_SIMD_X86
+    case PINHOLE_SIMD_AVX512:
+        spaceToPlaneAvx512(params, x, y, z, u, v, count);
+        break;
+    case PINHOLE_SIMD_AVX2:
+        spaceToPlaneAvx2(params, x, y, z, u, v, count);
+        break;
+#endif
+    default:
+        spaceToPlaneKernel<T>(params, x, y, z, u, v, count);
+    }
+}
+
+template <typename T>
+static void
+pinholeDistortionDispatch(const T* params,
+                          const T* mx, const T* my,
+                          T* dx, T* dy, size_t count)
+{
+    switch (pinholeSimdIsa())
+    {
+#ifdef CAMERA_MODEL_SIMD_X86
+    case PINHOLE_SIMD_AVX512:
+        distortionAvx512(params, mx, my, dx, dy, count);
+        break;
+    case PINHOLE_SIMD_AVX2:
+        distortionAvx2(params, mx, my, dx, dy, count);
+        break;
+#endif
+    default:
+        distortionKernel<T>(params, mx, my, dx, dy, count);
+    }
+}
+
+void
+pinholeSpaceToPlaneSimd(const double* params,
+                        const double* x, const double* y, const double* z,
+                        double* u, double* v, size_t count)
+{
+    pinholeSpaceToPlaneDispatch(params, x, y, z, u, v, count);
+}
+
+void
+pinholeSpaceToPlaneSimd(const float* params,
+                        const float* x, const float* y, const float* z,
+                        float* u, float* v, size_t count)
+{
+    pinholeSpaceToPlaneDispatch(params, x, y, z, u, v, count);
+}
+
+void
+pinholeDistortionSimd(const double* params,
+                      const double* mx, const double* my,
+                      double* dx, double* dy, size_t count)
+{
+    pinholeDistortionDispatch(params, mx, my, dx, dy, count);
+}
+
+void
+pinholeDistortionSimd(const float* params,
+                      const float* mx, const float* my,
+                      float* dx, float* dy, size_t count)
+{
+    pinholeDistortionDispatch(params, mx, my, dx, dy, count);
+}
+
+}
@@ -187,7 +187,7 @@ namespace camera_model
     }
 
     OCAMCamera::OCAMCamera()
-        : m_inv_scale(0.0)
+        : m_inv_scale(0.0), m_poly_terms(0), m_inv_poly_terms(0)
     {
     }
 
@@ -195,6 +195,8 @@ namespace camera_model
         : mParameters(params)
     {
         m_inv_scale = 1.0 / (params.C() - params.D() * params.E());
+
+        updatePolyTerms();
     }
 
     Camera::ModelType
@@ -632,14 +634,7 @@ namespace camera_model
             m_inv_scale * (-mParameters.E() * xc[0] + mParameters.C() * xc[1]));
 
         double phi = std::sqrt(xc_a[0] * xc_a[0] + xc_a[1] * xc_a[1]);
-        double phi_i = 1.0;
-        double z = 0.0;
-
-        for (int i = 0; i < SCARAMUZZA_POLY_SIZE; i++)
-        {
-            z += phi_i * mParameters.poly(i);
-            phi_i *= phi;
-        }
+        double z = evalPoly(&mParameters.poly(0), m_poly_terms, phi);
 
         P << xc[0], xc[1], -z;
     }
@@ -655,14 +650,7 @@ namespace camera_model
     {
         double norm = std::sqrt(P[0] * P[0] + P[1] * P[1]);
         double theta = std::atan2(-P[2], norm);
-        double rho = 0.0;
-        double theta_i = 1.0;
-
-        for (int i = 0; i < SCARAMUZZA_INV_POLY_SIZE; i++)
-        {
-            rho += theta_i * mParameters.inv_poly(i);
-            theta_i *= theta;
-        }
+        double rho = evalPoly(&mParameters.inv_poly(0), m_inv_poly_terms, theta);
 
         double invNorm = 1.0 / norm;
         Eigen::Vector2d xn(
@@ -673,6 +661,311 @@ namespace camera_model
             xn[0] * mParameters.E() + xn[1] + mParameters.center_y();
     }
 
+    /**
+ * \brief Project a 3D point to the image plane and calculate Jacobian
+ *
+ * \param P 3D point coordinates
+ * \param p return value, contains the image point coordinates
+ * \param J return value, jacobian of p w.r.t. P
+ */
+    void
+    OCAMCamera::spaceToPlane(const Eigen::Vector3d &P, Eigen::Vector2d &p,
+                             Eigen::Matrix<double, 2, 3> &J) const
+    {
+        double norm = std::sqrt(P[0] * P[0] + P[1] * P[1]);
+        double theta = std::atan2(-P[2], norm);
+
+        // evaluate the inverse polynomial and its derivative together
+        const double *inv_poly = &mParameters.inv_poly(0);
+        double rho = 0.0;
+        double drho = 0.0;
+        for (int i = m_inv_poly_terms - 1; i >= 0; --i)
+        {
+            drho = drho * theta + rho;
+            rho = rho * theta + inv_poly[i];
+        }
+
+        double invNorm = 1.0 / norm;
+        double cos_phi = P[0] * invNorm;
+        double sin_phi = P[1] * invNorm;
+
+        Eigen::Vector2d xn(cos_phi * rho, sin_phi * rho);
+
+        // d(theta)/dP = (z * cos(phi), z * sin(phi), -norm) / |P|^2
+        double invNorm2 = 1.0 / (norm * norm + P[2] * P[2]);
+        Eigen::RowVector3d dtheta(P[2] * cos_phi * invNorm2,
+                                  P[2] * sin_phi * invNorm2,
+                                  -norm * invNorm2);
+
+        Eigen::Matrix<double, 2, 3> J_xn;
+        J_xn.row(0) = drho * cos_phi * dtheta;
+        J_xn.row(1) = drho * sin_phi * dtheta;
+
+        // change of the direction (cos(phi), sin(phi)) in the image plane
+        double rhoNorm = rho * invNorm;
+        J_xn(0, 0) += rhoNorm * sin_phi * sin_phi;
+        J_xn(0, 1) -= rhoNorm * sin_phi * cos_phi;
+        J_xn(1, 0) -= rhoNorm * sin_phi * cos_phi;
+        J_xn(1, 1) += rhoNorm * cos_phi * cos_phi;
+
+        p << xn[0] * mParameters.C() + xn[1] * mParameters.D() + mParameters.center_x(),
+            xn[0] * mParameters.E() + xn[1] + mParameters.center_y();
+
+        J << mParameters.C() * J_xn.row(0) + mParameters.D() * J_xn.row(1),
+            mParameters.E() * J_xn.row(0) + J_xn.row(1);
+    }
+
+    /**
+ * \brief Project a 3D point to the image plane and calculate Jacobians
+ *
+ * \param P 3D point coordinates
+ * \param p return value, contains the image point coordinates
+ * \param J return value, jacobian of p w.r.t. P
+ * \param J_params return value, jacobian of p w.r.t. C, D, E, center_x,
+ *        center_y, poly and inv_poly; the forward polynomial does not
+ *        take part in the projection, so its columns are zero
+ */
+    void
+    OCAMCamera::spaceToPlane(const Eigen::Vector3d &P, Eigen::Vector2d &p,
+                             Eigen::Matrix<double, 2, 3> &J,
+                             Eigen::Matrix<double, 2, Eigen::Dynamic> &J_params) const
+    {
+        spaceToPlane(P, p, J);
+
+        double norm = std::sqrt(P[0] * P[0] + P[1] * P[1]);
+        double theta = std::atan2(-P[2], norm);
+
+        double invNorm = 1.0 / norm;
+        double cos_phi = P[0] * invNorm;
+        double sin_phi = P[1] * invNorm;
+
+        // xn without the affine transformation
+        double rho = evalPoly(&mParameters.inv_poly(0), m_inv_poly_terms, theta);
+        Eigen::Vector2d xn(cos_phi * rho, sin_phi * rho);
+
+        // d(p)/d(rho)
+        Eigen::Vector2d dp_drho(mParameters.C() * cos_phi + mParameters.D() * sin_phi,
+                                mParameters.E() * cos_phi + sin_phi);
+
+        J_params.setZero(2, parameterCount());
+        J_params(0, 0) = xn[0];
+        J_params(0, 1) = xn[1];
+        J_params(1, 2) = xn[0];
+        J_params(0, 3) = 1.0;
+        J_params(1, 4) = 1.0;
+
+        double theta_i = 1.0;
+        for (int i = 0; i < SCARAMUZZA_INV_POLY_SIZE; ++i)
+        {
+            J_params.col(5 + SCARAMUZZA_POLY_SIZE + i) = theta_i * dp_drho;
+            theta_i *= theta;
+        }
+    }
+
+    /**
+ * \brief Projects a batch of 3D points to the image plane
+ *
+ * Same model as spaceToPlane(), evaluated in a single loop with the
+ * inverse polynomial copied to the stack. The polynomial order is fixed
+ * for the whole batch, so each order gets its own unrolled loop.
+ */
+    template <typename T>
+    void
+    OCAMCamera::spaceToPlaneBatchImpl(const T *x, const T *y, const T *z,
+                                      int inStride,
+                                      T *u, T *v, int outStride,
+                                      size_t count) const
+    {
+        switch (m_inv_poly_terms)
+        {
+        case 2:
+            spaceToPlaneBatchFixed<2>(x, y, z, inStride, u, v, outStride, count);
+            break;
+        case 3:
+            spaceToPlaneBatchFixed<3>(x, y, z, inStride, u, v, outStride, count);
+            break;
+        case 4:
+            spaceToPlaneBatchFixed<4>(x, y, z, inStride, u, v, outStride, count);
+            break;
+        case 5:
+            spaceToPlaneBatchFixed<5>(x, y, z, inStride, u, v, outStride, count);
+            break;
+        case 6:
+            spaceToPlaneBatchFixed<6>(x, y, z, inStride, u, v, outStride, count);
+            break;
+        case 7:
+            spaceToPlaneBatchFixed<7>(x, y, z, inStride, u, v, outStride, count);
+            break;
+        case 8:
+            spaceToPlaneBatchFixed<8>(x, y, z, inStride, u, v, outStride, count);
+            break;
+        case 9:
+            spaceToPlaneBatchFixed<9>(x, y, z, inStride, u, v, outStride, count);
+            break;
+        case 10:
+            spaceToPlaneBatchFixed<10>(x, y, z, inStride, u, v, outStride, count);
+            break;
+        case 11:
+            spaceToPlaneBatchFixed<11>(x, y, z, inStride, u, v, outStride, count);
+            break;
+        case 12:
+            spaceToPlaneBatchFixed<12>(x, y, z, inStride, u, v, outStride, count);
+            break;
+        default:
+            spaceToPlaneBatchFixed<SCARAMUZZA_INV_POLY_SIZE>(x, y, z, inStride, u, v, outStride, count);
+        }
+    }
+
+    /**
+ * \brief Batch projection for an inverse polynomial with N terms
+ */
+    template <int N, typename T>
+    void
+    OCAMCamera::spaceToPlaneBatchFixed(const T *x, const T *y, const T *z,
+                                       int inStride,
+                                       T *u, T *v, int outStride,
+                                       size_t count) const
+    {
+        T inv_poly[SCARAMUZZA_INV_POLY_SIZE];
+        for (int i = 0; i < SCARAMUZZA_INV_POLY_SIZE; i++)
+            inv_poly[i] = mParameters.inv_poly(i);
+
+        const T C = mParameters.C();
+        const T D = mParameters.D();
+        const T E = mParameters.E();
+        const T center_x = mParameters.center_x();
+        const T center_y = mParameters.center_y();
+
+        for (size_t k = 0; k < count; ++k)
+        {
+            const size_t in = k * inStride;
+            const size_t out = k * outStride;
+
+            T norm = std::sqrt(x[in] * x[in] + y[in] * y[in]);
+            T theta = std::atan2(-z[in], norm);
+            T rho = evalPolyFixed<N>(inv_poly, theta);
+
+            T scale = rho / norm;
+            T xn0 = x[in] * scale;
+            T xn1 = y[in] * scale;
+
+            u[out] = xn0 * C + xn1 * D + center_x;
+            v[out] = xn0 * E + xn1 + center_y;
+        }
+    }
+
+    /**
+ * \brief Lifts a batch of image points to their projective rays
+ */
+    template <typename T>
+    void
+    OCAMCamera::liftProjectiveBatchImpl(const T *u, const T *v, int inStride,
+                                        T *x, T *y, T *z,
+                                        int outStride, size_t count) const
+    {
+        T poly[SCARAMUZZA_POLY_SIZE];
+        for (int i = 0; i < SCARAMUZZA_POLY_SIZE; i++)
+            poly[i] = mParameters.poly(i);
+
+        const T C = mParameters.C();
+        const T D = mParameters.D();
+        const T E = mParameters.E();
+        const T center_x = mParameters.center_x();
+        const T center_y = mParameters.center_y();
+        const T inv_scale = m_inv_scale;
+
+        for (size_t k = 0; k < count; ++k)
+        {
+            const size_t in = k * inStride;
+            const size_t out = k * outStride;
+
+            // Relative to Center
+            T xc0 = u[in] - center_x;
+            T xc1 = v[in] - center_y;
+
+            // Affine Transformation
+            T xc_a0 = inv_scale * (xc0 - D * xc1);
+            T xc_a1 = inv_scale * (-E * xc0 + C * xc1);
+
+            T phi = std::sqrt(xc_a0 * xc_a0 + xc_a1 * xc_a1);
+            T zp = evalPolyFixed<SCARAMUZZA_POLY_SIZE>(poly, phi);
+
+            x[out] = xc0;
+            y[out] = xc1;
+            z[out] = -zp;
+        }
+    }
+
+    template <typename T>
+    void
+    OCAMCamera::liftSphereBatchImpl(const T *u, const T *v, int inStride,
+                                    T *x, T *y, T *z,
+                                    int outStride, size_t count) const
+    {
+        liftProjectiveBatchImpl(u, v, inStride, x, y, z, outStride, count);
+
+        for (size_t k = 0; k < count; ++k)
+        {
+            const size_t out = k * outStride;
+
+            T inv_norm = T(1.0) / std::sqrt(x[out] * x[out] + y[out] * y[out] + z[out] * z[out]);
+
+            x[out] *= inv_norm;
+            y[out] *= inv_norm;
+            z[out] *= inv_norm;
+        }
+    }
+
+    void
+    OCAMCamera::spaceToPlaneBatch(const double *x, const double *y, const double *z,
+                                  int inStride,
+                                  double *u, double *v, int outStride,
+                                  size_t count) const
+    {
+        spaceToPlaneBatchImpl(x, y, z, inStride, u, v, outStride, count);
+    }
+
+    void
+    OCAMCamera::liftProjectiveBatch(const double *u, const double *v, int inStride,
+                                    double *x, double *y, double *z,
+                                    int outStride, size_t count) const
+    {
+        liftProjectiveBatchImpl(u, v, inStride, x, y, z, outStride, count);
+    }
+
+    void
+    OCAMCamera::liftSphereBatch(const double *u, const double *v, int inStride,
+                                double *x, double *y, double *z,
+                                int outStride, size_t count) const
+    {
+        liftSphereBatchImpl(u, v, inStride, x, y, z, outStride, count);
+    }
+
+    void
+    OCAMCamera::spaceToPlaneBatch(const float *x, const float *y, const float *z,
+                                  int inStride,
+                                  float *u, float *v, int outStride,
+                                  size_t count) const
+    {
+        spaceToPlaneBatchImpl(x, y, z, inStride, u, v, outStride, count);
+    }
+
+    void
+    OCAMCamera::liftProjectiveBatch(const float *u, const float *v, int inStride,
+                                    float *x, float *y, float *z,
+                                    int outStride, size_t count) const
+    {
+        liftProjectiveBatchImpl(u, v, inStride, x, y, z, outStride, count);
+    }
+
+    void
+    OCAMCamera::liftSphereBatch(const float *u, const float *v, int inStride,
+                                float *x, float *y, float *z,
+                                int outStride, size_t count) const
+    {
+        liftSphereBatchImpl(u, v, inStride, x, y, z, outStride, count);
+    }
+
     /** 
  * \brief Projects an undistorted 2D point p_u to the image plane
  *
@@ -686,54 +979,46 @@ namespace camera_model
         spaceToPlane(P, p);
     }
 
-#if 0
-void
-OCAMCamera::initUndistortMap(cv::Mat& map1, cv::Mat& map2, double fScale) const
-{
-    cv::Size imageSize(mParameters.imageWidth(), mParameters.imageHeight());
-
-    cv::Mat mapX = cv::Mat::zeros(imageSize, CV_32F);
-    cv::Mat mapY = cv::Mat::zeros(imageSize, CV_32F);
-
-    for (int v = 0; v < imageSize.height; ++v)
+    /**
+ * \brief Generates the maps of a virtual pinhole camera centred on the
+ *        principal point
+ *
+ * The focal length of the virtual camera is |poly[0]| * fScale, which
+ * preserves the scale of the image around its centre for fScale = 1.
+ */
+    void
+    OCAMCamera::initUndistortMap(cv::Mat &map1, cv::Mat &map2, double fScale,
+                                 int m1type) const
     {
-        for (int u = 0; u < imageSize.width; ++u)
-        {
-            double mx_u = m_inv_K11 / fScale * u + m_inv_K13 / fScale;
-            double my_u = m_inv_K22 / fScale * v + m_inv_K23 / fScale;
-
-            double xi = mParameters.xi();
-            double d2 = mx_u * mx_u + my_u * my_u;
+        cv::Size imageSize(mParameters.imageWidth(), mParameters.imageHeight());
 
-            Eigen::Vector3d P;
-            P << mx_u, my_u, 1.0 - xi * (d2 + 1.0) / (xi + sqrt(1.0 + (1.0 - xi * xi) * d2));
+        float f = naturalFocalLength() * fScale;
 
-            Eigen::Vector2d p;
-            spaceToPlane(P, p);
+        Eigen::Matrix3f K_inv;
+        K_inv << 1.0f / f, 0, -mParameters.center_x() / f,
+            0, 1.0f / f, -mParameters.center_y() / f,
+            0, 0, 1;
 
-            mapX.at<float>(v,u) = p(0);
-            mapY.at<float>(v,u) = p(1);
-        }
+        initRectifyMap(imageSize, K_inv, map1, map2, m1type);
     }
 
-    cv::convertMaps(mapX, mapY, map1, map2, CV_32FC1, false);
-}
-#endif
-
     cv::Mat
     OCAMCamera::initUndistortRectifyMap(cv::Mat &map1, cv::Mat &map2,
                                         float fx, float fy,
                                         cv::Size imageSize,
                                         float cx, float cy,
-                                        cv::Mat rmat) const
+                                        cv::Mat rmat, int m1type) const
     {
         if (imageSize == cv::Size(0, 0))
         {
             imageSize = cv::Size(mParameters.imageWidth(), mParameters.imageHeight());
         }
 
-        cv::Mat mapX = cv::Mat::zeros(imageSize.height, imageSize.width, CV_32F);
-        cv::Mat mapY = cv::Mat::zeros(imageSize.height, imageSize.width, CV_32F);
+        // the natural focal length keeps the scale of the image centre
+        if (fx < 0 || fy < 0)
+        {
+            fx = fy = naturalFocalLength();
+        }
 
         Eigen::Matrix3f K_rect;
 
@@ -741,41 +1026,35 @@ OCAMCamera::initUndistortMap(cv::Mat& map1, cv::Mat& map2, double fScale) const
             0, fy, cy < 0 ? imageSize.height / 2 : cy,
             0, 0, 1;
 
-        if (fx < 0 || fy < 0)
-        {
-            throw std::string(std::string(__FUNCTION__) + ": Focal length must be specified");
-        }
-
         Eigen::Matrix3f K_rect_inv = K_rect.inverse();
 
         Eigen::Matrix3f R, R_inv;
         cv::cv2eigen(rmat, R);
         R_inv = R.inverse();
 
-        for (int v = 0; v < imageSize.height; ++v)
-        {
-            for (int u = 0; u < imageSize.width; ++u)
-            {
-                Eigen::Vector3f xo;
-                xo << u, v, 1;
-
-                Eigen::Vector3f uo = R_inv * K_rect_inv * xo;
-
-                Eigen::Vector2d p;
-                spaceToPlane(uo.cast<double>(), p);
+        // ray of pixel (u, v) is A * (u, v, 1)
+        Eigen::Matrix3f A = R_inv * K_rect_inv;
 
-                mapX.at<float>(v, u) = p(0);
-                mapY.at<float>(v, u) = p(1);
-            }
-        }
-
-        cv::convertMaps(mapX, mapY, map1, map2, CV_32FC1, false);
+        initRectifyMap(imageSize, A, map1, map2, m1type);
 
         cv::Mat K_rect_cv;
         cv::eigen2cv(K_rect, K_rect_cv);
         return K_rect_cv;
     }
 
+    /**
+ * \brief Focal length of the pinhole camera that matches the model at the
+ *        principal point
+ *
+ * A ray at unit distance from the optical axis reaches the image |poly[0]|
+ * pixels from the centre, since z = -poly(rho) ~ -poly[0] for small rho.
+ */
+    float
+    OCAMCamera::naturalFocalLength(void) const
+    {
+        return std::fabs(mParameters.poly(0));
+    }
+
     int
     OCAMCamera::parameterCount(void) const
     {
@@ -794,6 +1073,23 @@ OCAMCamera::initUndistortMap(cv::Mat& map1, cv::Mat& map2, double fScale) const
         mParameters = parameters;
 
         m_inv_scale = 1.0 / (parameters.C() - parameters.D() * parameters.E());
+
+        updatePolyTerms();
+    }
+
+    /**
+ * \brief Detects the effective orders of the forward and inverse polynomials
+ *
+ * estimateIntrinsics() fits far fewer inverse polynomial terms than
+ * SCARAMUZZA_INV_POLY_SIZE; trailing zero coefficients are skipped when
+ * projecting and lifting in double and float. The templated cost function
+ * path still evaluates every coefficient so that all of them are optimized.
+ */
+    void
+    OCAMCamera::updatePolyTerms(void)
+    {
+        m_poly_terms = polyTerms(&mParameters.poly(0), SCARAMUZZA_POLY_SIZE);
+        m_inv_poly_terms = polyTerms(&mParameters.inv_poly(0), SCARAMUZZA_INV_POLY_SIZE);
     }
 
     void
@@ -0,0 +1,419 @@
+#include "camera_model/camera_models/TiledRectifyMap.h"
+
+#include <algorithm>
+#include <exception>
+#include <opencv2/core/utility.hpp>
+
+namespace camera_model
+{
+
+TiledRectifyMap::TiledRectifyMap(const CameraConstPtr& camera,
+                                 const cv::Mat& K_rect,
+                                 cv::Size imageSize,
+                                 cv::Mat rmat,
+                                 cv::Size tileSize,
+                                 size_t memoryBudget,
+                                 int m1type)
+ : m_camera(camera)
+ , m_K_rect(K_rect.clone())
+ , m_rmat(rmat.clone())
+ , m_imageSize(imageSize)
+ , m_tileSize(std::max(tileSize.width, 1), std::max(tileSize.height, 1))
+ , m_m1type(m1type)
+ , m_numThreads(0)
+ , m_residentBytes(0)
+ , m_memoryBudget(memoryBudget)
+ , m_stop(false)
+{
+    if (m_imageSize == cv::Size(0, 0))
+    {
+        m_imageSize = cv::Size(m_camera->imageWidth(), m_camera->imageHeight());
+    }
+
+    m_tileCols = (m_imageSize.width + m_tileSize.width - 1) / m_tileSize.width;
+    m_tileRows = (m_imageSize.height + m_tileSize.height - 1) / m_tileSize.height;
+
+    m_tiles.resize(m_tileCols * m_tileRows);
+    for (size_t i = 0; i < m_tiles.size(); ++i)
+    {
+        m_tiles.at(i).pending = false;
+        m_tiles.at(i).lruPosition = m_lru.end();
+    }
+}
+
+TiledRectifyMap::~TiledRectifyMap()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_prefetchWake.notify_all();
+
+    if (m_prefetchThread.joinable())
+    {
+        m_prefetchThread.join();
+    }
+}
+
+const cv::Size&
+TiledRectifyMap::imageSize(void) const
+{
+    return m_imageSize;
+}
+
+const cv::Size&
+TiledRectifyMap::tileSize(void) const
+{
+    return m_tileSize;
+}
+
+int
+TiledRectifyMap::tileCols(void) const
+{
+    return m_tileCols;
+}
+
+int
+TiledRectifyMap::tileRows(void) const
+{
+    return m_tileRows;
+}
+
+void
+TiledRectifyMap::setMemoryBudget(size_t memoryBudget)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    m_memoryBudget = memoryBudget;
+    evict(-1);
+}
+
+size_t
+TiledRectifyMap::memoryBudget(void) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    return m_memoryBudget;
+}
+
+size_t
+TiledRectifyMap::residentBytes(void) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    return m_residentBytes;
+}
+
+size_t
+TiledRectifyMap::residentTiles(void) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    return m_lru.size();
+}
+
+void
+TiledRectifyMap::setNumThreads(int numThreads)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    m_numThreads = numThreads;
+}
+
+int
+TiledRectifyMap::numThreads(void) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    return m_numThreads;
+}
+
+void
+TiledRectifyMap::remap(const cv::Mat& src, cv::Mat& dst, const cv::Rect& roi,
+                       int interpolation, int borderMode)
+{
+    dst.create(roi.size(), src.type());
+
+    std::vector<int> tiles = tilesOf(roi);
+
+    // A tile that fails to generate is reported to the caller once all
+    // stripes are done, instead of escaping from a worker thread.
+    std::exception_ptr error;
+    std::mutex errorMutex;
+
+    // The stripes run on the persistent thread pool of cv::parallel_for_(),
+    // which executes the cv::remap() calls nested in them serially.
+    // cv::remap() writes straight into the views of dst since they already
+    // have the right size and type.
+    auto remapTiles = [&](const cv::Range& range)
+    {
+        try
+        {
+            for (int i = range.start; i < range.end; ++i)
+            {
+                boost::shared_ptr<const Tile> tile = acquire(tiles.at(i));
+
+                cv::Rect part = tile->rect & roi;
+                cv::Rect inTile(part.x - tile->rect.x, part.y - tile->rect.y,
+                                part.width, part.height);
+
+                cv::Mat dstPart = dst(cv::Rect(part.x - roi.x, part.y - roi.y,
+                                               part.width, part.height));
+                cv::remap(src, dstPart, tile->map1(inTile),
+                          tile->map2.empty() ? cv::Mat() : tile->map2(inTile),
+                          interpolation, borderMode);
+            }
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(errorMutex);
+            if (!error)
+            {
+                error = std::current_exception();
+            }
+        }
+    };
+
+    int stripes = numThreads();
+    cv::parallel_for_(cv::Range(0, static_cast<int>(tiles.size())), remapTiles,
+                      stripes > 0 ? stripes : -1);
+
+    if (error)
+    {
+        std::rethrow_exception(error);
+    }
+}
+
+void
+TiledRectifyMap::getMaps(const cv::Rect& roi, cv::Mat& map1, cv::Mat& map2)
+{
+    std::vector<int> tiles = tilesOf(roi);
+    if (tiles.empty())
+    {
+        map1.release();
+        map2.release();
+        return;
+    }
+
+    for (size_t i = 0; i < tiles.size(); ++i)
+    {
+        boost::shared_ptr<const Tile> tile = acquire(tiles.at(i));
+
+        if (i == 0)
+        {
+            map1.create(roi.size(), tile->map1.type());
+            if (tile->map2.empty())
+            {
+                map2.release();
+            }
+            else
+            {
+                map2.create(roi.size(), tile->map2.type());
+            }
+        }
+
+        cv::Rect part = tile->rect & roi;
+        cv::Rect inTile(part.x - tile->rect.x, part.y - tile->rect.y,
+                        part.width, part.height);
+        cv::Rect inRoi(part.x - roi.x, part.y - roi.y, part.width, part.height);
+
+        cv::Mat map1Part = map1(inRoi);
+        tile->map1(inTile).copyTo(map1Part);
+        if (!map2.empty())
+        {
+            cv::Mat map2Part = map2(inRoi);
+            tile->map2(inTile).copyTo(map2Part);
+        }
+    }
+}
+
+void
+TiledRectifyMap::prefetch(const cv::Rect& roi)
+{
+    std::vector<int> tiles = tilesOf(roi);
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        for (size_t i = 0; i < tiles.size(); ++i)
+        {
+            const TileEntry& entry = m_tiles.at(tiles.at(i));
+            if (!entry.tile && !entry.pending)
+            {
+                m_prefetchQueue.push_back(tiles.at(i));
+            }
+        }
+
+        if (!m_prefetchThread.joinable())
+        {
+            m_prefetchThread = std::thread(&TiledRectifyMap::prefetchLoop, this);
+        }
+    }
+
+    m_prefetchWake.notify_one();
+}
+
+void
+TiledRectifyMap::clear(void)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    m_prefetchQueue.clear();
+
+    // tiles that are being generated are stored when they are done
+    for (std::list<int>::iterator it = m_lru.begin(); it != m_lru.end(); ++it)
+    {
+        m_tiles.at(*it).tile.reset();
+        m_tiles.at(*it).lruPosition = m_lru.end();
+    }
+    m_lru.clear();
+    m_residentBytes = 0;
+}
+
+boost::shared_ptr<const TiledRectifyMap::Tile>
+TiledRectifyMap::acquire(int i)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    TileEntry& entry = m_tiles.at(i);
+
+    // another thread is generating the tile
+    while (entry.pending)
+    {
+        m_tileReady.wait(lock);
+    }
+
+    if (entry.tile)
+    {
+        m_lru.splice(m_lru.begin(), m_lru, entry.lruPosition);
+        return entry.tile;
+    }
+
+    entry.pending = true;
+    lock.unlock();
+
+    int col = i % m_tileCols;
+    int row = i / m_tileCols;
+
+    boost::shared_ptr<Tile> tile(new Tile);
+    tile->rect = cv::Rect(col * m_tileSize.width, row * m_tileSize.height,
+                          std::min(m_tileSize.width, m_imageSize.width - col * m_tileSize.width),
+                          std::min(m_tileSize.height, m_imageSize.height - row * m_tileSize.height));
+
+    // Tiles are small and usually generated by the threads of remap(), so
+    // each one is generated on the calling thread only. If generation
+    // fails, waiting threads are released and retry it themselves.
+    try
+    {
+        m_camera->initUndistortRectifyMapRegion(tile->map1, tile->map2, m_K_rect,
+                                                tile->rect, m_rmat, m_m1type, 1);
+    }
+    catch (...)
+    {
+        lock.lock();
+        entry.pending = false;
+        m_tileReady.notify_all();
+        throw;
+    }
+
+    tile->bytes = tile->map1.total() * tile->map1.elemSize() +
+                  tile->map2.total() * tile->map2.elemSize();
+
+    lock.lock();
+
+    entry.tile = tile;
+    entry.pending = false;
+    m_lru.push_front(i);
+    entry.lruPosition = m_lru.begin();
+    m_residentBytes += tile->bytes;
+
+    evict(i);
+
+    m_tileReady.notify_all();
+
+    return tile;
+}
+
+void
+TiledRectifyMap::evict(int keep)
+{
+    // Evicted tiles stay alive while a caller still holds them, so the
+    // budget may be exceeded briefly by tiles that are in use.
+    while (m_residentBytes > m_memoryBudget && !m_lru.empty())
+    {
+        int i = m_lru.back();
+        if (i == keep)
+        {
+            break;
+        }
+
+        TileEntry& entry = m_tiles.at(i);
+        m_residentBytes -= entry.tile->bytes;
+        entry.tile.reset();
+        entry.lruPosition = m_lru.end();
+
+        m_lru.pop_back();
+    }
+}
+
+std::vector<int>
+TiledRectifyMap::tilesOf(const cv::Rect& roi) const
+{
+    std::vector<int> tiles;
+
+    cv::Rect r = roi & cv::Rect(0, 0, m_imageSize.width, m_imageSize.height);
+    if (r.empty())
+    {
+        return tiles;
+    }
+
+    int colBegin = r.x / m_tileSize.width;
+    int colEnd = (r.x + r.width - 1) / m_tileSize.width + 1;
+    int rowBegin = r.y / m_tileSize.height;
+    int rowEnd = (r.y + r.height - 1) / m_tileSize.height + 1;
+
+    for (int row = rowBegin; row < rowEnd; ++row)
+    {
+        for (int col = colBegin; col < colEnd; ++col)
+        {
+            tiles.push_back(row * m_tileCols + col);
+        }
+    }
+
+    return tiles;
+}
+
+void
+TiledRectifyMap::prefetchLoop(void)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    while (true)
+    {
+        while (!m_stop && m_prefetchQueue.empty())
+        {
+            m_prefetchWake.wait(lock);
+        }
+
+        if (m_stop)
+        {
+            return;
+        }
+
+        int i = m_prefetchQueue.front();
+        m_prefetchQueue.pop_front();
+
+        lock.unlock();
+        try
+        {
+            acquire(i);
+        }
+        catch (...)
+        {
+            // left to the next request of the tile, which reports the error
+        }
+        lock.lock();
+    }
+}
+
+}
@@ -0,0 +1,273 @@
+#include "camera_model/camera_models/Undistorter.h"
+
+#include <algorithm>
+#include <opencv2/core/utility.hpp>
+#include <vector>
+
+#include "camera_model/gpl/gpl.h"
+
+namespace camera_model
+{
+
+Undistorter::Undistorter(const CameraConstPtr& camera,
+                         float fx, float fy,
+                         cv::Size imageSize,
+                         float cx, float cy,
+                         cv::Mat rmat,
+                         bool cropToValidRoi)
+ : m_camera(camera)
+ , m_crop(cropToValidRoi)
+ , m_interpolation(cv::INTER_LINEAR)
+ , m_numThreads(0)
+ , m_tileSize(256, 32)
+ , m_grayscale(false)
+ , m_lastLatency(0.0)
+ , m_totalLatency(0.0)
+ , m_frameCount(0)
+{
+    m_K = m_camera->initUndistortRectifyMap(m_map1, m_map2, fx, fy, imageSize,
+                                            cx, cy, rmat, CV_16SC2);
+
+    computeValidRoi();
+
+    if (m_crop)
+    {
+        m_outputMap1 = m_map1(m_validRoi);
+        m_outputMap2 = m_map2(m_validRoi);
+
+        m_K.at<float>(0,2) -= m_validRoi.x;
+        m_K.at<float>(1,2) -= m_validRoi.y;
+    }
+    else
+    {
+        m_outputMap1 = m_map1;
+        m_outputMap2 = m_map2;
+    }
+}
+
+const CameraConstPtr&
+Undistorter::camera(void) const
+{
+    return m_camera;
+}
+
+const cv::Mat&
+Undistorter::cameraMatrix(void) const
+{
+    return m_K;
+}
+
+cv::Size
+Undistorter::outputSize(void) const
+{
+    return m_outputMap1.size();
+}
+
+const cv::Rect&
+Undistorter::validRoi(void) const
+{
+    return m_validRoi;
+}
+
+bool
+Undistorter::cropToValidRoi(void) const
+{
+    return m_crop;
+}
+
+void
+Undistorter::setInterpolation(int interpolation)
+{
+    m_interpolation = interpolation;
+}
+
+int
+Undistorter::interpolation(void) const
+{
+    return m_interpolation;
+}
+
+void
+Undistorter::setNumThreads(int numThreads)
+{
+    m_numThreads = numThreads;
+}
+
+int
+Undistorter::numThreads(void) const
+{
+    return m_numThreads;
+}
+
+void
+Undistorter::setTileSize(const cv::Size& tileSize)
+{
+    m_tileSize = cv::Size(std::max(tileSize.width, 1), std::max(tileSize.height, 1));
+}
+
+const cv::Size&
+Undistorter::tileSize(void) const
+{
+    return m_tileSize;
+}
+
+void
+Undistorter::setGrayscale(bool grayscale)
+{
+    m_grayscale = grayscale;
+}
+
+bool
+Undistorter::grayscale(void) const
+{
+    return m_grayscale;
+}
+
+double
+Undistorter::undistort(const cv::Mat& src, cv::Mat& dst)
+{
+    double startTime = timeInSeconds();
+
+    const cv::Mat* input = &src;
+    if (m_grayscale && src.channels() == 3)
+    {
+        cv::cvtColor(src, m_gray, cv::COLOR_BGR2GRAY);
+        input = &m_gray;
+    }
+
+    cv::Size outputSize = m_outputMap1.size();
+    dst.create(outputSize, input->type());
+
+    int tileCols = (outputSize.width + m_tileSize.width - 1) / m_tileSize.width;
+    int tileRows = (outputSize.height + m_tileSize.height - 1) / m_tileSize.height;
+
+    // Tiles are numbered row by row, so each stripe works on a contiguous
+    // band of the output. The stripes run on the persistent thread pool of
+    // cv::parallel_for_(), which executes the cv::remap() calls nested in
+    // them serially instead of starting more threads. cv::remap() writes
+    // straight into the tile views of dst since they already have the
+    // right size and type.
+    auto remapTiles = [&](const cv::Range& range)
+    {
+        for (int i = range.start; i < range.end; ++i)
+        {
+            int x = (i % tileCols) * m_tileSize.width;
+            int y = (i / tileCols) * m_tileSize.height;
+            cv::Rect tile(x, y,
+                          std::min(m_tileSize.width, outputSize.width - x),
+                          std::min(m_tileSize.height, outputSize.height - y));
+
+            cv::Mat dstTile = dst(tile);
+            cv::remap(*input, dstTile, m_outputMap1(tile), m_outputMap2(tile),
+                      m_interpolation, cv::BORDER_CONSTANT);
+        }
+    };
+
+    cv::parallel_for_(cv::Range(0, tileCols * tileRows), remapTiles,
+                      m_numThreads > 0 ? m_numThreads : -1);
+
+    m_lastLatency = timeInSeconds() - startTime;
+    m_totalLatency += m_lastLatency;
+    ++m_frameCount;
+
+    return m_lastLatency;
+}
+
+double
+Undistorter::lastLatency(void) const
+{
+    return m_lastLatency;
+}
+
+double
+Undistorter::meanLatency(void) const
+{
+    if (m_frameCount == 0)
+    {
+        return 0.0;
+    }
+
+    return m_totalLatency / m_frameCount;
+}
+
+size_t
+Undistorter::frameCount(void) const
+{
+    return m_frameCount;
+}
+
+void
+Undistorter::computeValidRoi(void)
+{
+    int width = m_map1.cols;
+    int height = m_map1.rows;
+    int srcWidth = m_camera->imageWidth();
+    int srcHeight = m_camera->imageHeight();
+
+    // Integral image of the invalid pixels, i.e. those whose interpolation
+    // window is not entirely inside the source image. map1 holds the
+    // integer part of each source coordinate.
+    std::vector<int> invalid((width + 1) * (height + 1), 0);
+    for (int v = 0; v < height; ++v)
+    {
+        const short* xy = m_map1.ptr<short>(v);
+        int rowSum = 0;
+        for (int u = 0; u < width; ++u)
+        {
+            int x = xy[2 * u];
+            int y = xy[2 * u + 1];
+            rowSum += (x < 0 || x > srcWidth - 2 || y < 0 || y > srcHeight - 2) ? 1 : 0;
+
+            invalid[(v + 1) * (width + 1) + u + 1] = invalid[v * (width + 1) + u + 1] + rowSum;
+        }
+    }
+
+    // number of invalid pixels in [x0, x1) x [y0, y1)
+    auto countInvalid = [&](int x0, int y0, int x1, int y1)
+    {
+        return invalid[y1 * (width + 1) + x1] - invalid[y0 * (width + 1) + x1]
+             - invalid[y1 * (width + 1) + x0] + invalid[y0 * (width + 1) + x0];
+    };
+
+    // Shrink the full view one line at a time, always moving the border
+    // with the largest fraction of invalid pixels, until no invalid pixel
+    // is left.
+    int x0 = 0, y0 = 0, x1 = width, y1 = height;
+    while (x0 < x1 && y0 < y1)
+    {
+        double w = x1 - x0;
+        double h = y1 - y0;
+
+        double top = countInvalid(x0, y0, x1, y0 + 1) / w;
+        double bottom = countInvalid(x0, y1 - 1, x1, y1) / w;
+        double left = countInvalid(x0, y0, x0 + 1, y1) / h;
+        double right = countInvalid(x1 - 1, y0, x1, y1) / h;
+
+        double worst = std::max(std::max(top, bottom), std::max(left, right));
+        if (worst == 0.0)
+        {
+            break;
+        }
+
+        if (top == worst)
+        {
+            ++y0;
+        }
+        else if (bottom == worst)
+        {
+            --y1;
+        }
+        else if (left == worst)
+        {
+            ++x0;
+        }
+        else
+        {
+            --x1;
+        }
+    }
+
+    m_validRoi = cv::Rect(x0, y0, std::max(x1 - x0, 0), std::max(y1 - y0, 0));
+}
+
+}
@@ -1,6 +1,7 @@
 #include "camera_model/gpl/gpl.h"
 
 #include <set>
+#include <thread>
 #ifdef _WIN32
 #include <winsock.h>
 #else
@@ -925,4 +926,44 @@ timestampDiff(uint64_t t1, uint64_t t2)
     }
 }
 
+void
+parallelFor(int begin, int end, int numThreads,
+            const boost::function<void (int, int)>& body)
+{
+    if (end <= begin)
+    {
+        return;
+    }
+
+    if (numThreads <= 0)
+    {
+        numThreads = std::max(static_cast<int>(std::thread::hardware_concurrency()), 1);
+    }
+    numThreads = std::min(numThreads, end - begin);
+
+    if (numThreads == 1)
+    {
+        body(begin, end);
+        return;
+    }
+
+    std::vector<std::thread> threads;
+    threads.reserve(numThreads - 1);
+
+    // block i covers [begin + n * i / numThreads, begin + n * (i + 1) / numThreads)
+    long n = end - begin;
+    for (int i = 1; i < numThreads; ++i)
+    {
+        threads.push_back(std::thread(body, begin + n * i / numThreads,
+                                      begin + n * (i + 1) / numThreads));
+    }
+
+    body(begin, begin + n / numThreads);
+
+    for (size_t i = 0; i < threads.size(); ++i)
+    {
+        threads.at(i).join();
+    }
+}
+
 }
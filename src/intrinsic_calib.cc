@@ -88,6 +88,10 @@ int main(int argc, char** argv)
     bool useOpenCV;
     bool viewResults;
     bool verbose;
+    camera_model::CalibrationSolverOptions solverOptions;
+    std::string linearSolver;
+    std::string trustRegion;
+    bool noSchurOrdering;
 
     //========= Handling Program options =========
     boost::program_options::options_description desc("Allowed options");
@@ -107,6 +111,13 @@ int main(int argc, char** argv)
         ("camera-name", boost::program_options::value<std::string>(&cameraName)->default_value("camera"), "Name of camera")
         ("opencv", boost::program_options::bool_switch(&useOpenCV)->default_value(true), "Use OpenCV to detect corners")
         ("view-results", boost::program_options::bool_switch(&viewResults)->default_value(false), "View results")
+        ("threads", boost::program_options::value<int>(&solverOptions.numThreads)->default_value(0), "Number of solver threads, 0 for all cores")
+        ("max-iterations", boost::program_options::value<int>(&solverOptions.maxNumIterations)->default_value(1000), "Maximum number of solver iterations")
+        ("linear-solver", boost::program_options::value<std::string>(&linearSolver)->default_value("sparse_schur"), "Ceres linear solver: sparse_schur | dense_schur | iterative_schur | sparse_normal_cholesky | dense_qr")
+        ("trust-region", boost::program_options::value<std::string>(&trustRegion)->default_value("levenberg_marquardt"), "Trust region strategy: levenberg_marquardt | dogleg")
+        ("no-schur-ordering", boost::program_options::bool_switch(&noSchurOrdering)->default_value(false), "Let Ceres choose the elimination ordering")
+        ("analytic-derivatives", boost::program_options::bool_switch(&solverOptions.analyticDerivatives)->default_value(false), "Use analytic instead of automatic derivatives")
+        ("per-view-residuals", boost::program_options::bool_switch(&solverOptions.perViewResiduals)->default_value(false), "Add one residual block per view instead of one per corner")
         ("verbose,v", boost::program_options::bool_switch(&verbose)->default_value(true), "Verbose output")
         ;
 
@@ -152,6 +163,18 @@ int main(int argc, char** argv)
         return 1;
     }
 
+    if (!ceres::StringToLinearSolverType(linearSolver, &solverOptions.linearSolverType))
+    {
+        std::cerr << "# ERROR: Unknown linear solver: " << linearSolver << std::endl;
+        return 1;
+    }
+    if (!ceres::StringToTrustRegionStrategyType(trustRegion, &solverOptions.trustRegionStrategyType))
+    {
+        std::cerr << "# ERROR: Unknown trust region strategy: " << trustRegion << std::endl;
+        return 1;
+    }
+    solverOptions.useSchurOrdering = !noSchurOrdering;
+
     switch (modelType)
     {
     case camera_model::Camera::KANNALA_BRANDT:
@@ -285,6 +308,7 @@ int main(int argc, char** argv)
 
     camera_model::CameraCalibration calibration(modelType, cameraName, frameSize, boardSize, squareSize);
     calibration.setVerbose(verbose);
+    calibration.setSolverOptions(solverOptions);
 
     std::vector<bool> chessboardFound(imageFilenames.size(), false);
     for (size_t i = 0; i < imageFilenames.size(); ++i)
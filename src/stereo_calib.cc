@@ -87,8 +87,13 @@ int main(int argc, char** argv)
     std::string fileExtension;
     std::string arucoParams;
     bool useOpenCV;
+    bool rectify;
     bool viewResults;
     bool verbose;
+    camera_model::CalibrationSolverOptions solverOptions;
+    std::string linearSolver;
+    std::string trustRegion;
+    bool noSchurOrdering;
 
     //========= Handling Program options =========
     boost::program_options::options_description desc("Allowed options");
@@ -110,7 +115,15 @@ int main(int argc, char** argv)
         ("camera-name-l", boost::program_options::value<std::string>(&cameraNameL)->default_value("camera_left"), "Name of left camera")
         ("camera-name-r", boost::program_options::value<std::string>(&cameraNameR)->default_value("camera_right"), "Name of right camera")
         ("opencv", boost::program_options::bool_switch(&useOpenCV)->default_value(false), "Use OpenCV to detect corners")
+        ("rectify", boost::program_options::bool_switch(&rectify)->default_value(false), "Compute and write stereo rectification maps")
         ("view-results", boost::program_options::bool_switch(&viewResults)->default_value(false), "View results")
+        ("threads", boost::program_options::value<int>(&solverOptions.numThreads)->default_value(0), "Number of solver threads, 0 for all cores")
+        ("max-iterations", boost::program_options::value<int>(&solverOptions.maxNumIterations)->default_value(1000), "Maximum number of solver iterations")
+        ("linear-solver", boost::program_options::value<std::string>(&linearSolver)->default_value("sparse_schur"), "Ceres linear solver: sparse_schur | dense_schur | iterative_schur | sparse_normal_cholesky | dense_qr")
+        ("trust-region", boost::program_options::value<std::string>(&trustRegion)->default_value("levenberg_marquardt"), "Trust region strategy: levenberg_marquardt | dogleg")
+        ("no-schur-ordering", boost::program_options::bool_switch(&noSchurOrdering)->default_value(false), "Let Ceres choose the elimination ordering")
+        ("analytic-derivatives", boost::program_options::bool_switch(&solverOptions.analyticDerivatives)->default_value(false), "Use analytic instead of automatic derivatives")
+        ("per-view-residuals", boost::program_options::bool_switch(&solverOptions.perViewResiduals)->default_value(false), "Add one residual block per view instead of one per corner")
         ("verbose,v", boost::program_options::bool_switch(&verbose)->default_value(false), "Verbose output")
         ;
 
@@ -156,6 +169,18 @@ int main(int argc, char** argv)
         return 1;
     }
 
+    if (!ceres::StringToLinearSolverType(linearSolver, &solverOptions.linearSolverType))
+    {
+        std::cerr << "# ERROR: Unknown linear solver: " << linearSolver << std::endl;
+        return 1;
+    }
+    if (!ceres::StringToTrustRegionStrategyType(trustRegion, &solverOptions.trustRegionStrategyType))
+    {
+        std::cerr << "# ERROR: Unknown trust region strategy: " << trustRegion << std::endl;
+        return 1;
+    }
+    solverOptions.useSchurOrdering = !noSchurOrdering;
+
     switch (modelType)
     {
     case camera_model::Camera::KANNALA_BRANDT:
@@ -330,6 +355,7 @@ int main(int argc, char** argv)
 
     camera_model::StereoCameraCalibration calibration(modelType, cameraNameL, cameraNameR, frameSize, boardSize, squareSize);
     calibration.setVerbose(verbose);
+    calibration.setSolverOptions(solverOptions);
 
     std::vector<bool> chessboardFoundL(imageFilenamesL.size(), false);
     std::vector<bool> chessboardFoundR(imageFilenamesR.size(), false);
@@ -501,6 +527,13 @@ int main(int argc, char** argv)
     double startTime = camera_model::timeInSeconds();
 
     calibration.calibrate();
+
+    if (rectify)
+    {
+        cv::Mat mapLeft1, mapLeft2, mapRight1, mapRight2;
+        calibration.initStereoRectifyMaps(mapLeft1, mapLeft2, mapRight1, mapRight2);
+    }
+
     calibration.writeParams(outputDir);
 
     if (verbose)
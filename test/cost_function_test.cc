@@ -0,0 +1,362 @@
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "ceres/ceres.h"
+#include "camera_model/camera_models/CataCamera.h"
+#include "camera_model/camera_models/CostFunctionFactory.h"
+#include "camera_model/camera_models/EquidistantCamera.h"
+#include "camera_model/camera_models/PinholeCamera.h"
+#include "camera_model/camera_models/ScaramuzzaCamera.h"
+
+using namespace camera_model;
+
+namespace
+{
+
+const int kTrials = 20;
+const double kTolerance = 1e-7;
+
+// central differences are accurate to about sqrt(eps) relative
+const double kNumericTolerance = 1e-5;
+const double kNumericStep = 1e-6;
+
+std::mt19937 rng(42);
+
+double
+uniform(double lo, double hi)
+{
+    return std::uniform_real_distribution<double>(lo, hi)(rng);
+}
+
+bool
+near(double a, double b, double tolerance = kTolerance)
+{
+    return std::fabs(a - b) <= tolerance * std::max(1.0, std::max(std::fabs(a), std::fabs(b)));
+}
+
+std::vector<double>
+randomIntrinsics(Camera::ModelType modelType)
+{
+    std::vector<double> params;
+
+    switch (modelType)
+    {
+    case Camera::PINHOLE:
+        // k1, k2, p1, p2, fx, fy, cx, cy
+        params = {uniform(-0.3, 0.3), uniform(-0.1, 0.1),
+                  uniform(-1e-3, 1e-3), uniform(-1e-3, 1e-3),
+                  uniform(400.0, 600.0), uniform(400.0, 600.0),
+                  uniform(300.0, 340.0), uniform(220.0, 260.0)};
+        break;
+    case Camera::MEI:
+        // xi, k1, k2, p1, p2, gamma1, gamma2, u0, v0
+        params = {uniform(0.5, 1.5),
+                  uniform(-0.3, 0.3), uniform(-0.1, 0.1),
+                  uniform(-1e-3, 1e-3), uniform(-1e-3, 1e-3),
+                  uniform(600.0, 900.0), uniform(600.0, 900.0),
+                  uniform(300.0, 340.0), uniform(220.0, 260.0)};
+        break;
+    case Camera::KANNALA_BRANDT:
+        // k2, k3, k4, k5, mu, mv, u0, v0
+        params = {uniform(-0.05, 0.05), uniform(-0.05, 0.05),
+                  uniform(-0.05, 0.05), uniform(-0.05, 0.05),
+                  uniform(300.0, 500.0), uniform(300.0, 500.0),
+                  uniform(300.0, 340.0), uniform(220.0, 260.0)};
+        break;
+    case Camera::SCARAMUZZA:
+    {
+        // C, D, E, center_x, center_y, poly, inv_poly
+        params.assign(SCARAMUZZA_CAMERA_NUM_PARAMS, 0.0);
+        params[0] = uniform(0.95, 1.05);
+        params[1] = uniform(-0.01, 0.01);
+        params[2] = uniform(-0.01, 0.01);
+        params[3] = uniform(300.0, 340.0);
+        params[4] = uniform(220.0, 260.0);
+        for (int i = 0; i < SCARAMUZZA_POLY_SIZE; ++i)
+        {
+            params[5 + i] = uniform(-1.0, 1.0);
+        }
+
+        // Leave the trailing inverse polynomial coefficients at zero, as
+        // estimateIntrinsics() does; they must still get derivatives.
+        double* inv_poly = &params[5 + SCARAMUZZA_POLY_SIZE];
+        inv_poly[0] = uniform(200.0, 300.0);
+        for (int i = 1; i < 8; ++i)
+        {
+            inv_poly[i] = uniform(-50.0, 50.0) / i;
+        }
+        break;
+    }
+    default:
+        break;
+    }
+
+    return params;
+}
+
+bool
+compare(const std::string& name, const std::string& what,
+        const double* analytic, const double* reference, int size,
+        double tolerance = kTolerance)
+{
+    bool ok = true;
+    for (int i = 0; i < size; ++i)
+    {
+        if (!near(analytic[i], reference[i], tolerance))
+        {
+            std::cerr << name << ": " << what << "[" << i << "] analytic "
+                      << analytic[i] << " != reference " << reference[i] << std::endl;
+            ok = false;
+        }
+    }
+
+    return ok;
+}
+
+bool
+testModel(const std::string& name, const CameraPtr& camera)
+{
+    bool ok = true;
+
+    for (int trial = 0; trial < kTrials; ++trial)
+    {
+        std::vector<double> intrinsics = randomIntrinsics(camera->modelType());
+        camera->readParameters(intrinsics);
+
+        Eigen::Quaterniond q_eigen(Eigen::AngleAxisd(uniform(0.0, 0.3),
+                                                     Eigen::Vector3d(uniform(-1.0, 1.0),
+                                                                     uniform(-1.0, 1.0),
+                                                                     uniform(-1.0, 1.0)).normalized()));
+        double q[4] = {q_eigen.x(), q_eigen.y(), q_eigen.z(), q_eigen.w()};
+        double t[3] = {uniform(-0.2, 0.2), uniform(-0.2, 0.2), uniform(1.0, 2.0)};
+
+        Eigen::Vector3d observed_P(uniform(-0.5, 0.5), uniform(-0.5, 0.5), 0.0);
+        Eigen::Vector2d observed_p(uniform(200.0, 440.0), uniform(140.0, 340.0));
+
+        Eigen::Matrix2d sqrtPrecisionMat;
+        sqrtPrecisionMat << uniform(0.5, 2.0), uniform(-0.2, 0.2),
+                            0.0, uniform(0.5, 2.0);
+
+        ceres::CostFunction* autodiffCost =
+            CostFunctionFactory::instance()->generateCostFunction(camera, observed_P, observed_p,
+                                                                  sqrtPrecisionMat,
+                                                                  CAMERA_INTRINSICS | CAMERA_POSE);
+        ceres::CostFunction* analyticCost =
+            CostFunctionFactory::instance()->generateCostFunction(camera, observed_P, observed_p,
+                                                                  sqrtPrecisionMat,
+                                                                  CAMERA_INTRINSICS | CAMERA_POSE |
+                                                                  ANALYTIC_DERIVATIVES);
+
+        const int n = camera->parameterCount();
+        const double* parameters[3] = {intrinsics.data(), q, t};
+
+        double residuals[2][2];
+        std::vector<double> J_intrinsics[2], J_q[2], J_t[2];
+        for (int k = 0; k < 2; ++k)
+        {
+            J_intrinsics[k].resize(2 * n);
+            J_q[k].resize(2 * 4);
+            J_t[k].resize(2 * 3);
+        }
+
+        double* jacobians[2][3] = {{J_intrinsics[0].data(), J_q[0].data(), J_t[0].data()},
+                                   {J_intrinsics[1].data(), J_q[1].data(), J_t[1].data()}};
+
+        if (!analyticCost->Evaluate(parameters, residuals[0], jacobians[0]) ||
+            !autodiffCost->Evaluate(parameters, residuals[1], jacobians[1]))
+        {
+            std::cerr << name << ": evaluation failed" << std::endl;
+            ok = false;
+        }
+        else
+        {
+            ok &= compare(name, "residual", residuals[0], residuals[1], 2);
+            ok &= compare(name, "J_intrinsics", J_intrinsics[0].data(), J_intrinsics[1].data(), 2 * n);
+            ok &= compare(name, "J_q", J_q[0].data(), J_q[1].data(), 2 * 4);
+            ok &= compare(name, "J_t", J_t[0].data(), J_t[1].data(), 2 * 3);
+        }
+
+        delete autodiffCost;
+        delete analyticCost;
+    }
+
+    return ok;
+}
+
+/**
+ * \brief Checks the per-view residual block under a Cauchy loss
+ *
+ * The residuals must carry the robust cost of the corners, 0.5 * |r|^2 =
+ * sum 0.5 * rho(s_i), and the analytic Jacobians must match central
+ * differences. One corner is observed almost exactly so that its s falls
+ * below the series threshold of ViewReprojectionError.
+ */
+bool
+testView(const std::string& name, const CameraPtr& camera)
+{
+    bool ok = true;
+
+    const ceres::CauchyLoss lossFunction(1.0);
+
+    for (int trial = 0; trial < kTrials; ++trial)
+    {
+        std::vector<double> intrinsics = randomIntrinsics(camera->modelType());
+        camera->readParameters(intrinsics);
+
+        Eigen::Quaterniond q_eigen(Eigen::AngleAxisd(uniform(0.0, 0.3),
+                                                     Eigen::Vector3d(uniform(-1.0, 1.0),
+                                                                     uniform(-1.0, 1.0),
+                                                                     uniform(-1.0, 1.0)).normalized()));
+        double q[4] = {q_eigen.x(), q_eigen.y(), q_eigen.z(), q_eigen.w()};
+        double t[3] = {uniform(-0.2, 0.2), uniform(-0.2, 0.2), uniform(1.0, 2.0)};
+
+        // 5 x 4 corner target; corner 0 gets a subpixel-exact observation
+        std::vector<cv::Point3f> observed_P;
+        std::vector<cv::Point2f> observed_p;
+        for (int r = 0; r < 4; ++r)
+        {
+            for (int c = 0; c < 5; ++c)
+            {
+                cv::Point3f P(0.1f * (c - 2), 0.1f * (r - 1.5f), 0.0f);
+
+                Eigen::Vector3d P_c = q_eigen * Eigen::Vector3d(P.x, P.y, P.z)
+                                      + Eigen::Vector3d(t[0], t[1], t[2]);
+                Eigen::Vector2d p;
+                camera->spaceToPlane(P_c, p);
+
+                double noise = observed_P.empty() ? 1e-4 : 3.0;
+                p += Eigen::Vector2d(uniform(-noise, noise), uniform(-noise, noise));
+
+                observed_P.push_back(P);
+                observed_p.push_back(cv::Point2f(p(0), p(1)));
+            }
+        }
+
+        ceres::CostFunction* costFunction =
+            CostFunctionFactory::instance()->generateCostFunction(camera, observed_P, observed_p,
+                                                                  &lossFunction,
+                                                                  CAMERA_INTRINSICS | CAMERA_POSE);
+
+        const int n = camera->parameterCount();
+        const int m = costFunction->num_residuals();
+        const int blockSizes[3] = {n, 4, 3};
+        double* parameters[3] = {intrinsics.data(), q, t};
+
+        std::vector<double> residuals(m);
+        std::vector<double> J[3];
+        for (int k = 0; k < 3; ++k)
+        {
+            J[k].resize(m * blockSizes[k]);
+        }
+        double* jacobians[3] = {J[0].data(), J[1].data(), J[2].data()};
+
+        if (!costFunction->Evaluate(parameters, residuals.data(), jacobians))
+        {
+            std::cerr << name << ": view evaluation failed" << std::endl;
+            delete costFunction;
+            ok = false;
+            continue;
+        }
+
+        // expected residuals sqrt(rho(s) / s) * e and robust cost
+        std::vector<double> expected(m);
+        double cost = 0.0;
+        double robustCost = 0.0;
+        double minS = std::numeric_limits<double>::max();
+        for (size_t i = 0; i < observed_p.size(); ++i)
+        {
+            const cv::Point3f& P = observed_P.at(i);
+            Eigen::Vector3d P_c = q_eigen * Eigen::Vector3d(P.x, P.y, P.z)
+                                  + Eigen::Vector3d(t[0], t[1], t[2]);
+            Eigen::Vector2d p;
+            camera->spaceToPlane(P_c, p);
+
+            Eigen::Vector2d e = p - Eigen::Vector2d(observed_p.at(i).x, observed_p.at(i).y);
+            double s = e.squaredNorm();
+            double rho[3];
+            lossFunction.Evaluate(s, rho);
+
+            double w = s > 0.0 ? std::sqrt(rho[0] / s) : std::sqrt(rho[1]);
+            expected[2 * i] = w * e(0);
+            expected[2 * i + 1] = w * e(1);
+
+            cost += 0.5 * (residuals[2 * i] * residuals[2 * i] +
+                           residuals[2 * i + 1] * residuals[2 * i + 1]);
+            robustCost += 0.5 * rho[0];
+            minS = std::min(minS, s);
+        }
+
+        if (minS >= 1e-6)
+        {
+            std::cerr << name << ": no corner with s < 1e-6, smallest s is " << minS << std::endl;
+            ok = false;
+        }
+
+        ok &= compare(name, "view residual", residuals.data(), expected.data(), m);
+        ok &= compare(name, "view cost", &cost, &robustCost, 1);
+
+        // central differences of the residuals, column by column
+        const char* blockNames[3] = {"view J_intrinsics", "view J_q", "view J_t"};
+        for (int k = 0; k < 3; ++k)
+        {
+            std::vector<double> J_numeric(m * blockSizes[k]);
+            std::vector<double> r_plus(m), r_minus(m);
+
+            for (int j = 0; j < blockSizes[k]; ++j)
+            {
+                double x = parameters[k][j];
+                double h = kNumericStep * std::max(1.0, std::fabs(x));
+
+                parameters[k][j] = x + h;
+                costFunction->Evaluate(parameters, r_plus.data(), 0);
+                parameters[k][j] = x - h;
+                costFunction->Evaluate(parameters, r_minus.data(), 0);
+                parameters[k][j] = x;
+
+                for (int i = 0; i < m; ++i)
+                {
+                    J_numeric[i * blockSizes[k] + j] = (r_plus[i] - r_minus[i]) / (2.0 * h);
+                }
+            }
+
+            ok &= compare(name, blockNames[k], J[k].data(), J_numeric.data(),
+                          m * blockSizes[k], kNumericTolerance);
+        }
+
+        delete costFunction;
+    }
+
+    return ok;
+}
+
+}
+
+int
+main(int argc, char** argv)
+{
+    bool ok = true;
+
+    ok &= testModel("Pinhole", CameraPtr(new PinholeCamera));
+    ok &= testModel("Mei", CameraPtr(new CataCamera));
+    ok &= testModel("Kannala-Brandt", CameraPtr(new EquidistantCamera));
+    ok &= testModel("OCAM", CameraPtr(new OCAMCamera));
+
+    ok &= testView("Pinhole", CameraPtr(new PinholeCamera));
+    ok &= testView("Mei", CameraPtr(new CataCamera));
+    ok &= testView("Kannala-Brandt", CameraPtr(new EquidistantCamera));
+    ok &= testView("OCAM", CameraPtr(new OCAMCamera));
+
+    if (!ok)
+    {
+        return 1;
+    }
+
+    std::cout << "Analytic derivatives agree with the references" << std::endl;
+
+    return 0;
+}